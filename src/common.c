@@ -23,8 +23,11 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/syscall.h>
 #ifndef SYS_getrandom
 # include <fcntl.h>
@@ -32,52 +35,64 @@
 
 #include "common.h"
 
+/* Kernel entropy source, used only to seed the generator below.
+ */
+
 #ifdef SYS_getrandom
 
 static int
-getrandom_get(unsigned char *outbuf, const size_t outbuf_size)
+kernel_random_get(unsigned char *outbuf, const size_t outbuf_size)
 {
-	/* No, you don't need more than 64 bytes. */
-	if (outbuf_size > 64) {
-		return 1;
-	}
+	size_t bytes_needed = outbuf_size;
+	unsigned char *cur_outbuf = outbuf;
+	long ret = 0;
 
-	int ret = 0;
-	for (;;) {
-		ret = syscall(SYS_getrandom, outbuf, outbuf_size, 0);
-		if (ret >= 0) {
-			break;
-		}
+	while (bytes_needed > 0) {
+		ret = syscall(SYS_getrandom, cur_outbuf, bytes_needed, 0);
+		if (ret < 0) {
+			if (errno != EINTR) {
+				goto fail_read;
+			}
 
-		if (errno != EINTR) {
-			return 1;
+			continue;
 		}
-	}
 
-	if (ret != (int) outbuf_size) {
-		bzero(outbuf, outbuf_size);
-		return 1;
+		bytes_needed -= ret;
+		cur_outbuf += ret;
 	}
 
 	return 0;
+
+fail_read:
+	bzero(outbuf, outbuf_size);
+
+	return 1;
 }
 
 #else /* SYS_getrandom */
 
 static int urandom_fd = -1;
+static pthread_mutex_t urandom_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int urandom_open(void)
 {       
+	pthread_mutex_lock(&urandom_lock);
 	for (;;) {
+		if (urandom_fd >= 0) {
+			break;
+		}
+
 		urandom_fd = open("/dev/urandom", O_RDONLY);
 		if (urandom_fd >= 0) {
 			break;
 		}
 
 		if (errno != EINTR) {
+			pthread_mutex_unlock(&urandom_lock);
 			return 1;
 		}
 	}
+	pthread_mutex_unlock(&urandom_lock);
 
 	return 0;
 }
@@ -90,7 +105,7 @@ static void urandom_close(void)
 	}
 }
 
-static int urandom_get(unsigned char *outbuf, const size_t outbuf_size)
+static int kernel_random_get(unsigned char *outbuf, const size_t outbuf_size)
 {       
 	if (urandom_fd == -1) {
 		return 1;
@@ -136,43 +151,330 @@ fail_read:
 
 #endif /* SYS_getrandom */
 
+/* ChaCha20 keystream generator.
+ *
+ * Output is served from a buffer of keystream blocks.  Every refill
+ * also replaces the key with a block of the same keystream ("fast key
+ * erasure"), and served bytes are wiped, so the state in memory never
+ * reveals past output.  The key is mixed with fresh kernel
+ * entropy every RANDOM_RESEED_BYTES of output and on request.
+ *
+ * Each thread has its own generator, seeded on first use, so threads
+ * never wait on each other.  A forked child starts with none, so it
+ * never repeats what its parent draws.
+ */
+
+#define CHACHA_BLOCK         64
+#define CHACHA_KEY           32
+#define RANDOM_BUF_BLOCKS    16
+#define RANDOM_BUF_SIZE      (RANDOM_BUF_BLOCKS * CHACHA_BLOCK)
+#define RANDOM_RESEED_BYTES  (16 * 1024 * 1024)
+
+static __thread struct {
+	uint32_t      key[CHACHA_KEY / 4];
+	unsigned char buf[RANDOM_BUF_SIZE];
+	size_t        buf_pos;       /* first unserved byte of buf */
+	size_t        since_reseed;  /* bytes served since the last reseed */
+	int           seeded;
+} rng;
+
+static void
+wipe(void *ptr, size_t len)
+{
+	volatile unsigned char *p = ptr;
+
+	while (len-- > 0) {
+		*p++ = 0;
+	}
+}
+
+#define ROTL32(v, n)  (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER_ROUND(a, b, c, d)                       \
+	a += b; d ^= a; d = ROTL32(d, 16);              \
+	c += d; b ^= c; b = ROTL32(b, 12);              \
+	a += b; d ^= a; d = ROTL32(d, 8);               \
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+/* Block 'counter' of the keystream under 'key', with a zero nonce.
+ * The key changes after every use, so the nonce never repeats a
+ * (key, counter) pair.
+ */
+static void
+chacha20_block(const uint32_t key[8], uint32_t counter, unsigned char out[CHACHA_BLOCK])
+{
+	uint32_t in[16], x[16];
+	int i;
+
+	in[0] = 0x61707865;
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (i = 0; i < 8; i++) {
+		in[4 + i] = key[i];
+	}
+	in[12] = counter;
+	in[13] = in[14] = in[15] = 0;
+
+	memcpy(x, in, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTER_ROUND(x[0], x[4], x[8],  x[12]);
+		QUARTER_ROUND(x[1], x[5], x[9],  x[13]);
+		QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+		QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+		QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+		QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+		QUARTER_ROUND(x[2], x[7], x[8],  x[13]);
+		QUARTER_ROUND(x[3], x[4], x[9],  x[14]);
+	}
+
+	for (i = 0; i < 16; i++) {
+		x[i] += in[i];
+		out[4*i]     = x[i];
+		out[4*i + 1] = x[i] >> 8;
+		out[4*i + 2] = x[i] >> 16;
+		out[4*i + 3] = x[i] >> 24;
+	}
+
+	wipe(x, sizeof(x));
+	wipe(in, sizeof(in));
+}
+
+/* Fills 'out' with keystream, whole blocks straight into the caller's
+ * buffer, then replaces the key with block 0 of the same stream.
+ */
+static void
+chacha20_stream(unsigned char *out, size_t len)
+{
+	unsigned char block[CHACHA_BLOCK];
+	uint32_t counter = 1;
+
+	for (; len >= CHACHA_BLOCK; len -= CHACHA_BLOCK, out += CHACHA_BLOCK) {
+		chacha20_block(rng.key, counter++, out);
+	}
+	if (len > 0) {
+		chacha20_block(rng.key, counter, block);
+		memcpy(out, block, len);
+	}
+
+	chacha20_block(rng.key, 0, block);
+	memcpy(rng.key, block, CHACHA_KEY);
+	wipe(block, sizeof(block));
+}
+
+static void
+random_refill(void)
+{
+	chacha20_stream(rng.buf, RANDOM_BUF_SIZE);
+	rng.buf_pos = 0;
+}
+
+/* The child of fork() only has the forking thread, whose generator
+ * is a copy of the parent's: wipe it so the next draw reseeds.
+ */
+static void
+random_atfork_child(void)
+{
+	strong_random_forget();
+}
+
+static void
+random_atfork_register(void)
+{
+	pthread_atfork(NULL, NULL, random_atfork_child);
+}
+
 int
 strong_random_init(void)
 {
+	static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&atfork_once, random_atfork_register);
 #ifndef SYS_getrandom
-	return urandom_open();
-#else /* SYS_getrandom */
-	return 0;
+	if (urandom_open() != 0) {
+		return 1;
+	}
 #endif /* SYS_getrandom */
+	return strong_random_reseed();
 }
 
 void
 strong_random_destroy(void)
 {
+	strong_random_forget();
 #ifndef SYS_getrandom
 	urandom_close();
 #endif /* SYS_getrandom */
 }
 
+/* Wipes the generator of the calling thread; a thread that used it
+ * calls this before it exits.
+ */
+void
+strong_random_forget(void)
+{
+	wipe(&rng, sizeof(rng));
+}
+
+/* Mixes fresh kernel entropy into the key and drops any buffered
+ * output, so nothing generated before the call can be predicted from
+ * what is generated after it.
+ */
 int
 strong_random_reseed(void)
 {
+	uint32_t seed[CHACHA_KEY / 4];
+	int i;
+
+	if (kernel_random_get((unsigned char *) seed, sizeof(seed)) != 0) {
+		return 1;
+	}
+
+	for (i = 0; i < CHACHA_KEY / 4; i++) {
+		rng.key[i] ^= seed[i];
+	}
+	wipe(seed, sizeof(seed));
+
+	wipe(rng.buf, sizeof(rng.buf));
+	rng.buf_pos = RANDOM_BUF_SIZE;
+	rng.since_reseed = 0;
+	rng.seeded = 1;
+
 	return 0;
 }
 
+/* Any amount of output.  Small requests are served from the buffer;
+ * large ones are generated in place, bounded only by cipher speed.
+ */
 int
 strong_random_get(unsigned char *outbuf, const size_t outbuf_size)
 {
-#ifndef SYS_getrandom
-	return urandom_get(outbuf, outbuf_size);
-#else /* SYS_getrandom */
-	return getrandom_get(outbuf, outbuf_size);
-#endif /* SYS_getrandom */
+	size_t bytes_needed = outbuf_size;
+	size_t chunk;
+
+	if (outbuf == NULL) {
+		return 1;
+	}
+
+	while (bytes_needed > 0) {
+		if (!rng.seeded || rng.since_reseed >= RANDOM_RESEED_BYTES) {
+			if (strong_random_reseed() != 0) {
+				bzero(outbuf, outbuf_size);
+				return 1;
+			}
+		}
+
+		if (rng.buf_pos == RANDOM_BUF_SIZE && bytes_needed >= RANDOM_BUF_SIZE) {
+			chunk = bytes_needed - bytes_needed % CHACHA_BLOCK;
+			if (chunk > RANDOM_RESEED_BYTES - rng.since_reseed) {
+				chunk = RANDOM_RESEED_BYTES - rng.since_reseed;
+			}
+			chacha20_stream(outbuf, chunk);
+		} else {
+			if (rng.buf_pos == RANDOM_BUF_SIZE) {
+				random_refill();
+			}
+			chunk = RANDOM_BUF_SIZE - rng.buf_pos;
+			if (chunk > bytes_needed) {
+				chunk = bytes_needed;
+			}
+			memcpy(outbuf, rng.buf + rng.buf_pos, chunk);
+			wipe(rng.buf + rng.buf_pos, chunk);
+			rng.buf_pos += chunk;
+		}
+
+		outbuf += chunk;
+		bytes_needed -= chunk;
+		rng.since_reseed += chunk;
+	}
+
+	return 0;
+}
+
+/* Error traps
+ *
+ * Library entry points push a trap for the calling thread.  While one
+ * is pushed, error(), fatal() and warning() record their message in
+ * it instead of printing it, and fatal() and terminate() jump back to
+ * the entry point instead of exiting.  The first message of each kind
+ * is kept, as later ones tend to be its consequences.
+ *
+ * Code holding a lock pushes a cleanup that releases it; a jump runs
+ * the cleanups pushed since its trap, newest first.
+ */
+
+static __thread error_trap_t    *trap_top    = NULL;
+static __thread error_cleanup_t *cleanup_top = NULL;
+
+void
+error_trap_push(error_trap_t *trap)
+{
+	trap->msg[0] = '\0';
+	trap->warning[0] = '\0';
+	trap->cleanups = cleanup_top;
+	trap->prev = trap_top;
+	trap_top = trap;
+}
+
+void
+error_trap_pop(error_trap_t *trap)
+{
+	trap_top = trap->prev;
+}
+
+void
+error_cleanup_push(error_cleanup_t *cleanup, void (*fn)(void *), void *arg)
+{
+	cleanup->fn = fn;
+	cleanup->arg = arg;
+	cleanup->prev = cleanup_top;
+	cleanup_top = cleanup;
+}
+
+void
+error_cleanup_pop(error_cleanup_t *cleanup)
+{
+	cleanup_top = cleanup->prev;
+}
+
+void
+error_cleanup_unlock(void *mutex)
+{
+	pthread_mutex_unlock((pthread_mutex_t *) mutex);
+}
+
+static void
+trap_record(error_trap_t *trap, const char *format, va_list va)
+{
+	if (trap->msg[0] == '\0') {
+		vsnprintf(trap->msg, sizeof(trap->msg), format, va);
+	}
+}
+
+static void
+trap_spring(void)
+{
+	error_trap_t *trap = trap_top;
+	error_cleanup_t *cleanup;
+
+	if (trap->msg[0] == '\0') {
+		snprintf(trap->msg, sizeof(trap->msg), "Internal error");
+	}
+	while (cleanup_top != trap->cleanups) {
+		cleanup = cleanup_top;
+		cleanup_top = cleanup->prev;
+		cleanup->fn(cleanup->arg);
+	}
+	trap_top = trap->prev;
+	longjmp(trap->env, 1);
 }
 
 void
 terminate(const int exit_code)
 {
+	if (trap_top) {
+		trap_spring();
+	}
+
 	strong_random_destroy();
 	exit(exit_code);
 }
@@ -199,6 +501,13 @@ error(const char *format, ...)
 	va_list va;
 	char *msg;
 
+	if (trap_top) {
+		va_start(va, format);
+		trap_record(trap_top, format, va);
+		va_end(va);
+		return;
+	}
+
 	va_start(va, format);
 	msg = format_msg(format, va);
 	va_end(va);
@@ -213,6 +522,15 @@ warning(const char *format, ...)
 	va_list va;
 	char *msg;
 
+	if (trap_top) {
+		if (trap_top->warning[0] == '\0') {
+			va_start(va, format);
+			vsnprintf(trap_top->warning, sizeof(trap_top->warning), format, va);
+			va_end(va);
+		}
+		return;
+	}
+
 	va_start(va, format);
 	msg = format_msg(format, va);
 	va_end(va);
@@ -227,6 +545,13 @@ fatal(const char *format, ...)
 	va_list va;
 	char *msg;
 
+	if (trap_top) {
+		va_start(va, format);
+		trap_record(trap_top, format, va);
+		va_end(va);
+		trap_spring();
+	}
+
 	va_start(va, format);
 	msg = format_msg(format, va);
 	va_end(va);
@@ -264,3 +589,14 @@ xcalloc(size_t nmemb, size_t size)
 	return ptr;
 }
 
+void *
+xrealloc(void *ptr, size_t size)
+{
+	if (size == 0)
+		fatal("Zero size");
+
+	ptr = realloc(ptr, size);
+	if (ptr == NULL)
+		fatal("Can't allocate memory!");
+	return ptr;
+}
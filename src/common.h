@@ -20,12 +20,37 @@
 
 #ifndef COMMON_H
 #define COMMON_H
- 
+
+#include <stdarg.h>
+#include <setjmp.h>
+
 int	strong_random_init(void);
 void	strong_random_destroy(void);
 int	strong_random_reseed(void);
+void	strong_random_forget(void);
 int	strong_random_get(unsigned char *outbuf, const size_t outbuf_size);
 
+/* Undoes what a jump out of a trap would leave behind, like a held lock */
+typedef struct error_cleanup {
+	void                (*fn)(void *);
+	void                 *arg;
+	struct error_cleanup *prev;
+} error_cleanup_t;
+
+typedef struct error_trap {
+	jmp_buf            env;
+	char               msg[256];
+	char               warning[256];
+	error_cleanup_t   *cleanups;  /* pushed before the trap */
+	struct error_trap *prev;
+} error_trap_t;
+
+void	error_trap_push(error_trap_t *trap);
+void	error_trap_pop(error_trap_t *trap);
+void	error_cleanup_push(error_cleanup_t *cleanup, void (*fn)(void *), void *arg);
+void	error_cleanup_pop(error_cleanup_t *cleanup);
+void	error_cleanup_unlock(void *mutex);
+
 void	terminate(const int exit_code);
 char	*format_msg (const char *, va_list);
 void	error(const char *, ...);
@@ -33,5 +58,6 @@ void	warning(const char *, ...);
 void	fatal(const char *, ...);
 void	*xmalloc(size_t);
 void	*xcalloc(size_t, size_t);
+void	*xrealloc(void *, size_t);
 
 #endif
@@ -0,0 +1,392 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* Bulk generation of distinct addresses
+ *
+ * The work is split across one thread per CPU.  Every thread draws
+ * addresses exactly as a single change would, drops the ones already
+ * seen by any thread, and writes the rest in large formatted chunks.
+ *
+ * Addresses already seen are kept in a bitset of the three random
+ * bytes when the vendor is fixed, and in a lock-free open addressing
+ * hash set otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "generate.h"
+#include "maclist.h"
+#include "common.h"
+
+#define GEN_BATCH           4096      /* addresses per write */
+#define GEN_MIN_PER_THREAD  65536
+#define GEN_MAX_THREADS     64
+#define GEN_ENDING_SPACE    (1UL << 24)
+
+typedef struct {
+	mc_generate_mode_t mode;
+	mac_t              base;
+	mac_type_t         kind;
+	char               set_bia;
+	mc_vendor_picker_t *picker;
+	mc_shard_t         shard;
+
+	uint64_t          *bits;   /* ending mode: one bit per address */
+	uint64_t          *slots;  /* otherwise: hash set, 0 is empty  */
+	size_t             mask;
+	int                shift;
+
+	int                out_fd;
+	pthread_mutex_t    out_lock;
+	int                failed;
+	char               msg[256];  /* first error of any worker */
+} gen_shared_t;
+
+typedef struct {
+	gen_shared_t *shared;
+	unsigned long count;
+	pthread_t     thread;
+} gen_worker_t;
+
+
+static void
+gen_one (const gen_shared_t *s, mac_t *mac)
+{
+	*mac = s->base;
+
+	switch (s->mode) {
+	case mc_generate_random:
+		mc_mac_random (mac, 6, s->set_bia);
+		break;
+	case mc_generate_ending:
+		mc_mac_random (mac, 3, 1);
+		break;
+	case mc_generate_vendor:
+		mc_maclist_pick_vendor (s->picker, mac, s->kind);
+		mc_mac_random (mac, 3, 1);
+		break;
+	case mc_generate_shard:
+		mc_mac_random_shard (mac, &s->shard);
+		break;
+	}
+}
+
+
+/* Whether 'mac' is one the mode could make, for the modes with a
+ * space small enough to run out of.
+ */
+static int
+gen_in_space (const gen_shared_t *s, const mac_t *mac)
+{
+	unsigned long node;
+
+	switch (s->mode) {
+	case mc_generate_ending:
+		return memcmp (mac->byte, s->base.byte, 3) == 0;
+	case mc_generate_shard:
+		return (mac->byte[0] & 3) == 2 &&
+		       mc_mac_shard (mac, s->shard.bits, &node) == 0 && node == s->shard.node;
+	default:
+		return 1;
+	}
+}
+
+
+/* Returns 1 if 'mac' had not been seen before, by any thread */
+static int
+gen_insert (gen_shared_t *s, const mac_t *mac)
+{
+	uint64_t key = 0, bit, cur;
+	size_t   i;
+	int      n;
+
+	for (n=0; n<6; n++) {
+		key = (key << 8) | mac->byte[n];
+	}
+
+	if (s->bits) {
+		i   = key & (GEN_ENDING_SPACE - 1);
+		bit = (uint64_t) 1 << (i & 63);
+		return !(__atomic_fetch_or (&s->bits[i >> 6], bit, __ATOMIC_RELAXED) & bit);
+	}
+
+	key |= (uint64_t) 1 << 63;
+	i = (key * 0x9E3779B97F4A7C15ull) >> s->shift;
+	for (;;) {
+		cur = __atomic_load_n (&s->slots[i], __ATOMIC_RELAXED);
+		if (cur == 0 &&
+		    __atomic_compare_exchange_n (&s->slots[i], &cur, key, 0,
+						 __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			return 1;
+		}
+		if (cur == key) {
+			return 0;
+		}
+		i = (i + 1) & s->mask;
+	}
+}
+
+
+static void
+gen_write (gen_shared_t *s, const char *text, size_t len)
+{
+	ssize_t n;
+
+	pthread_mutex_lock (&s->out_lock);
+	while (len > 0 && !s->failed) {
+		n = write (s->out_fd, text, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error ("Could not write output: %s", strerror (errno));
+			__atomic_store_n (&s->failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		text += n;
+		len  -= n;
+	}
+	pthread_mutex_unlock (&s->out_lock);
+}
+
+
+static void
+gen_fail (gen_shared_t *s, const char *msg)
+{
+	pthread_mutex_lock (&s->out_lock);
+	if (s->msg[0] == '\0') {
+		snprintf (s->msg, sizeof(s->msg), "%s", msg);
+	}
+	__atomic_store_n (&s->failed, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&s->out_lock);
+}
+
+
+static void
+gen_run (gen_worker_t *w)
+{
+	gen_shared_t *s = w->shared;
+	mac_t        *batch;
+	char         *text;
+	size_t        n = 0;
+
+	batch = (mac_t *) xmalloc (sizeof(mac_t) * GEN_BATCH);
+	text  = (char *) xmalloc (MC_MAC_LINE_LEN * GEN_BATCH);
+
+	while (w->count > 0 && !__atomic_load_n (&s->failed, __ATOMIC_RELAXED)) {
+		gen_one (s, &batch[n]);
+		if (!gen_insert (s, &batch[n])) {
+			continue;
+		}
+
+		w->count--;
+		if (++n == GEN_BATCH || w->count == 0) {
+			mc_mac_format_lines (batch, n, text);
+			gen_write (s, text, n * MC_MAC_LINE_LEN);
+			n = 0;
+		}
+	}
+
+	free (text);
+	free (batch);
+}
+
+
+/* Errors are caught per thread and reported once by the caller, so
+ * neither the tool nor the library gets them from a worker.
+ */
+static void *
+gen_worker (void *arg)
+{
+	gen_worker_t *w = arg;
+	error_trap_t  trap;
+
+	error_trap_push (&trap);
+	if (setjmp (trap.env) == 0) {
+		gen_run (w);
+		error_trap_pop (&trap);
+	}
+	if (trap.msg[0] != '\0') {
+		gen_fail (w->shared, trap.msg);
+	}
+
+	strong_random_forget ();
+	return NULL;
+}
+
+
+/* Writes 'count' distinct addresses to 'out_fd', one per line.
+ * Returns 0, or -1 on error.
+ */
+int
+mc_generate_stream (int out_fd, unsigned long count, mc_generate_mode_t mode,
+		    const mac_t *base, mac_type_t kind, char set_bia,
+		    mc_vendor_picker_t *picker, const mc_shard_t *shard,
+		    const mac_t *avoid, size_t navoid)
+{
+	gen_shared_t  s;
+	gen_worker_t *workers;
+	mac_t         scratch;
+	unsigned long per_thread;
+	uint64_t      space = UINT64_MAX;   /* a shard has up to 2^45 */
+	long          nthreads;
+	size_t        slots, j;
+	int           i, started;
+
+	memset (&s, 0, sizeof(s));
+	s.mode    = mode;
+	s.base    = *base;
+	s.kind    = kind;
+	s.set_bia = set_bia;
+	s.picker  = picker;
+	s.out_fd  = out_fd;
+
+	if (mode == mc_generate_ending) {
+		space = GEN_ENDING_SPACE;
+	} else if (mode == mc_generate_shard) {
+		s.shard = *shard;
+		space   = (uint64_t) 1 << (MC_SHARD_FREE_BITS - shard->bits);
+	}
+
+	/* Addresses in use take room from a small space */
+	for (j=0; j<navoid && space != UINT64_MAX; j++) {
+		if (gen_in_space (&s, &avoid[j])) {
+			space--;
+		}
+	}
+	if (count > space) {
+		error ("There are only %llu free addresses %s", (unsigned long long) space,
+		       (mode == mc_generate_ending) ? "with the same vendor" : "in the shard");
+		return -1;
+	}
+
+	pthread_mutex_init (&s.out_lock, NULL);
+
+	if (mode == mc_generate_ending) {
+		s.bits = (uint64_t *) xcalloc (GEN_ENDING_SPACE / 64, sizeof(uint64_t));
+	} else {
+		/* At most half full */
+		for (slots = 1024, s.shift = 54; slots < 2 * (count + navoid); slots <<= 1) {
+			s.shift--;
+		}
+		s.slots = (uint64_t *) xcalloc (slots, sizeof(uint64_t));
+		s.mask  = slots - 1;
+	}
+
+	/* Taken already, as if generated */
+	for (j=0; j<navoid; j++) {
+		if (mode != mc_generate_ending || gen_in_space (&s, &avoid[j])) {
+			gen_insert (&s, &avoid[j]);
+		}
+	}
+
+	/* The vendor lists load on first use; do it before the threads
+	 * start, so they only ever read them.
+	 */
+	if (mode == mc_generate_vendor) {
+		mc_maclist_pick_vendor (picker, &scratch, kind);
+	}
+
+	nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+	if (nthreads > (long) (count / GEN_MIN_PER_THREAD)) {
+		nthreads = count / GEN_MIN_PER_THREAD;
+	}
+	if (nthreads > GEN_MAX_THREADS) {
+		nthreads = GEN_MAX_THREADS;
+	}
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+
+	workers    = (gen_worker_t *) xcalloc (nthreads, sizeof(gen_worker_t));
+	per_thread = count / nthreads;
+	for (i=0; i<nthreads; i++) {
+		workers[i].shared = &s;
+		workers[i].count  = per_thread + ((unsigned long) i < count % nthreads);
+	}
+
+	/* The calling thread is worker 0 */
+	for (started=1; started<nthreads; started++) {
+		if (pthread_create (&workers[started].thread, NULL, gen_worker,
+				    &workers[started]) != 0) {
+			gen_fail (&s, "Could not start a generator thread");
+			break;
+		}
+	}
+	gen_worker (&workers[0]);
+	for (i=1; i<started; i++) {
+		pthread_join (workers[i].thread, NULL);
+	}
+
+	pthread_mutex_destroy (&s.out_lock);
+	free (workers);
+	free (s.bits);
+	free (s.slots);
+
+	if (s.msg[0] != '\0') {
+		error ("%s", s.msg);
+	}
+	return s.failed ? -1 : 0;
+}
+
+
+int
+mc_generate_pool (int out_fd, unsigned long count, mc_pool_t *pool)
+{
+	gen_shared_t  s;
+	mac_t        *batch;
+	char         *text;
+	size_t        n;
+	int           ret = 0;
+
+	memset (&s, 0, sizeof(s));
+	s.out_fd = out_fd;
+	pthread_mutex_init (&s.out_lock, NULL);
+
+	batch = (mac_t *) xmalloc (sizeof(mac_t) * GEN_BATCH);
+	text  = (char *) xmalloc (MC_MAC_LINE_LEN * GEN_BATCH);
+
+	while (count > 0 && !s.failed) {
+		n = (count < GEN_BATCH) ? count : GEN_BATCH;
+		if (mc_pool_alloc (pool, batch, n) < 0) {
+			ret = -1;
+			break;
+		}
+		mc_mac_format_lines (batch, n, text);
+		gen_write (&s, text, n * MC_MAC_LINE_LEN);
+		count -= n;
+	}
+
+	free (text);
+	free (batch);
+	pthread_mutex_destroy (&s.out_lock);
+	return (ret < 0 || s.failed) ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef __MAC_CHANGER_GENERATE_H__
+#define __MAC_CHANGER_GENERATE_H__
+
+#include "mac.h"
+#include "maclist.h"
+#include "pool.h"
+
+typedef enum {
+	mc_generate_random,   /* any unicast address, as --random   */
+	mc_generate_ending,   /* keep the vendor of 'base', as --ending */
+	mc_generate_vendor,   /* a random vendor of 'kind', as --another */
+	mc_generate_shard     /* in 'shard', as --shard */
+} mc_generate_mode_t;
+
+/* 'picker' is NULL for the process wide vendor distribution, and
+ * 'shard' only used by mc_generate_shard.  The 'navoid' addresses of
+ * 'avoid' are never written.
+ */
+int mc_generate_stream (int out_fd, unsigned long count, mc_generate_mode_t mode,
+			const mac_t *base, mac_type_t kind, char set_bia,
+			mc_vendor_picker_t *picker, const mc_shard_t *shard,
+			const mac_t *avoid, size_t navoid);
+
+/* 'count' addresses allocated from 'pool'.  Those written before a
+ * failure stay allocated.
+ */
+int mc_generate_pool   (int out_fd, unsigned long count, mc_pool_t *pool);
+
+#endif /* __MAC_CHANGER_GENERATE_H__ */
@@ -0,0 +1,200 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "inuse.h"
+#include "common.h"
+
+#define INUSE_MIN_SLOTS  1024
+
+struct mc_inuse {
+	pthread_mutex_t  lock;
+	unsigned int     refs;
+	uint64_t        *slots;     /* address | bit 63, 0 is empty */
+	size_t           mask;
+	size_t           len;
+	int              shift;
+};
+
+
+static uint64_t
+inuse_key (const mac_t *mac)
+{
+	uint64_t key = 0;
+	int      i;
+
+	for (i=0; i<6; i++) {
+		key = (key << 8) | mac->byte[i];
+	}
+	return key | ((uint64_t) 1 << 63);
+}
+
+
+/* Returns 1 if 'key' went in, 0 if it was there */
+static int
+inuse_insert (uint64_t *slots, size_t mask, int shift, uint64_t key)
+{
+	size_t i;
+
+	for (i = (key * 0x9E3779B97F4A7C15ull) >> shift; slots[i] != 0; i = (i + 1) & mask) {
+		if (slots[i] == key) {
+			return 0;
+		}
+	}
+
+	slots[i] = key;
+	return 1;
+}
+
+
+/* Keeps the table at most half full */
+static void
+inuse_grow (mc_inuse_t *set)
+{
+	uint64_t *slots;
+	size_t    size, i;
+
+	if (2 * (set->len + 1) <= set->mask + 1) {
+		return;
+	}
+
+	size  = 2 * (set->mask + 1);
+	slots = (uint64_t *) xcalloc (size, sizeof(uint64_t));
+	for (i=0; i<=set->mask; i++) {
+		if (set->slots[i] != 0) {
+			inuse_insert (slots, size - 1, set->shift - 1, set->slots[i]);
+		}
+	}
+
+	free (set->slots);
+	set->slots = slots;
+	set->mask  = size - 1;
+	set->shift--;
+}
+
+
+mc_inuse_t *
+mc_inuse_new (void)
+{
+	mc_inuse_t *set;
+
+	set = (mc_inuse_t *) xcalloc (1, sizeof(mc_inuse_t));
+	set->refs  = 1;
+	set->slots = (uint64_t *) xcalloc (INUSE_MIN_SLOTS, sizeof(uint64_t));
+	set->mask  = INUSE_MIN_SLOTS - 1;
+	set->shift = 54;             /* 64 - log2 (INUSE_MIN_SLOTS) */
+	pthread_mutex_init (&set->lock, NULL);
+
+	return set;
+}
+
+
+mc_inuse_t *
+mc_inuse_ref (mc_inuse_t *set)
+{
+	pthread_mutex_lock (&set->lock);
+	set->refs++;
+	pthread_mutex_unlock (&set->lock);
+
+	return set;
+}
+
+
+void
+mc_inuse_unref (mc_inuse_t *set)
+{
+	unsigned int refs;
+
+	if (set == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&set->lock);
+	refs = --set->refs;
+	pthread_mutex_unlock (&set->lock);
+
+	if (refs == 0) {
+		pthread_mutex_destroy (&set->lock);
+		free (set->slots);
+		free (set);
+	}
+}
+
+
+int
+mc_inuse_claim (mc_inuse_t *set, const mac_t *mac)
+{
+	error_cleanup_t unlock;
+	int             added;
+
+	pthread_mutex_lock (&set->lock);
+	error_cleanup_push (&unlock, error_cleanup_unlock, &set->lock);
+	inuse_grow (set);
+	added = inuse_insert (set->slots, set->mask, set->shift, inuse_key (mac));
+	set->len += added;
+	error_cleanup_pop (&unlock);
+	pthread_mutex_unlock (&set->lock);
+
+	return added;
+}
+
+
+void
+mc_inuse_add (mc_inuse_t *set, const mac_t *mac)
+{
+	mc_inuse_claim (set, mac);
+}
+
+
+mac_t *
+mc_inuse_list (mc_inuse_t *set, size_t *n)
+{
+	error_cleanup_t unlock;
+	mac_t          *list;
+	uint64_t        key;
+	size_t          i;
+	int             b;
+
+	pthread_mutex_lock (&set->lock);
+	error_cleanup_push (&unlock, error_cleanup_unlock, &set->lock);
+	list = (mac_t *) xmalloc ((set->len + 1) * sizeof(mac_t));
+	*n   = 0;
+	for (i=0; i<=set->mask; i++) {
+		if ((key = set->slots[i]) == 0) {
+			continue;
+		}
+		for (b=5; b>=0; b--, key >>= 8) {
+			list[*n].byte[b] = key & 0xff;
+		}
+		(*n)++;
+	}
+	error_cleanup_pop (&unlock);
+	pthread_mutex_unlock (&set->lock);
+
+	return list;
+}
@@ -0,0 +1,58 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef __MAC_CHANGER_INUSE_H__
+#define __MAC_CHANGER_INUSE_H__
+
+#include <stddef.h>
+#include "mac.h"
+
+/* Addresses already in use
+ *
+ * An open addressing hash set of 48-bit addresses, filled from the
+ * links and the neighbour tables of the namespace and grown by every
+ * address picked while it is in use.  Lookups and inserts take one
+ * lock and a probe or two, so a candidate costs well under a
+ * microsecond to check.  Contexts, and the threads behind them, can
+ * share one set; it goes away with its last reference.
+ */
+
+typedef struct mc_inuse mc_inuse_t;
+
+mc_inuse_t *mc_inuse_new   (void);
+mc_inuse_t *mc_inuse_ref   (mc_inuse_t *);
+void        mc_inuse_unref (mc_inuse_t *);
+
+void        mc_inuse_add   (mc_inuse_t *, const mac_t *);
+
+/* Adds 'mac' if it was not there.  Returns 1 if it was added, 0 if
+ * it was already in use.
+ */
+int         mc_inuse_claim (mc_inuse_t *, const mac_t *);
+
+/* Every address in the set, in no particular order */
+mac_t      *mc_inuse_list  (mc_inuse_t *, size_t *n);
+
+#endif /* __MAC_CHANGER_INUSE_H__ */
@@ -0,0 +1,1419 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+/* libmacchanger: the public API of macchanger.h
+ *
+ * The rest of the tree reports failures through error() and fatal().
+ * Every entry point here pushes an error trap first, so that those
+ * land back in the entry point as a message in the context and a -1
+ * return, instead of on stderr or in exit().
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <net/if_arp.h>
+
+#include "macchanger.h"
+#include "mac.h"
+#include "maclist.h"
+#include "netinfo.h"
+#include "netlink.h"
+#include "resolve.h"
+#include "generate.h"
+#include "state.h"
+#include "inuse.h"
+#include "pool.h"
+#include "common.h"
+
+struct macchanger {
+	mc_vendor_picker_t *picker;
+	mc_netlink_t       *nl;      /* address changes, opened on first use */
+	int                 no_netlink;
+	int                 watch;   /* link events, or -1 */
+	mc_state_t         *state;   /* original addresses, if kept */
+	mc_inuse_t         *inuse;   /* addresses to pass over, if any */
+	int                 inuse_local;  /* ... without the neighbours' */
+	mc_shard_t          shard;   /* of MACCHANGER_SHARD */
+	mc_pool_t          *pool;    /* of MACCHANGER_POOL, if open */
+	char                error[256];
+	char                warning[256];  /* not yet handed out */
+	char                warned[256];   /* the one handed out last */
+};
+
+#define WATCH_RCVBUF  (4 << 20)   /* events a burst may leave waiting */
+#define INUSE_TRIES   1000        /* candidates to try before giving up */
+
+/* The vendor lists and the socket for the interface ioctls are
+ * shared; the last context out releases them.
+ */
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int    contexts      = 0;
+static int             shared_sock   = -1;
+
+
+/* Evaluates 'call' under an error trap and stores its result in
+ * 'ret'.  A fatal() inside it jumps back here as a -1; anything
+ * reported through error() before a -1 return becomes the context's
+ * message.  The first warning() is kept for macchanger_warning().
+ */
+#define API_CALL(ctx, ret, call)                                    \
+	do {                                                        \
+		error_trap_t  trap_;                                \
+		volatile int  ret_ = -1;                            \
+		(ctx)->error[0] = '\0';                             \
+		error_trap_push (&trap_);                           \
+		if (setjmp (trap_.env) == 0) {                      \
+			ret_ = (call);                              \
+			error_trap_pop (&trap_);                    \
+		}                                                   \
+		if (ret_ < 0) {                                     \
+			api_failed ((ctx), trap_.msg);              \
+		}                                                   \
+		api_warned ((ctx), trap_.warning);                  \
+		(ret) = ret_;                                       \
+	} while (0)
+
+
+static void
+api_failed (macchanger_t *ctx, const char *msg)
+{
+	snprintf (ctx->error, sizeof(ctx->error), "%s",
+		  msg[0] != '\0' ? msg : "Unknown error");
+}
+
+
+/* Earlier warnings the caller has not read yet win */
+static void
+api_warned (macchanger_t *ctx, const char *msg)
+{
+	if (msg[0] != '\0' && ctx->warning[0] == '\0') {
+		snprintf (ctx->warning, sizeof(ctx->warning), "%s", msg);
+	}
+}
+
+
+static int
+context_setup (macchanger_t *ctx)
+{
+	if (strong_random_init () != 0) {
+		error ("Failed to initialize strong RNG.");
+		return -1;
+	}
+
+	ctx->picker = mc_vendor_picker_new (mc_vendor_by_oui, NULL);
+	ctx->watch  = -1;
+	return 0;
+}
+
+
+static int
+context_init (macchanger_t *ctx)
+{
+	int ret;
+
+	API_CALL (ctx, ret, context_setup (ctx));
+	return ret;
+}
+
+
+macchanger_t *
+macchanger_new (void)
+{
+	macchanger_t *ctx;
+
+	if ((ctx = calloc (1, sizeof(macchanger_t))) == NULL) {
+		return NULL;
+	}
+
+	if (context_init (ctx) < 0) {
+		free (ctx);
+		return NULL;
+	}
+
+	pthread_mutex_lock (&contexts_lock);
+	contexts++;
+	pthread_mutex_unlock (&contexts_lock);
+
+	return ctx;
+}
+
+
+void
+macchanger_free (macchanger_t *ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+
+	mc_vendor_picker_free (ctx->picker);
+	mc_netlink_close (ctx->nl);
+	mc_state_close (ctx->state);
+	mc_inuse_unref (ctx->inuse);
+	mc_pool_close (ctx->pool);
+	if (ctx->watch >= 0) {
+		close (ctx->watch);
+	}
+
+	pthread_mutex_lock (&contexts_lock);
+	if (--contexts == 0) {
+		mc_maclist_free ();
+		if (shared_sock >= 0) {
+			close (shared_sock);
+			shared_sock = -1;
+		}
+	}
+	pthread_mutex_unlock (&contexts_lock);
+
+	strong_random_forget ();
+	free (ctx);
+}
+
+
+const char *
+macchanger_error (const macchanger_t *ctx)
+{
+	return ctx->error;
+}
+
+
+const char *
+macchanger_warning (macchanger_t *ctx)
+{
+	if (ctx->warning[0] == '\0') {
+		return NULL;
+	}
+
+	memcpy (ctx->warned, ctx->warning, sizeof(ctx->warned));
+	ctx->warning[0] = '\0';
+	return ctx->warned;
+}
+
+
+/* Replaces the picker of 'ctx', keeping the old one on failure */
+static int
+picker_replace (macchanger_t *ctx, mc_vendor_dist_t how, const char *path)
+{
+	mc_vendor_picker_t *picker;
+
+	if ((picker = mc_vendor_picker_new (how, path)) == NULL) {
+		return -1;
+	}
+
+	mc_vendor_picker_free (ctx->picker);
+	ctx->picker = picker;
+	return 0;
+}
+
+
+int
+macchanger_set_vendor_dist (macchanger_t *ctx, macchanger_vendor_dist_t dist,
+			    const char *weights_file)
+{
+	mc_vendor_dist_t how;
+	int              ret;
+
+	switch (dist) {
+	case MACCHANGER_VENDOR_BY_OUI:    how = mc_vendor_by_oui;    break;
+	case MACCHANGER_VENDOR_BY_NAME:   how = mc_vendor_by_name;   break;
+	case MACCHANGER_VENDOR_BY_WEIGHT: how = mc_vendor_by_weight; break;
+	default:
+		snprintf (ctx->error, sizeof(ctx->error), "Unknown vendor distribution");
+		return -1;
+	}
+
+	if (how == mc_vendor_by_weight && weights_file == NULL) {
+		snprintf (ctx->error, sizeof(ctx->error), "No weights file given");
+		return -1;
+	}
+
+	API_CALL (ctx, ret, picker_replace (ctx, how, weights_file));
+	return ret;
+}
+
+
+int
+macchanger_preload (macchanger_t *ctx)
+{
+	int ret;
+
+	API_CALL (ctx, ret, mc_maclist_init ());
+	return ret;
+}
+
+
+int
+macchanger_parse (macchanger_t *ctx, const char *text, macchanger_mac_t *mac)
+{
+	int ret;
+
+	API_CALL (ctx, ret, mc_mac_read_string (mac, text));
+	return ret;
+}
+
+
+void
+macchanger_format (const macchanger_mac_t *mac, char *text)
+{
+	mc_mac_into_string (mac, text);
+}
+
+
+static int
+lookup (const mac_t *mac, const char **vendor, int *is_wireless)
+{
+	const char *name;
+	int         wireless;
+
+	name = mc_maclist_lookup (mac, &wireless);
+	if (vendor) {
+		*vendor = name;
+	}
+	if (is_wireless) {
+		*is_wireless = wireless;
+	}
+	return 0;
+}
+
+
+int
+macchanger_lookup (macchanger_t *ctx, const macchanger_mac_t *mac,
+		   const char **vendor, int *is_wireless)
+{
+	int ret;
+
+	API_CALL (ctx, ret, lookup (mac, vendor, is_wireless));
+	return ret;
+}
+
+
+/* The context's pool, or NULL with an error */
+static mc_pool_t *
+pool (macchanger_t *ctx)
+{
+	if (ctx->pool == NULL) {
+		error ("No pool in use");
+	}
+	return ctx->pool;
+}
+
+
+/* Applies 'mode' to 'mac' in place, as the command line options do */
+static int
+random_once (macchanger_t *ctx, mac_t *mac, macchanger_random_t mode, int bia)
+{
+	switch (mode) {
+	case MACCHANGER_RANDOM:
+		mc_mac_random (mac, 6, bia);
+		break;
+	case MACCHANGER_ENDING:
+		mc_mac_random (mac, 3, 1);
+		break;
+	case MACCHANGER_ANOTHER:
+		mc_maclist_pick_vendor (ctx->picker, mac, mc_maclist_is_wireless (mac));
+		mc_mac_random (mac, 3, 1);
+		break;
+	case MACCHANGER_ANOTHER_ANY:
+		mc_maclist_pick_vendor (ctx->picker, mac, mac_is_anykind);
+		mc_mac_random (mac, 3, 1);
+		break;
+	case MACCHANGER_SHARD:
+		if (ctx->shard.bits == 0) {
+			error ("No shard set");
+			return -1;
+		}
+		mc_mac_random_shard (mac, &ctx->shard);
+		break;
+	case MACCHANGER_POOL:
+		if (pool (ctx) == NULL || mc_pool_alloc (ctx->pool, mac, 1) < 0) {
+			return -1;
+		}
+		break;
+	default:
+		error ("Unknown random mode");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+set_shard (macchanger_t *ctx, unsigned long node, unsigned int bits)
+{
+	mc_shard_t shard;
+
+	shard.node = node;
+	shard.bits = bits;
+	if (mc_shard_check (&shard) < 0) {
+		return -1;
+	}
+
+	ctx->shard = shard;
+	return 0;
+}
+
+
+int
+macchanger_set_shard (macchanger_t *ctx, unsigned long node, unsigned int bits)
+{
+	int ret;
+
+	API_CALL (ctx, ret, set_shard (ctx, node, bits));
+	return ret;
+}
+
+
+int
+macchanger_shard_of (macchanger_t *ctx, const macchanger_mac_t *mac, unsigned int bits,
+		     unsigned long *node)
+{
+	int ret;
+
+	API_CALL (ctx, ret, mc_mac_shard (mac, bits, node));
+	return ret;
+}
+
+
+/* As random_once(), over again while the address is in use */
+static int
+random_mac (macchanger_t *ctx, mac_t *mac, macchanger_random_t mode, int bia)
+{
+	mac_t base = *mac;
+	int   tries;
+
+	for (tries=0; tries<INUSE_TRIES; tries++) {
+		*mac = base;
+		if (random_once (ctx, mac, mode, bia) < 0) {
+			return -1;
+		}
+		if (ctx->inuse == NULL || mc_inuse_claim (ctx->inuse, mac)) {
+			return 0;
+		}
+	}
+
+	*mac = base;
+	error ("Could not find an address that is not in use");
+	return -1;
+}
+
+
+int
+macchanger_random (macchanger_t *ctx, macchanger_mac_t *mac, macchanger_random_t mode, int bia)
+{
+	int ret;
+
+	API_CALL (ctx, ret, random_mac (ctx, mac, mode, bia));
+	return ret;
+}
+
+
+/* Every context, in every thread, uses the same ioctl socket */
+static int
+device_socket (void)
+{
+	int sock;
+
+	pthread_mutex_lock (&contexts_lock);
+	if (shared_sock < 0) {
+		shared_sock = mc_net_info_socket ();
+	}
+	sock = shared_sock;
+	pthread_mutex_unlock (&contexts_lock);
+
+	return sock;
+}
+
+
+static net_info_t *
+device_open (const char *device)
+{
+	int sock;
+
+	if ((sock = device_socket ()) < 0) {
+		return NULL;
+	}
+
+	return mc_net_info_new_shared (sock, device);
+}
+
+
+static int
+devices (const char *pattern, char ***names, size_t *n)
+{
+	int sock;
+
+	if ((sock = device_socket ()) < 0) {
+		return -1;
+	}
+
+	*names = mc_net_info_devices (sock, pattern, n);
+	return 0;
+}
+
+
+int
+macchanger_devices (macchanger_t *ctx, const char *pattern, char ***names, size_t *n)
+{
+	int ret;
+
+	API_CALL (ctx, ret, devices (pattern, names, n));
+	return ret;
+}
+
+
+static int
+device_mac (const char *device, mac_t *mac, int permanent)
+{
+	net_info_t *net;
+	mac_t      *found;
+
+	if ((net = device_open (device)) == NULL) {
+		return -1;
+	}
+
+	found = permanent ? mc_net_info_get_permanent_mac (net) : mc_net_info_get_mac (net);
+	mc_net_info_free (net);
+	if (found == NULL) {
+		return -1;
+	}
+
+	*mac = *found;
+	mc_mac_free (found);
+	return 0;
+}
+
+
+int
+macchanger_get_mac (macchanger_t *ctx, const char *device, macchanger_mac_t *mac)
+{
+	int ret;
+
+	API_CALL (ctx, ret, device_mac (device, mac, 0));
+	return ret;
+}
+
+
+int
+macchanger_get_permanent_mac (macchanger_t *ctx, const char *device, macchanger_mac_t *mac)
+{
+	int ret;
+
+	API_CALL (ctx, ret, device_mac (device, mac, 1));
+	return ret;
+}
+
+
+/* The context's rtnetlink socket, or NULL if the kernel has none */
+static mc_netlink_t *
+netlink (macchanger_t *ctx)
+{
+	if (ctx->nl == NULL && !ctx->no_netlink &&
+	    (ctx->nl = mc_netlink_open ()) == NULL) {
+		ctx->no_netlink = 1;
+	}
+
+	return ctx->nl;
+}
+
+
+/* Without rtnetlink: the interface list and two ioctls per link */
+static void
+links_by_ioctl (mc_link_list_t *list)
+{
+	net_info_t *net;
+	mac_t      *mac;
+	mc_link_t  *link;
+	char      **names;
+	size_t      n, i;
+	int         sock;
+
+	if ((sock = device_socket ()) < 0) {
+		terminate (EXIT_FAILURE);
+	}
+
+	names = mc_net_info_devices (sock, "*", &n);
+	list->links = (mc_link_t *) xcalloc (n + 1, sizeof(mc_link_t));
+	list->len   = 0;
+	for (i=0; i<n; i++) {
+		if ((net = mc_net_info_new_shared (sock, names[i])) == NULL) {
+			continue;  /* gone meanwhile */
+		}
+
+		link = &list->links[list->len++];
+		snprintf (link->name, sizeof(link->name), "%s", names[i]);
+		link->index = if_nametoindex (names[i]);
+		if (net->dev.ifr_hwaddr.sa_family == ARPHRD_ETHER) {
+			mac = mc_net_info_get_mac (net);
+			link->mac     = *mac;
+			link->has_mac = 1;
+			mc_mac_free (mac);
+		}
+		mc_net_info_free (net);
+	}
+	free (names);
+}
+
+
+/* The links there are now, from one dump if the kernel allows */
+static void
+current_links (macchanger_t *ctx, mc_link_list_t *list)
+{
+	memset (list, 0, sizeof(*list));
+	if (netlink (ctx) == NULL || mc_netlink_links (ctx->nl, list) < 0) {
+		free (list->links);
+		memset (list, 0, sizeof(*list));
+		links_by_ioctl (list);
+	}
+}
+
+
+static int
+link_name_compare (const void *a, const void *b)
+{
+	return strcmp (((const mc_link_t *) a)->name, ((const mc_link_t *) b)->name);
+}
+
+
+/* In a list sorted with link_name_compare() */
+static const mc_link_t *
+link_find (const mc_link_list_t *list, const char *name)
+{
+	mc_link_t key;
+
+	snprintf (key.name, sizeof(key.name), "%s", name);
+	return bsearch (&key, list->links, list->len, sizeof(mc_link_t), link_name_compare);
+}
+
+
+static int
+mac_is_zero (const mac_t *mac)
+{
+	static const mac_t zero;
+
+	return memcmp (mac, &zero, sizeof(zero)) == 0;
+}
+
+
+static int
+link_compare (const void *a, const void *b)
+{
+	return strverscmp (((const macchanger_link_t *) a)->name,
+			   ((const macchanger_link_t *) b)->name);
+}
+
+
+static int
+links (macchanger_t *ctx, int vendors, macchanger_link_t **out, size_t *n)
+{
+	mc_link_list_t     list;
+	macchanger_link_t *all;
+	net_info_t        *net;
+	mac_t             *mac;
+	size_t             i;
+	int                sock = -1;
+
+	current_links (ctx, &list);
+
+	all = (macchanger_link_t *) xcalloc (list.len + 1, sizeof(macchanger_link_t));
+	for (i=0; i<list.len; i++) {
+		const mc_link_t *link = &list.links[i];
+
+		memcpy (all[i].name, link->name, sizeof(all[i].name));
+		all[i].index         = link->index;
+		all[i].flags         = link->flags;
+		all[i].mac           = link->mac;
+		all[i].has_mac       = link->has_mac;
+		all[i].permanent     = link->permanent;
+		all[i].has_permanent = link->has_permanent;
+
+		/* Kernels before 5.6 do not tell; ask ethtool */
+		if (link->has_mac && !list.perm_known) {
+			if (sock < 0 && (sock = device_socket ()) < 0) {
+				terminate (EXIT_FAILURE);
+			}
+			if ((net = mc_net_info_new_shared (sock, link->name)) != NULL) {
+				if ((mac = mc_net_info_get_permanent_mac (net)) != NULL) {
+					all[i].permanent     = *mac;
+					all[i].has_permanent = !mac_is_zero (mac);
+					mc_mac_free (mac);
+				}
+				mc_net_info_free (net);
+			}
+		}
+	}
+	free (list.links);
+
+	qsort (all, list.len, sizeof(macchanger_link_t), link_compare);
+
+	/* One pass over the vendor index */
+	if (vendors) {
+		for (i=0; i<list.len; i++) {
+			if (all[i].has_mac) {
+				all[i].vendor = mc_maclist_lookup (&all[i].mac, &all[i].is_wireless);
+			}
+		}
+	}
+
+	*out = all;
+	*n   = list.len;
+	return 0;
+}
+
+
+int
+macchanger_links (macchanger_t *ctx, int vendors, macchanger_link_t **out, size_t *n)
+{
+	int ret;
+
+	API_CALL (ctx, ret, links (ctx, vendors, out, n));
+	return ret;
+}
+
+
+static void
+in_use_neighbour (const mac_t *mac, void *arg)
+{
+	mc_inuse_add (arg, mac);
+}
+
+
+static int
+in_use_load (macchanger_t *ctx, macchanger_t *share)
+{
+	mc_link_list_t list;
+	mc_inuse_t    *set;
+	size_t         i;
+	int            local = 0;
+
+	if (share && share->inuse) {
+		set   = mc_inuse_ref (share->inuse);
+		local = share->inuse_local;
+	} else {
+		set = mc_inuse_new ();
+
+		current_links (ctx, &list);
+		for (i=0; i<list.len; i++) {
+			if (list.links[i].has_mac) {
+				mc_inuse_add (set, &list.links[i].mac);
+			}
+			if (list.links[i].has_permanent) {
+				mc_inuse_add (set, &list.links[i].permanent);
+			}
+		}
+		free (list.links);
+
+		if (netlink (ctx) == NULL ||
+		    mc_netlink_neighbours (ctx->nl, in_use_neighbour, set) < 0) {
+			local = 1;
+		}
+	}
+
+	mc_inuse_unref (ctx->inuse);
+	ctx->inuse       = set;
+	ctx->inuse_local = local;
+	return local;
+}
+
+
+int
+macchanger_avoid_in_use (macchanger_t *ctx, macchanger_t *share)
+{
+	int ret;
+
+	API_CALL (ctx, ret, in_use_load (ctx, share));
+	return ret;
+}
+
+
+static int
+watch_open (macchanger_t *ctx, int *fd)
+{
+	int size = WATCH_RCVBUF;
+
+	if (ctx->watch < 0) {
+		if ((ctx->watch = mc_netlink_monitor (1)) < 0) {
+			error ("Could not watch the links: %s", strerror (errno));
+			return -1;
+		}
+
+		/* Past the limit only for the privileged, which a daemon
+		 * changing addresses usually is.
+		 */
+		if (setsockopt (ctx->watch, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+			setsockopt (ctx->watch, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		}
+	}
+
+	*fd = ctx->watch;
+	return 0;
+}
+
+
+int
+macchanger_watch (macchanger_t *ctx, int *fd)
+{
+	int ret;
+
+	API_CALL (ctx, ret, watch_open (ctx, fd));
+	return ret;
+}
+
+
+static int
+watch_read (macchanger_t *ctx, macchanger_link_event_t **out, size_t *n, int *complete)
+{
+	mc_link_list_t           list;
+	macchanger_link_event_t *events;
+	size_t                   i;
+
+	if (ctx->watch < 0) {
+		error ("Not watching the links");
+		return -1;
+	}
+
+	*complete = 0;
+	memset (&list, 0, sizeof(list));
+	if (mc_netlink_events (ctx->watch, &list) < 0) {
+		if (errno != ENOBUFS) {
+			error ("Could not read link events: %s", strerror (errno));
+			free (list.links);
+			return -1;
+		}
+
+		/* Events were lost: tell of everything there is instead */
+		list.len = 0;
+		if (netlink (ctx) == NULL || mc_netlink_links (ctx->nl, &list) < 0) {
+			error ("Could not read the links: %s", strerror (errno));
+			free (list.links);
+			return -1;
+		}
+		*complete = 1;
+	}
+
+	events = (macchanger_link_event_t *) xcalloc (list.len + 1, sizeof(macchanger_link_event_t));
+	for (i=0; i<list.len; i++) {
+		const mc_link_t *link = &list.links[i];
+
+		memcpy (events[i].link.name, link->name, sizeof(events[i].link.name));
+		events[i].link.index   = link->index;
+		events[i].link.flags   = link->flags;
+		events[i].link.mac     = link->mac;
+		events[i].link.has_mac = link->has_mac;
+		events[i].removed      = link->removed;
+	}
+	free (list.links);
+
+	*out = events;
+	*n   = list.len;
+	return 0;
+}
+
+
+int
+macchanger_watch_read (macchanger_t *ctx, macchanger_link_event_t **events, size_t *n,
+		       int *complete)
+{
+	int ret;
+
+	API_CALL (ctx, ret, watch_read (ctx, events, n, complete));
+	return ret;
+}
+
+
+/* Saves the addresses the devices have now, for those without one
+ * saved, or whose saved one belongs to an interface since removed.
+ * Only then may they be changed.
+ */
+static int
+save_originals (macchanger_t *ctx, const char *const *devices, size_t n)
+{
+	const mc_state_entry_t *e;
+	mc_state_entry_t       *entries;
+	const mc_link_t        *link;
+	mc_link_list_t          list;
+	char                   *wanted;
+	size_t                  i, count = 0;
+	int                     ret;
+
+	if (mc_state_load (ctx->state) < 0) {
+		return -1;
+	}
+
+	wanted = (char *) xcalloc (n + 1, 1);
+	for (i=0; i<n; i++) {
+		e = mc_state_find (ctx->state, devices[i]);
+		wanted[i] = (e == NULL || e->index != if_nametoindex (devices[i]));
+		count += wanted[i];
+	}
+	if (count == 0) {
+		free (wanted);
+		return 0;
+	}
+
+	current_links (ctx, &list);
+	qsort (list.links, list.len, sizeof(mc_link_t), link_name_compare);
+
+	entries = (mc_state_entry_t *) xcalloc (count, sizeof(mc_state_entry_t));
+	for (i=0, count=0; i<n; i++) {
+		if (wanted[i] && (link = link_find (&list, devices[i])) != NULL && link->has_mac) {
+			entries[count].index = link->index;
+			entries[count].mac   = link->mac;
+			memcpy (entries[count].name, link->name, sizeof(entries[count].name));
+			count++;
+		}
+	}
+
+	ret = mc_state_save (ctx->state, entries, count);
+	free (entries);
+	free (list.links);
+	free (wanted);
+	return ret;
+}
+
+
+/* Devices now back at their saved address need it no more */
+static void
+forget_restored (macchanger_t *ctx, const char *const *devices, const mac_t *macs,
+		 const int *errors, size_t n)
+{
+	const mc_state_entry_t *e;
+	const char            **names;
+	size_t                  i, count = 0;
+
+	names = (const char **) xmalloc ((n + 1) * sizeof(char *));
+	for (i=0; i<n; i++) {
+		if (errors[i] == 0 && (e = mc_state_find (ctx->state, devices[i])) != NULL &&
+		    memcmp (&e->mac, &macs[i], sizeof(mac_t)) == 0) {
+			names[count++] = devices[i];
+		}
+	}
+	if (count > 0) {
+		mc_state_forget (ctx->state, names, count);
+	}
+	free (names);
+}
+
+
+/* Changes go through rtnetlink, batched, and through one ioctl per
+ * device if the kernel will not take them that way.  With a state
+ * file, the addresses they had first are saved beforehand.
+ */
+static int
+device_set_macs (macchanger_t *ctx, const char *const *devices, const mac_t *macs,
+		 int *errors, size_t n)
+{
+	net_info_t *net;
+	size_t      i;
+	int         ret = 0;
+
+	if (ctx->state && save_originals (ctx, devices, n) < 0) {
+		for (i=0; i<n; i++) {
+			errors[i] = EIO;
+		}
+		return -1;
+	}
+
+	if (netlink (ctx) && mc_netlink_set_macs (ctx->nl, devices, macs, errors, n) < 0) {
+		mc_netlink_close (ctx->nl);
+		ctx->nl = NULL;
+		ctx->no_netlink = 1;
+	}
+
+	if (ctx->no_netlink) {
+		for (i=0; i<n; i++) {
+			if ((net = device_open (devices[i])) == NULL) {
+				errors[i] = errno;
+				continue;
+			}
+			errors[i] = (mc_net_info_set_mac (net, &macs[i]) < 0) ? errno : 0;
+			mc_net_info_free (net);
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		if (errors[i] != 0) {
+			ret = -1;
+		}
+	}
+
+	if (ctx->state) {
+		forget_restored (ctx, devices, macs, errors, n);
+	}
+	return ret;
+}
+
+
+static int
+device_set_mac (macchanger_t *ctx, const char *device, const mac_t *mac)
+{
+	int err;
+
+	return device_set_macs (ctx, &device, mac, &err, 1);
+}
+
+
+int
+macchanger_set_mac (macchanger_t *ctx, const char *device, const macchanger_mac_t *mac)
+{
+	int ret;
+
+	API_CALL (ctx, ret, device_set_mac (ctx, device, mac));
+	return ret;
+}
+
+
+int
+macchanger_set_macs (macchanger_t *ctx, const char *const *devices,
+		     const macchanger_mac_t *macs, int *errors, size_t n)
+{
+	int ret;
+
+	API_CALL (ctx, ret, device_set_macs (ctx, devices, macs, errors, n));
+	return ret;
+}
+
+
+static int
+device_set_mac_bounce (macchanger_t *ctx, const char *device, const mac_t *mac,
+		       macchanger_outage_t *outage)
+{
+	mc_outage_t cost;
+	net_info_t *net;
+	int         err = 0;
+
+	memset (&cost, 0, sizeof(cost));
+	memset (outage, 0, sizeof(*outage));
+	if (ctx->state && save_originals (ctx, &device, 1) < 0) {
+		return -1;
+	}
+
+	if (netlink (ctx) && mc_netlink_set_mac_bounce (ctx->nl, device, mac, &cost, &err) < 0) {
+		mc_netlink_close (ctx->nl);
+		ctx->nl = NULL;
+		ctx->no_netlink = 1;
+	}
+
+	if (ctx->no_netlink) {
+		if ((net = device_open (device)) == NULL) {
+			return -1;
+		}
+		err = (mc_net_info_set_mac_bounce (net, mac, &cost) < 0) ? errno : 0;
+		mc_net_info_free (net);
+	}
+
+	outage->bounced      = cost.bounced;
+	outage->down_usec    = cost.down_usec;
+	outage->carrier      = cost.carrier;
+	outage->carrier_usec = cost.carrier_usec;
+
+	if (ctx->state) {
+		forget_restored (ctx, &device, mac, &err, 1);
+	}
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+
+int
+macchanger_set_mac_bounce (macchanger_t *ctx, const char *device, const macchanger_mac_t *mac,
+			   macchanger_outage_t *outage)
+{
+	int ret;
+
+	API_CALL (ctx, ret, device_set_mac_bounce (ctx, device, mac, outage));
+	return ret;
+}
+
+
+static int
+state_use (macchanger_t *ctx, const char *path)
+{
+	mc_state_t *state;
+
+	if ((state = mc_state_open (path ? path : STATEDIR "/" MC_STATE_FILE)) == NULL) {
+		return -1;
+	}
+
+	mc_state_close (ctx->state);
+	ctx->state = state;
+	return 0;
+}
+
+
+int
+macchanger_use_state (macchanger_t *ctx, const char *path)
+{
+	int ret;
+
+	API_CALL (ctx, ret, state_use (ctx, path));
+	return ret;
+}
+
+
+static int
+pool_use (macchanger_t *ctx, const char *path)
+{
+	mc_pool_t *p;
+
+	if ((p = mc_pool_open (path)) == NULL) {
+		return -1;
+	}
+
+	mc_pool_close (ctx->pool);
+	ctx->pool = p;
+	return 0;
+}
+
+
+int
+macchanger_create_pool (macchanger_t *ctx, const char *path,
+			const macchanger_mac_t *prefix, unsigned int prefix_bits)
+{
+	int ret;
+
+	API_CALL (ctx, ret, mc_pool_create (path, prefix, prefix_bits));
+	return ret;
+}
+
+
+int
+macchanger_use_pool (macchanger_t *ctx, const char *path)
+{
+	int ret;
+
+	API_CALL (ctx, ret, pool_use (ctx, path));
+	return ret;
+}
+
+
+static int
+pool_alloc (macchanger_t *ctx, mac_t *macs, size_t n)
+{
+	return pool (ctx) ? mc_pool_alloc (ctx->pool, macs, n) : -1;
+}
+
+
+int
+macchanger_pool_alloc (macchanger_t *ctx, macchanger_mac_t *macs, size_t n)
+{
+	int ret;
+
+	API_CALL (ctx, ret, pool_alloc (ctx, macs, n));
+	return ret;
+}
+
+
+static int
+pool_release (macchanger_t *ctx, const mac_t *macs, size_t n)
+{
+	return pool (ctx) ? mc_pool_release (ctx->pool, macs, n) : -1;
+}
+
+
+int
+macchanger_pool_release (macchanger_t *ctx, const macchanger_mac_t *macs, size_t n)
+{
+	int ret;
+
+	API_CALL (ctx, ret, pool_release (ctx, macs, n));
+	return ret;
+}
+
+
+static int
+pool_compact (macchanger_t *ctx)
+{
+	return pool (ctx) ? mc_pool_compact (ctx->pool) : -1;
+}
+
+
+int
+macchanger_pool_compact (macchanger_t *ctx)
+{
+	int ret;
+
+	API_CALL (ctx, ret, pool_compact (ctx));
+	return ret;
+}
+
+
+static int
+pool_stats (macchanger_t *ctx, macchanger_pool_stats_t *stats)
+{
+	uint64_t used, size;
+
+	if (pool (ctx) == NULL ||
+	    mc_pool_stats (ctx->pool, &stats->prefix, &stats->prefix_bits, &used, &size) < 0) {
+		return -1;
+	}
+
+	stats->used = used;
+	stats->size = size;
+	return 0;
+}
+
+
+int
+macchanger_pool_stats (macchanger_t *ctx, macchanger_pool_stats_t *stats)
+{
+	int ret;
+
+	API_CALL (ctx, ret, pool_stats (ctx, stats));
+	return ret;
+}
+
+
+static int
+original_mac (macchanger_t *ctx, const char *device, mac_t *mac)
+{
+	const mc_state_entry_t *e;
+
+	if (ctx->state == NULL) {
+		error ("No state file in use");
+		return -1;
+	}
+	if (mc_state_load (ctx->state) < 0) {
+		return -1;
+	}
+
+	if ((e = mc_state_find (ctx->state, device)) == NULL ||
+	    e->index != if_nametoindex (device)) {
+		error ("No original address saved for %s", device);
+		return -1;
+	}
+
+	*mac = e->mac;
+	return 0;
+}
+
+
+int
+macchanger_get_original_mac (macchanger_t *ctx, const char *device, macchanger_mac_t *mac)
+{
+	int ret;
+
+	API_CALL (ctx, ret, original_mac (ctx, device, mac));
+	return ret;
+}
+
+
+/* Puts every saved address back, in one batch.  Interfaces that are
+ * gone, or were made again since, are forgotten.
+ */
+static int
+restore_all (macchanger_t *ctx, macchanger_restored_t **out, size_t *nout)
+{
+	const mc_state_entry_t *all;
+	mc_state_entry_t       *saved;
+	macchanger_restored_t  *restored;
+	const mc_link_t        *link;
+	mc_link_list_t          list;
+	const char            **names, **done;
+	mac_t                  *macs;
+	size_t                 *which;
+	int                    *errors;
+	size_t                  nall, n = 0, nset = 0, ndone = 0, i;
+	int                     ret = 0;
+
+	if (ctx->state == NULL) {
+		error ("No state file in use");
+		return -1;
+	}
+	if (mc_state_load (ctx->state) < 0) {
+		return -1;
+	}
+
+	/* The entries move as the log changes */
+	all   = mc_state_entries (ctx->state, &nall);
+	saved = (mc_state_entry_t *) xmalloc ((nall + 1) * sizeof(mc_state_entry_t));
+	for (i=0; i<nall; i++) {
+		if (all[i].live) {
+			saved[n++] = all[i];
+		}
+	}
+
+	current_links (ctx, &list);
+	qsort (list.links, list.len, sizeof(mc_link_t), link_name_compare);
+
+	restored = (macchanger_restored_t *) xcalloc (n + 1, sizeof(macchanger_restored_t));
+	names    = (const char **) xmalloc ((n + 1) * sizeof(char *));
+	done     = (const char **) xmalloc ((n + 1) * sizeof(char *));
+	macs     = (mac_t *) xmalloc ((n + 1) * sizeof(mac_t));
+	which    = (size_t *) xmalloc ((n + 1) * sizeof(size_t));
+	errors   = (int *) xmalloc ((n + 1) * sizeof(int));
+
+	for (i=0; i<n; i++) {
+		memcpy (restored[i].name, saved[i].name, sizeof(restored[i].name));
+		restored[i].mac = saved[i].mac;
+
+		link = link_find (&list, saved[i].name);
+		if (link == NULL || link->index != saved[i].index) {
+			restored[i].error = ENODEV;
+			done[ndone++] = saved[i].name;
+		} else if (memcmp (&link->mac, &saved[i].mac, sizeof(mac_t)) == 0) {
+			done[ndone++] = saved[i].name;
+		} else {
+			names[nset] = restored[i].name;
+			macs[nset]  = saved[i].mac;
+			which[nset] = i;
+			nset++;
+		}
+	}
+
+	/* Those it restores, it forgets */
+	if (nset > 0 && device_set_macs (ctx, names, macs, errors, nset) < 0) {
+		ret = -1;
+	}
+	for (i=0; i<nset; i++) {
+		restored[which[i]].error = errors[i];
+	}
+	if (ndone > 0 && mc_state_forget (ctx->state, done, ndone) < 0) {
+		ret = -1;
+	}
+
+	free (errors);
+	free (which);
+	free (macs);
+	free (done);
+	free (names);
+	free (list.links);
+	free (saved);
+
+	*out  = restored;
+	*nout = n;
+	return ret;
+}
+
+
+int
+macchanger_restore_all (macchanger_t *ctx, macchanger_restored_t **restored, size_t *n)
+{
+	int ret;
+
+	*restored = NULL;
+	*n        = 0;
+	API_CALL (ctx, ret, restore_all (ctx, restored, n));
+	return ret;
+}
+
+
+int
+macchanger_list (macchanger_t *ctx, const char *const *keywords, size_t nkeywords, int out_fd)
+{
+	int ret;
+
+	API_CALL (ctx, ret, mc_maclist_print (keywords, nkeywords, out_fd));
+	return ret;
+}
+
+
+int
+macchanger_resolve (macchanger_t *ctx, int in_fd, int out_fd)
+{
+	int ret;
+
+	API_CALL (ctx, ret, mc_resolve_stream (in_fd, out_fd));
+	return ret;
+}
+
+
+static int
+generate (macchanger_t *ctx, int out_fd, unsigned long count,
+	  macchanger_random_t mode, const mac_t *base, int bia)
+{
+	mc_generate_mode_t how;
+	mac_type_t         kind = mac_is_anykind;
+	mac_t              zero, *avoid = NULL;
+	size_t             navoid = 0;
+	int                ret;
+
+	if (base == NULL) {
+		memset (&zero, 0, sizeof(zero));
+		base = &zero;
+	}
+
+	switch (mode) {
+	case MACCHANGER_RANDOM:
+		how = mc_generate_random;
+		break;
+	case MACCHANGER_ENDING:
+		how = mc_generate_ending;
+		break;
+	case MACCHANGER_ANOTHER:
+		how  = mc_generate_vendor;
+		kind = mc_maclist_is_wireless (base);
+		break;
+	case MACCHANGER_ANOTHER_ANY:
+		how = mc_generate_vendor;
+		break;
+	case MACCHANGER_SHARD:
+		if (ctx->shard.bits == 0) {
+			error ("No shard set");
+			return -1;
+		}
+		how = mc_generate_shard;
+		break;
+	case MACCHANGER_POOL:
+		/* Unique by construction */
+		if (pool (ctx) == NULL) {
+			return -1;
+		}
+		return mc_generate_pool (out_fd, count, ctx->pool);
+	default:
+		error ("Unknown random mode");
+		return -1;
+	}
+
+	if (ctx->inuse) {
+		avoid = mc_inuse_list (ctx->inuse, &navoid);
+	}
+	ret = mc_generate_stream (out_fd, count, how, base, kind, bia, ctx->picker,
+				  &ctx->shard, avoid, navoid);
+
+	free (avoid);
+	return ret;
+}
+
+
+int
+macchanger_generate (macchanger_t *ctx, int out_fd, unsigned long count,
+		     macchanger_random_t mode, const macchanger_mac_t *base, int bia)
+{
+	int ret;
+
+	API_CALL (ctx, ret, generate (ctx, out_fd, count, mode, base, bia));
+	return ret;
+}
@@ -26,11 +26,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "mac.h"
 #include "common.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define MAC_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
 
 mac_t *
 mc_mac_dup (const mac_t *mac)
@@ -50,17 +56,6 @@ mc_mac_free (mac_t *mac)
 }
 
 
-void
-mc_mac_into_string (const mac_t *mac, char *s)
-{
-	int i;
-
-	for (i=0; i<6; i++) {
-		sprintf (&s[i*3], "%02x%s", mac->byte[i], i<5?":":"");
-	}
-}
-
-
 void
 mc_mac_random (mac_t *mac, unsigned char last_n_bytes, char set_bia)
 {
@@ -97,6 +92,78 @@ mc_mac_random (mac_t *mac, unsigned char last_n_bytes, char set_bia)
 }
 
 
+int
+mc_shard_check (const mc_shard_t *shard)
+{
+	if (shard->bits < 1 || shard->bits > MC_SHARD_MAX_BITS) {
+		error ("A shard takes 1 to %d bits", MC_SHARD_MAX_BITS);
+		return -1;
+	}
+	/* 'node' may be as wide as 'bits' == MC_SHARD_MAX_BITS */
+	if ((uint64_t) shard->node >> shard->bits != 0) {
+		error ("Node %lu does not fit in %u bits", shard->node, shard->bits);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* The 46 free bits are the top six of the first octet, above the
+ * locally administered and multicast bits, and the other five octets.
+ */
+static uint64_t
+shard_free_bits (const mac_t *mac)
+{
+	uint64_t v = mac->byte[0] >> 2;
+	int      i;
+
+	for (i=1; i<6; i++) {
+		v = (v << 8) | mac->byte[i];
+	}
+	return v;
+}
+
+
+void
+mc_mac_random_shard (mac_t *mac, const mc_shard_t *shard)
+{
+	uint64_t v;
+	int      i;
+
+	mc_mac_random (mac, 6, 0);
+	v = shard_free_bits (mac) & (((uint64_t) 1 << (MC_SHARD_FREE_BITS - shard->bits)) - 1);
+	v |= (uint64_t) shard->node << (MC_SHARD_FREE_BITS - shard->bits);
+
+	for (i=5; i>0; i--, v >>= 8) {
+		mac->byte[i] = v & 0xFF;
+	}
+	mac->byte[0] = (v << 2) | 2;
+}
+
+
+/* The node whose shard of 'bits' bits holds 'mac'.  Returns -1 for
+ * addresses that are in no shard: multicast or universal ones.
+ */
+int
+mc_mac_shard (const mac_t *mac, unsigned int bits, unsigned long *node)
+{
+	mc_shard_t shard;
+
+	shard.bits = bits;
+	shard.node = 0;
+	if (mc_shard_check (&shard) < 0) {
+		return -1;
+	}
+	if ((mac->byte[0] & 3) != 2) {
+		error ("Not a locally administered unicast address");
+		return -1;
+	}
+
+	*node = shard_free_bits (mac) >> (MC_SHARD_FREE_BITS - bits);
+	return 0;
+}
+
+
 int
 mc_mac_equal (const mac_t *mac1, const mac_t *mac2)
 {
@@ -111,27 +178,453 @@ mc_mac_equal (const mac_t *mac1, const mac_t *mac2)
 }
 
 
-int
-mc_mac_read_string (mac_t *mac, char *string)
+/* Parse and format kernels
+ *
+ * Text conversion is the inner loop of every bulk path, so it has a
+ * scalar version and, on x86, SSSE3 and AVX2 versions picked at run
+ * time.  All of them read and write exactly the bytes of the text form
+ * (17 bytes, or 18 with the line end): nothing past the end of the
+ * caller's buffer is touched.
+ */
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Digit value plus one, zero for anything that is not a hex digit */
+static const unsigned char hex_table[256] = {
+	['0'] =  1, ['1'] =  2, ['2'] =  3, ['3'] =  4, ['4'] =  5,
+	['5'] =  6, ['6'] =  7, ['7'] =  8, ['8'] =  9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+static inline int
+hex_value (char c)
 {
-	int nbyte = 5;
+	return (int) hex_table[(unsigned char) c] - 1;
+}
+
+
+static int
+parse_scalar (mac_t *mac, const char *string, char sep)
+{
+	int nbyte, hi, lo;
+
+	for (nbyte=0; nbyte<6; nbyte++) {
+		hi = hex_value (string[nbyte*3]);
+		lo = hex_value (string[nbyte*3+1]);
+		if (hi < 0 || lo < 0 || (nbyte < 5 && string[nbyte*3+2] != sep)) {
+			return -1;
+		}
+		mac->byte[nbyte] = (hi << 4) | lo;
+	}
+
+	return 0;
+}
+
 
-	/* Check the format */
-	if (strlen(string) != 17) {
-		error ("Incorrect format: MAC length should be 17. %s(%lu)", string, strlen(string));
+static void
+format_scalar (const mac_t *mac, char *s, char end)
+{
+	int i;
+
+	for (i=0; i<6; i++) {
+		s[i*3]   = hex_digits[mac->byte[i] >> 4];
+		s[i*3+1] = hex_digits[mac->byte[i] & 0xf];
+		s[i*3+2] = ':';
+	}
+	s[17] = end;
+}
+
+
+static size_t
+parse_lines_scalar (mac_t *macs, const char *text, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++, text+=MC_MAC_LINE_LEN) {
+		if (text[17] != '\n' || parse_scalar (&macs[i], text, ':') < 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+
+static void
+format_lines_scalar (const mac_t *macs, size_t n, char *text)
+{
+	size_t i;
+
+	for (i=0; i<n; i++, text+=MC_MAC_LINE_LEN) {
+		format_scalar (&macs[i], text, '\n');
+	}
+}
+
+
+#ifdef MAC_X86_KERNELS
+
+/* Twelve digits are gathered from two overlapping loads, s[0..15] and
+ * s[1..16], then classified, converted and paired into bytes.  The
+ * separators must sit at 2, 5, 8, 11 and 14 of the first load.
+ */
+#define SEP_BITS    0x4924
+#define DIGIT_BITS  0x0fff
+
+#define GATHER_LO  0, 1, 3, 4, 6, 7, 9, 10, 12, 13, 15, -1, -1, -1, -1, -1
+#define GATHER_HI  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, -1, -1, -1, -1
+#define SCATTER    0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10
+#define COLONS     0, 0, ':', 0, 0, ':', 0, 0, ':', 0, 0, ':', 0, 0, ':', 0
+#define HEX_LUT    '0', '1', '2', '3', '4', '5', '6', '7', \
+		   '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+
+/* Digit values of 'digits' in 'value'; returns the mask of the lanes
+ * holding a valid hex digit.
+ */
+__attribute__((target("ssse3"))) static inline __m128i
+hex_decode_128 (__m128i digits, __m128i *value)
+{
+	__m128i dec   = _mm_sub_epi8 (digits, _mm_set1_epi8 ('0'));
+	__m128i alpha = _mm_sub_epi8 (_mm_or_si128 (digits, _mm_set1_epi8 (0x20)),
+				      _mm_set1_epi8 ('a'));
+	__m128i is_dec   = _mm_cmpeq_epi8 (_mm_min_epu8 (dec, _mm_set1_epi8 (9)), dec);
+	__m128i is_alpha = _mm_cmpeq_epi8 (_mm_min_epu8 (alpha, _mm_set1_epi8 (5)), alpha);
+
+	*value = _mm_or_si128 (_mm_and_si128 (is_dec, dec),
+			       _mm_andnot_si128 (is_dec, _mm_add_epi8 (alpha, _mm_set1_epi8 (10))));
+	return _mm_or_si128 (is_dec, is_alpha);
+}
+
+
+__attribute__((target("ssse3"))) static int
+parse_ssse3 (mac_t *mac, const char *string, char sep)
+{
+	__m128i lo = _mm_loadu_si128 ((const __m128i *) string);
+	__m128i hi = _mm_loadu_si128 ((const __m128i *) (string + 1));
+	__m128i digits, value, valid, bytes;
+	unsigned char out[8];
+
+	if ((_mm_movemask_epi8 (_mm_cmpeq_epi8 (lo, _mm_set1_epi8 (sep))) & SEP_BITS) != SEP_BITS) {
 		return -1;
 	}
 
-	for (nbyte=2; nbyte<16; nbyte+=3) {
-		if (string[nbyte] != ':') {
-			error ("Incorrect format: %s", string);
-			return -1;
+	digits = _mm_or_si128 (_mm_shuffle_epi8 (lo, _mm_setr_epi8 (GATHER_LO)),
+			       _mm_shuffle_epi8 (hi, _mm_setr_epi8 (GATHER_HI)));
+	valid  = hex_decode_128 (digits, &value);
+	if ((_mm_movemask_epi8 (valid) & DIGIT_BITS) != DIGIT_BITS) {
+		return -1;
+	}
+
+	bytes = _mm_maddubs_epi16 (value, _mm_set1_epi16 (0x0110));
+	_mm_storel_epi64 ((__m128i *) out, _mm_packus_epi16 (bytes, bytes));
+	memcpy (mac->byte, out, 6);
+	return 0;
+}
+
+
+__attribute__((target("ssse3"))) static void
+format_ssse3 (const mac_t *mac, char *s, char end)
+{
+	unsigned char in[8] = {0};
+	__m128i bytes, nibbles, text;
+
+	memcpy (in, mac->byte, 6);
+	bytes   = _mm_loadl_epi64 ((const __m128i *) in);
+	nibbles = _mm_unpacklo_epi8 (_mm_and_si128 (_mm_srli_epi16 (bytes, 4), _mm_set1_epi8 (0x0f)),
+				     _mm_and_si128 (bytes, _mm_set1_epi8 (0x0f)));
+	text    = _mm_shuffle_epi8 (_mm_setr_epi8 (HEX_LUT), nibbles);
+	text    = _mm_or_si128 (_mm_shuffle_epi8 (text, _mm_setr_epi8 (SCATTER)),
+				_mm_setr_epi8 (COLONS));
+
+	_mm_storeu_si128 ((__m128i *) s, text);
+	s[16] = hex_digits[mac->byte[5] & 0xf];
+	s[17] = end;
+}
+
+
+__attribute__((target("ssse3"))) static size_t
+parse_lines_ssse3 (mac_t *macs, const char *text, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++, text+=MC_MAC_LINE_LEN) {
+		if (text[17] != '\n' || parse_ssse3 (&macs[i], text, ':') < 0) {
+			break;
 		}
 	}
+	return i;
+}
 
-	/* Read the values */
-	for (nbyte=0; nbyte<6; nbyte++) {
-		mac->byte[nbyte] = (char) (strtoul(string+nbyte*3, 0, 16) & 0xFF);
+
+__attribute__((target("ssse3"))) static void
+format_lines_ssse3 (const mac_t *macs, size_t n, char *text)
+{
+	size_t i;
+
+	for (i=0; i<n; i++, text+=MC_MAC_LINE_LEN) {
+		format_ssse3 (&macs[i], text, '\n');
+	}
+}
+
+
+/* The AVX2 versions run the same steps on two lines at once, one per
+ * 128-bit lane.
+ */
+__attribute__((target("avx2"))) static inline __m256i
+load_pair (const char *first, const char *second)
+{
+	return _mm256_inserti128_si256 (
+		_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) first)),
+		_mm_loadu_si128 ((const __m128i *) second), 1);
+}
+
+
+__attribute__((target("avx2"))) static size_t
+parse_lines_avx2 (mac_t *macs, const char *text, size_t n)
+{
+	const __m256i colon   = _mm256_set1_epi8 (':');
+	const __m256i gather0 = _mm256_setr_epi8 (GATHER_LO, GATHER_LO);
+	const __m256i gather1 = _mm256_setr_epi8 (GATHER_HI, GATHER_HI);
+	const uint32_t colons = SEP_BITS | (SEP_BITS << 16);
+	const uint32_t digits = DIGIT_BITS | (DIGIT_BITS << 16);
+	__m256i  lo, hi, d, dec, alpha, is_dec, is_alpha, value, bytes;
+	unsigned char out[32];
+	size_t   i;
+
+	for (i=0; i+2<=n; i+=2, text+=2*MC_MAC_LINE_LEN) {
+		if (text[17] != '\n' || text[MC_MAC_LINE_LEN+17] != '\n') {
+			break;
+		}
+
+		lo = load_pair (text, text + MC_MAC_LINE_LEN);
+		hi = load_pair (text + 1, text + MC_MAC_LINE_LEN + 1);
+		if (((uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (lo, colon)) & colons) != colons) {
+			break;
+		}
+
+		d = _mm256_or_si256 (_mm256_shuffle_epi8 (lo, gather0),
+				     _mm256_shuffle_epi8 (hi, gather1));
+		dec      = _mm256_sub_epi8 (d, _mm256_set1_epi8 ('0'));
+		alpha    = _mm256_sub_epi8 (_mm256_or_si256 (d, _mm256_set1_epi8 (0x20)),
+					    _mm256_set1_epi8 ('a'));
+		is_dec   = _mm256_cmpeq_epi8 (_mm256_min_epu8 (dec, _mm256_set1_epi8 (9)), dec);
+		is_alpha = _mm256_cmpeq_epi8 (_mm256_min_epu8 (alpha, _mm256_set1_epi8 (5)), alpha);
+		if (((uint32_t) _mm256_movemask_epi8 (_mm256_or_si256 (is_dec, is_alpha)) & digits) != digits) {
+			break;
+		}
+
+		value = _mm256_or_si256 (_mm256_and_si256 (is_dec, dec),
+					 _mm256_andnot_si256 (is_dec, _mm256_add_epi8 (alpha, _mm256_set1_epi8 (10))));
+		bytes = _mm256_maddubs_epi16 (value, _mm256_set1_epi16 (0x0110));
+		_mm256_storeu_si256 ((__m256i *) out, _mm256_packus_epi16 (bytes, bytes));
+		memcpy (macs[i].byte,   out,      6);
+		memcpy (macs[i+1].byte, out + 16, 6);
+	}
+
+	/* An odd line, or the pair holding the first bad line */
+	return i + parse_lines_ssse3 (macs + i, text, n - i);
+}
+
+
+__attribute__((target("avx2"))) static void
+format_lines_avx2 (const mac_t *macs, size_t n, char *text)
+{
+	const __m256i lut     = _mm256_setr_epi8 (HEX_LUT, HEX_LUT);
+	const __m256i scatter = _mm256_setr_epi8 (SCATTER, SCATTER);
+	const __m256i colons  = _mm256_setr_epi8 (COLONS, COLONS);
+	const __m256i low     = _mm256_set1_epi8 (0x0f);
+	unsigned char in[32] = {0};
+	unsigned char out[32];
+	__m256i bytes, nibbles;
+	size_t  i;
+
+	for (i=0; i+2<=n; i+=2, text+=2*MC_MAC_LINE_LEN) {
+		memcpy (in,      macs[i].byte,   6);
+		memcpy (in + 16, macs[i+1].byte, 6);
+		bytes   = _mm256_loadu_si256 ((const __m256i *) in);
+		nibbles = _mm256_unpacklo_epi8 (_mm256_and_si256 (_mm256_srli_epi16 (bytes, 4), low),
+						_mm256_and_si256 (bytes, low));
+		nibbles = _mm256_shuffle_epi8 (lut, nibbles);
+		_mm256_storeu_si256 ((__m256i *) out,
+				     _mm256_or_si256 (_mm256_shuffle_epi8 (nibbles, scatter), colons));
+
+		memcpy (text, out, 16);
+		text[16] = hex_digits[macs[i].byte[5] & 0xf];
+		text[17] = '\n';
+		memcpy (text + MC_MAC_LINE_LEN, out + 16, 16);
+		text[MC_MAC_LINE_LEN+16] = hex_digits[macs[i+1].byte[5] & 0xf];
+		text[MC_MAC_LINE_LEN+17] = '\n';
+	}
+
+	format_lines_ssse3 (macs + i, n - i, text);
+}
+
+#endif /* MAC_X86_KERNELS */
+
+
+typedef struct {
+	int    (*parse)        (mac_t *, const char *, char sep);
+	void   (*format)       (const mac_t *, char *, char);
+	size_t (*parse_lines)  (mac_t *, const char *, size_t);
+	void   (*format_lines) (const mac_t *, size_t, char *);
+} mac_kernels_t;
+
+static const mac_kernels_t *kernels = NULL;
+
+static const mac_kernels_t *
+get_kernels (void)
+{
+	static const mac_kernels_t scalar = {
+		parse_scalar, format_scalar, parse_lines_scalar, format_lines_scalar
+	};
+#ifdef MAC_X86_KERNELS
+	static const mac_kernels_t ssse3 = {
+		parse_ssse3, format_ssse3, parse_lines_ssse3, format_lines_ssse3
+	};
+	static const mac_kernels_t avx2 = {
+		parse_ssse3, format_ssse3, parse_lines_avx2, format_lines_avx2
+	};
+#endif
+
+	if (kernels == NULL) {
+		kernels = &scalar;
+#ifdef MAC_X86_KERNELS
+		__builtin_cpu_init ();
+		if (__builtin_cpu_supports ("avx2")) {
+			kernels = &avx2;
+		} else if (__builtin_cpu_supports ("ssse3")) {
+			kernels = &ssse3;
+		}
+#endif
+	}
+
+	return kernels;
+}
+
+
+/* Parses exactly 'len' bytes of "XX:XX:XX:XX:XX:XX" without printing
+ * anything, so it can be used on bulk input.
+ */
+int
+mc_mac_parse (mac_t *mac, const char *string, size_t len)
+{
+	if (len != 17) {
+		return -1;
+	}
+
+	return get_kernels()->parse (mac, string, ':');
+}
+
+
+/* Writes the 17 character form and its terminating NUL */
+void
+mc_mac_into_string (const mac_t *mac, char *s)
+{
+	get_kernels()->format (mac, s, '\0');
+}
+
+
+/* Parses up to 'n' consecutive "XX:XX:XX:XX:XX:XX\n" lines.  Returns
+ * how many were parsed before the first one that is not in that form.
+ */
+size_t
+mc_mac_parse_lines (mac_t *macs, const char *text, size_t n)
+{
+	return get_kernels()->parse_lines (macs, text, n);
+}
+
+
+/* Writes 'n' lines of MC_MAC_LINE_LEN bytes each; no NUL is added */
+void
+mc_mac_format_lines (const mac_t *macs, size_t n, char *text)
+{
+	get_kernels()->format_lines (macs, n, text);
+}
+
+
+/* Parses one address in any of the usual notations, detected on the
+ * fly: "xx:xx:xx:xx:xx:xx", "xx-xx-xx-xx-xx-xx", Cisco "xxxx.xxxx.xxxx"
+ * or 12 bare digits, in any case.  The text is walked once and never
+ * copied.  On error returns -1 and stores in 'error_pos' the offset of
+ * the offending character, or 'len' when the text ends too early.
+ */
+int
+mc_mac_parse_any (mac_t *mac, const char *string, size_t len, size_t *error_pos)
+{
+	size_t i;
+	int    ndigits = 0;  /* digits so far, 12 in all     */
+	int    run     = 0;  /* digits since the separator   */
+	int    group   = 0;  /* digits per group, 0: unknown */
+	char   sep     = 0;
+	int    value;
+
+	/* The colon and dash forms take the vector kernel */
+	if (len == 17 && (string[2] == ':' || string[2] == '-') &&
+	    get_kernels()->parse (mac, string, string[2]) == 0) {
+		return 0;
+	}
+
+	for (i=0; i<len; i++) {
+		value = hex_value (string[i]);
+
+		if (value >= 0) {
+			if (ndigits == 12 || (group && run == group)) {
+				break;
+			}
+			if (ndigits & 1) {
+				mac->byte[ndigits/2] |= value;
+			} else {
+				mac->byte[ndigits/2] = value << 4;
+			}
+			ndigits++;
+			run++;
+			continue;
+		}
+
+		/* A separator: the first one fixes the notation */
+		if (sep == 0) {
+			if (run == 2 && (string[i] == ':' || string[i] == '-')) {
+				group = 2;
+			} else if (run == 4 && string[i] == '.') {
+				group = 4;
+			} else {
+				break;
+			}
+			sep = string[i];
+		} else if (string[i] != sep || run != group) {
+			break;
+		}
+
+		if (ndigits == 12) {
+			break;
+		}
+		run = 0;
+	}
+
+	if (i == len && ndigits == 12 && (group == 0 || run == group)) {
+		return 0;
+	}
+
+	if (error_pos) {
+		*error_pos = i;
+	}
+	return -1;
+}
+
+
+int
+mc_mac_read_string (mac_t *mac, const char *string)
+{
+	size_t len = strlen (string);
+	size_t pos;
+
+	if (mc_mac_parse_any (mac, string, len, &pos) < 0) {
+		if (pos == len) {
+			error ("Incorrect format: %s: address is incomplete", string);
+		} else {
+			error ("Incorrect format: %s: unexpected '%c' at position %lu",
+			       string, string[pos], (unsigned long) pos + 1);
+		}
+		return -1;
 	}
 
 	return 0;
@@ -26,10 +26,11 @@
 #ifndef __MAC_CHANGER_MAC_H__
 #define __MAC_CHANGER_MAC_H__
 
+#include <stddef.h>
+#include "macchanger.h"
 
-typedef struct {
-	unsigned char byte[6];
-} mac_t;
+
+typedef macchanger_mac_t mac_t;
 
 typedef enum {
 	mac_is_anykind,
@@ -37,14 +38,40 @@ typedef enum {
 	mac_is_others
 } mac_type_t;
 
+/* "XX:XX:XX:XX:XX:XX\n", the record of the bulk functions */
+#define MC_MAC_LINE_LEN  18
 
+/* Shards of the locally administered unicast space
+ *
+ * Such an address has 46 free bits.  A shard of 'bits' bits owns the
+ * addresses whose top free bits hold its node number, so nodes given
+ * distinct numbers of the same width never make the same address, and
+ * the number can be read back from any of them.  The rest is random.
+ */
+#define MC_SHARD_FREE_BITS  46
+#define MC_SHARD_MAX_BITS   32
 
-int     mc_mac_read_string (mac_t *, char *);
+typedef struct {
+	unsigned long node;
+	unsigned int  bits;      /* 0: no shard */
+} mc_shard_t;
+
+
+int     mc_mac_parse       (mac_t *, const char *, size_t len);
+int     mc_mac_parse_any   (mac_t *, const char *, size_t len, size_t *error_pos);
+int     mc_mac_read_string (mac_t *, const char *);
 void    mc_mac_into_string (const mac_t *, char *);
 
+size_t  mc_mac_parse_lines  (mac_t *, const char *, size_t n);
+void    mc_mac_format_lines (const mac_t *, size_t n, char *);
+
 int     mc_mac_equal       (const mac_t *, const mac_t *);
 mac_t  *mc_mac_dup         (const mac_t *);
 void    mc_mac_free        (mac_t *);
 void    mc_mac_random      (mac_t *, unsigned char last_n_bytes, char set_bia);
 
+int     mc_shard_check       (const mc_shard_t *);
+void    mc_mac_random_shard  (mac_t *, const mc_shard_t *);
+int     mc_mac_shard         (const mac_t *, unsigned int bits, unsigned long *node);
+
 #endif /* __MAC_CHANGER_LISTA_H__ */
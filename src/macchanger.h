@@ -0,0 +1,253 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef __MAC_CHANGER_LIB_H__
+#define __MAC_CHANGER_LIB_H__
+
+/* libmacchanger
+ *
+ * Everything the macchanger command does, as a library.  Every call
+ * takes a context made by macchanger_new().  A context may be used by
+ * one thread at a time, and any number of contexts may be used at
+ * once.  Calls return 0 on success and -1 on failure, after which
+ * macchanger_error() describes what went wrong: the library never
+ * prints to the terminal and never exits.  Calls that succeed in a
+ * lesser way, like with a damaged vendor database, leave a warning
+ * for macchanger_warning().
+ *
+ * The vendor lists are loaded once per process, the first time some
+ * context needs them, and shared by all contexts until the last one
+ * is freed.  Vendor names handed out stay valid until then.
+ *
+ * Device calls share one control socket, opened by the first of them;
+ * it reaches the interfaces of the network namespace the process was
+ * in at that time.  Addresses are changed through rtnetlink, one
+ * socket per context, or through ioctls where rtnetlink is not
+ * available.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	unsigned char byte[6];
+} macchanger_mac_t;
+
+/* "xx:xx:xx:xx:xx:xx" and its NUL */
+#define MACCHANGER_MAC_STRING_LEN  18
+
+typedef struct macchanger macchanger_t;
+
+/* One interface, as macchanger_links() reports it */
+typedef struct {
+	char              name[16];
+	unsigned int      index;
+	unsigned int      flags;          /* IFF_* */
+	macchanger_mac_t  mac;
+	macchanger_mac_t  permanent;
+	int               has_mac;        /* has an Ethernet address */
+	int               has_permanent;  /* and a permanent one */
+	const char       *vendor;         /* of 'mac', or NULL */
+	int               is_wireless;
+} macchanger_link_t;
+
+/* A change of an interface, as macchanger_watch_read() reports it.
+ * Only the name, index, flags and current address of 'link' are set.
+ */
+typedef struct {
+	macchanger_link_t link;
+	int               removed;        /* the interface is gone */
+} macchanger_link_event_t;
+
+typedef enum {
+	MACCHANGER_RANDOM,        /* fully random, as -r              */
+	MACCHANGER_ENDING,        /* keep the vendor bytes, as -e     */
+	MACCHANGER_ANOTHER,       /* vendor of the same kind, as -a   */
+	MACCHANGER_ANOTHER_ANY,   /* vendor of any kind, as -A        */
+	MACCHANGER_SHARD,         /* in the context's shard, as --shard */
+	MACCHANGER_POOL           /* from the context's pool, as --pool */
+} macchanger_random_t;
+
+typedef struct {
+	macchanger_mac_t   prefix;        /* the first address of the range */
+	unsigned int       prefix_bits;
+	unsigned long long used;          /* addresses allocated */
+	unsigned long long size;          /* addresses in the range */
+} macchanger_pool_stats_t;
+
+typedef enum {
+	MACCHANGER_VENDOR_BY_OUI,     /* every OUI equally likely         */
+	MACCHANGER_VENDOR_BY_NAME,    /* every vendor name equally likely */
+	MACCHANGER_VENDOR_BY_WEIGHT   /* weights read from a file         */
+} macchanger_vendor_dist_t;
+
+/* One interface macchanger_restore_all() dealt with */
+typedef struct {
+	char              name[16];
+	macchanger_mac_t  mac;            /* its saved address */
+	int               error;          /* 0, ENODEV if it is gone, or why
+					     the change failed */
+} macchanger_restored_t;
+
+/* What macchanger_set_mac_bounce() cost the link */
+typedef struct {
+	int           bounced;        /* it was taken down            */
+	unsigned long down_usec;      /* for at most this long        */
+	int           carrier;        /* its carrier came back ...    */
+	unsigned long carrier_usec;   /* ... this long after going down */
+} macchanger_outage_t;
+
+macchanger_t *macchanger_new    (void);
+void          macchanger_free   (macchanger_t *);
+const char   *macchanger_error  (const macchanger_t *);
+
+/* The first warning since the last time this was called, or NULL */
+const char   *macchanger_warning (macchanger_t *);
+
+int  macchanger_set_vendor_dist (macchanger_t *, macchanger_vendor_dist_t, const char *weights_file);
+
+/* Loads the vendor lists now rather than on first use */
+int  macchanger_preload (macchanger_t *);
+
+/* Addresses */
+int  macchanger_parse    (macchanger_t *, const char *text, macchanger_mac_t *);
+void macchanger_format   (const macchanger_mac_t *, char *text);
+int  macchanger_lookup   (macchanger_t *, const macchanger_mac_t *,
+			  const char **vendor, int *is_wireless);
+int  macchanger_random   (macchanger_t *, macchanger_mac_t *, macchanger_random_t, int bia);
+
+/* MACCHANGER_SHARD makes locally administered addresses whose top
+ * 'bits' free bits, of the 46 there are, hold 'node'.  Nodes given
+ * distinct numbers of the same width never make the same address,
+ * with nothing shared between them; macchanger_shard_of() reads the
+ * node back from an address.  'bits' is 1 to 32.
+ */
+int  macchanger_set_shard (macchanger_t *, unsigned long node, unsigned int bits);
+int  macchanger_shard_of  (macchanger_t *, const macchanger_mac_t *, unsigned int bits,
+			   unsigned long *node);
+
+/* Pools: a file handing out the addresses after a prefix of 20 to 47
+ * bits, each to one caller at a time, shared by every process using
+ * it.  macchanger_create_pool() makes the file, or checks that the one
+ * there owns the same range; macchanger_use_pool() opens it for the
+ * context, and for its MACCHANGER_POOL mode.  Allocations are all or
+ * nothing, and so are releases.
+ */
+int  macchanger_create_pool  (macchanger_t *, const char *path,
+			      const macchanger_mac_t *prefix, unsigned int prefix_bits);
+int  macchanger_use_pool     (macchanger_t *, const char *path);
+int  macchanger_pool_alloc   (macchanger_t *, macchanger_mac_t *macs, size_t n);
+int  macchanger_pool_release (macchanger_t *, const macchanger_mac_t *macs, size_t n);
+int  macchanger_pool_compact (macchanger_t *);
+int  macchanger_pool_stats   (macchanger_t *, macchanger_pool_stats_t *);
+
+/* Makes macchanger_random() and macchanger_generate() pass over the
+ * addresses in use: those of every link, and of every neighbour table
+ * entry, read now in one dump of each.  Every address picked is added
+ * to them.  With 'share', the set of another context is used, and
+ * added to, instead of a new one; it may be used from many threads.
+ * Returns 1 when the neighbour tables could not be read, so only the
+ * addresses of the links are passed over.
+ */
+int  macchanger_avoid_in_use (macchanger_t *, macchanger_t *share);
+
+/* Devices */
+
+/* The interfaces whose names match the shell pattern 'pattern', or
+ * all but the loopback ones if it is NULL, in index order.  '*names'
+ * is a single allocation, released with free().
+ */
+int  macchanger_devices (macchanger_t *, const char *pattern, char ***names, size_t *n);
+
+/* Every interface with its addresses, sorted by name, from a single
+ * netlink dump where the kernel allows.  Vendors are looked up only
+ * if 'vendors' is not 0.  Release '*links' with free().
+ */
+int  macchanger_links   (macchanger_t *, int vendors, macchanger_link_t **links, size_t *n);
+
+/* Starts listening to the kernel for interfaces that appear, change
+ * or go.  '*fd' becomes readable while events wait; it belongs to the
+ * context.
+ */
+int  macchanger_watch      (macchanger_t *, int *fd);
+
+/* The events that came since the last call, oldest first, without
+ * waiting.  If the kernel had to drop some, '*complete' is set and
+ * '*events' is instead every interface there is.  Release '*events'
+ * with free().
+ */
+int  macchanger_watch_read (macchanger_t *, macchanger_link_event_t **events, size_t *n,
+			    int *complete);
+
+int  macchanger_get_mac           (macchanger_t *, const char *device, macchanger_mac_t *);
+int  macchanger_get_permanent_mac (macchanger_t *, const char *device, macchanger_mac_t *);
+int  macchanger_set_mac           (macchanger_t *, const char *device, const macchanger_mac_t *);
+
+/* Sets macs[i] on devices[i], all in as few system calls as the kernel
+ * allows.  errors[i] gets 0 or the errno of that device; the call
+ * fails if any device did, and macchanger_error() tells of the first.
+ */
+int  macchanger_set_macs          (macchanger_t *, const char *const *devices,
+				   const macchanger_mac_t *macs, int *errors, size_t n);
+
+/* Sets the address with the link up if the driver allows it, and
+ * otherwise takes the link down, sets it and restores the link, in a
+ * single netlink transaction where the kernel has one.  '*outage'
+ * tells how long the link was down, and, if it had a carrier, how
+ * long that took to come back.
+ */
+int  macchanger_set_mac_bounce    (macchanger_t *, const char *device, const macchanger_mac_t *,
+				   macchanger_outage_t *outage);
+
+/* Original addresses
+ *
+ * With a state file, the address an interface has before the context
+ * first changes it is saved, on disk, before the change is made.  It
+ * is forgotten once the interface has it back.  'path' NULL is the
+ * system wide file.
+ */
+int  macchanger_use_state         (macchanger_t *, const char *path);
+int  macchanger_get_original_mac  (macchanger_t *, const char *device, macchanger_mac_t *);
+
+/* Puts every saved address back, in one batch.  '*restored' tells of
+ * each interface, even if the call fails because some change did;
+ * release it with free().
+ */
+int  macchanger_restore_all       (macchanger_t *, macchanger_restored_t **restored, size_t *n);
+
+/* Bulk work, written to a file descriptor */
+int  macchanger_list     (macchanger_t *, const char *const *keywords, size_t nkeywords, int out_fd);
+int  macchanger_resolve  (macchanger_t *, int in_fd, int out_fd);
+int  macchanger_generate (macchanger_t *, int out_fd, unsigned long count,
+			  macchanger_random_t, const macchanger_mac_t *base, int bia);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MAC_CHANGER_LIB_H__ */
@@ -0,0 +1,1471 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+/* macchangerd: serves MAC changes over a local socket
+ *
+ * The vendor lists are loaded once at start up and the interfaces are
+ * reached through a single control socket, so a request costs neither
+ * a process start nor a list load.  One thread runs an epoll loop
+ * over all the clients.
+ *
+ * Requests and replies are lines of text.  A client may send any
+ * number of requests without waiting; each connection is answered in
+ * order.
+ *
+ *   request:  ID COMMAND [ARGUMENT...]
+ *   reply:    ID ok|error MICROSECONDS RESULT
+ *
+ *   show DEVICE                 CURRENT PERMANENT ('-' if unknown)
+ *   set DEVICE MAC              NEW
+ *   random DEVICE [bia]         NEW
+ *   ending DEVICE               NEW
+ *   vendor-random DEVICE [any]  NEW
+ *   restore DEVICE              NEW
+ *   resolve MAC                 MAC wireless|other VENDOR
+ *
+ * ID is any word chosen by the client and MICROSECONDS is the time
+ * spent serving the request.  After an error RESULT is the message.
+ *
+ * The daemon also rotates addresses on a schedule, set by rules like
+ *
+ *   PATTERN every INTERVAL [jitter INTERVAL] [MODE]
+ *   PATTERN cron MINUTE HOUR DAY MONTH WEEKDAY [MODE]
+ *
+ * where MODE is random [bia], ending, vendor-random [any] or shard
+ * NODE/BITS.  Every
+ * rule waits on a timer heap behind one timerfd; the rules that are
+ * due together share one link dump and one batch of changes.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include "macchanger.h"
+#include "schedule.h"
+
+#define EXIT_OK    0
+#define EXIT_ERROR 1
+
+#define MCD_SOCKET      "/run/macchangerd.sock"
+#define MCD_LINE_MAX    4096         /* longest request */
+#define MCD_OUT_MAX     (1 << 20)    /* stop reading while more is pending */
+#define MCD_MAX_EVENTS  64
+#define MCD_MAX_ARGS    4
+#define MCD_RULE_WORDS  12           /* longest rotation rule */
+
+/* Long options without a short equivalent */
+enum {
+	OPT_VENDOR_WEIGHTS = 256,
+	OPT_WATCH_FILE,
+	OPT_STATE_FILE,
+	OPT_NO_STATE
+};
+
+typedef struct {
+	int     fd;
+	char    in[MCD_LINE_MAX];
+	size_t  in_len;
+	char   *out;
+	size_t  out_pos, out_len, out_size;
+	int     eof;          /* no more requests will come */
+	int     events;       /* what epoll watches for */
+} client_t;
+
+/* What the interfaces matching a pattern get */
+typedef struct {
+	char                *pattern;
+	macchanger_random_t  mode;
+	int                  bia;
+	int                  fixed;       /* 'mac' rather than a random one */
+	macchanger_mac_t     mac;
+	unsigned long        node;        /* of MACCHANGER_SHARD */
+	unsigned int         bits;
+} policy_t;
+
+typedef struct {
+	mcd_timer_t          timer;       /* first: a timer is its rotation */
+	policy_t             policy;
+	mcd_schedule_t       schedule;
+} rotation_t;
+
+/* An interface the watcher knows of, by index */
+typedef struct {
+	unsigned int         index;       /* 0 for a free slot */
+	int                  managed;     /* a policy chose 'mac' for it */
+	int                  failed;      /* and the change was refused */
+	unsigned int         seen;        /* batch of events it was last in */
+	unsigned int         queued;      /* batch that changes it */
+	macchanger_mac_t     mac;
+} watched_t;
+
+static macchanger_t     *ctx = NULL;
+static mcd_timer_heap_t  timers;
+
+static policy_t         *policies;    /* for interfaces that appear */
+static size_t            npolicies;
+static watched_t        *watched;     /* open addressing, by index */
+static size_t            watched_len, watched_size;
+static unsigned int      batch;
+
+/* Tags for the epoll entries that are not clients */
+static char listen_tag, signal_tag, timer_tag, watch_tag;
+
+
+static void
+message (const char *kind, const char *format, ...)
+{
+	va_list va;
+
+	fprintf (stderr, "[%s]: ", kind);
+	va_start (va, format);
+	vfprintf (stderr, format, va);
+	va_end (va);
+	fputc ('\n', stderr);
+}
+
+
+/* Passes on what the library warned about */
+static void
+show_warnings (void)
+{
+	const char *msg;
+
+	if ((msg = macchanger_warning (ctx)) != NULL) {
+		message ("WARNING", "%s", msg);
+	}
+}
+
+
+static void
+print_help (void)
+{
+	printf ("GNU MAC Changer daemon\n"
+		"Usage: macchangerd [options]\n\n"
+		"  -h,  --help                   Print this help\n"
+		"  -V,  --version                Print version and exit\n"
+		"  -s,  --socket=path            Listen on path (default " MCD_SOCKET ")\n"
+		"  -r,  --rotate=rule            Change the addresses of the interfaces\n"
+		"                                matching a pattern on a schedule, as in\n"
+		"                                'wlan* every 1h jitter 10m vendor-random'\n"
+		"                                or 'eth0 cron 0 4 * * * random'\n"
+		"  -f,  --rotate-file=file       Read rotation rules from file, one a line\n"
+		"  -w,  --watch=rule             Change the address of every interface that\n"
+		"                                appears with a name matching a pattern, and\n"
+		"                                keep it, as in 'veth* random' or\n"
+		"                                'vf* set 02:00:00:00:00:01'\n"
+		"       --watch-file=file        Read watch rules from file, one a line\n"
+		"       --vendor-weights=how     How vendor-random picks vendors, as in\n"
+		"                                macchanger(1)\n"
+		"       --state-file=file        Save original MACs in file\n"
+		"       --no-state               Don't save original MACs\n\n"
+		"Report bugs to https://github.com/alobbs/macchanger/issues\n");
+}
+
+
+static unsigned long
+elapsed_usec (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000UL +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+static void *
+allocate (void *ptr, size_t size)
+{
+	if ((ptr = realloc (ptr, size)) == NULL && size > 0) {
+		message ("FATAL_ERROR", "Not enough memory");
+		exit (EXIT_ERROR);
+	}
+	return ptr;
+}
+
+
+/* Watched interfaces
+ */
+
+static size_t
+watched_slot (unsigned int index)
+{
+	size_t slot = (index * 2654435761u) & (watched_size - 1);
+
+	while (watched[slot].index != 0 && watched[slot].index != index) {
+		slot = (slot + 1) & (watched_size - 1);
+	}
+	return slot;
+}
+
+
+static watched_t *
+watched_find (unsigned int index)
+{
+	watched_t *w;
+
+	if (watched_size == 0) {
+		return NULL;
+	}
+	w = &watched[watched_slot (index)];
+	return (w->index == index) ? w : NULL;
+}
+
+
+/* The entry of 'index', made blank if there was none */
+static watched_t *
+watched_add (unsigned int index)
+{
+	watched_t *old = watched;
+	size_t     old_size = watched_size;
+	size_t     i;
+	watched_t *w;
+
+	if (2 * (watched_len + 1) > watched_size) {
+		watched_size = watched_size ? 2 * watched_size : 256;
+		watched = allocate (NULL, watched_size * sizeof(watched_t));
+		memset (watched, 0, watched_size * sizeof(watched_t));
+		for (i=0; i<old_size; i++) {
+			if (old[i].index != 0) {
+				watched[watched_slot (old[i].index)] = old[i];
+			}
+		}
+		free (old);
+	}
+
+	w = &watched[watched_slot (index)];
+	if (w->index != index) {
+		memset (w, 0, sizeof(*w));
+		w->index = index;
+		watched_len++;
+	}
+	return w;
+}
+
+
+static void
+watched_remove (unsigned int index)
+{
+	size_t hole, slot, home;
+
+	if (watched_find (index) == NULL) {
+		return;
+	}
+
+	/* Pull back the entries that probed past the hole */
+	hole = watched_slot (index);
+	slot = hole;
+	for (;;) {
+		slot = (slot + 1) & (watched_size - 1);
+		if (watched[slot].index == 0) {
+			break;
+		}
+		home = (watched[slot].index * 2654435761u) & (watched_size - 1);
+		if (((slot - home) & (watched_size - 1)) >= ((slot - hole) & (watched_size - 1))) {
+			watched[hole] = watched[slot];
+			hole = slot;
+		}
+	}
+	watched[hole].index = 0;
+	watched_len--;
+}
+
+
+/* The daemon changed the address itself: that is what to keep */
+static void
+watched_changed (unsigned int index, const macchanger_mac_t *mac)
+{
+	watched_t *w = watched_find (index);
+
+	if (w != NULL && w->managed) {
+		w->mac    = *mac;
+		w->failed = 0;
+	}
+}
+
+
+/* Requests
+ */
+
+/* Sets the address of 'device' and reads it back into 'result' */
+static int
+change (const char *device, const macchanger_mac_t *mac, char *result)
+{
+	macchanger_mac_t now;
+
+	if (macchanger_set_mac (ctx, device, mac) < 0 ||
+	    macchanger_get_mac (ctx, device, &now) < 0) {
+		return -1;
+	}
+	if (watched_len > 0) {
+		watched_changed (if_nametoindex (device), &now);
+	}
+
+	macchanger_format (&now, result);
+	return 0;
+}
+
+
+static int
+change_random (const char *device, macchanger_random_t mode, int bia, char *result)
+{
+	macchanger_mac_t mac;
+
+	if (macchanger_get_mac (ctx, device, &mac) < 0 ||
+	    macchanger_random (ctx, &mac, mode, bia) < 0) {
+		return -1;
+	}
+
+	return change (device, &mac, result);
+}
+
+
+static int
+do_show (const char *device, char *result, size_t size)
+{
+	macchanger_mac_t mac, permanent;
+	char             current[MACCHANGER_MAC_STRING_LEN];
+	char             perm[MACCHANGER_MAC_STRING_LEN] = "-";
+
+	if (macchanger_get_mac (ctx, device, &mac) < 0) {
+		return -1;
+	}
+	if (macchanger_get_permanent_mac (ctx, device, &permanent) == 0) {
+		macchanger_format (&permanent, perm);
+	}
+
+	macchanger_format (&mac, current);
+	snprintf (result, size, "%s %s", current, perm);
+	return 0;
+}
+
+
+static int
+do_restore (const char *device, char *result)
+{
+	static const macchanger_mac_t zero;
+	macchanger_mac_t mac;
+
+	/* Devices without a burned-in address go back to the saved one */
+	if ((macchanger_get_permanent_mac (ctx, device, &mac) < 0 ||
+	     memcmp (&mac, &zero, sizeof(zero)) == 0) &&
+	    macchanger_get_original_mac (ctx, device, &mac) < 0) {
+		return -1;
+	}
+
+	return change (device, &mac, result);
+}
+
+
+static int
+do_resolve (const char *text, char *result, size_t size)
+{
+	macchanger_mac_t mac;
+	char             string[MACCHANGER_MAC_STRING_LEN];
+	const char      *vendor;
+	int              is_wireless;
+
+	if (macchanger_parse (ctx, text, &mac) < 0 ||
+	    macchanger_lookup (ctx, &mac, &vendor, &is_wireless) < 0) {
+		return -1;
+	}
+
+	macchanger_format (&mac, string);
+	snprintf (result, size, "%s %s %s", string,
+		  is_wireless ? "wireless" : "other",
+		  vendor ? vendor : "unknown");
+	return 0;
+}
+
+
+/* Runs one request.  Returns 0 with the reply in 'result', or -1 with
+ * the error message in it.
+ */
+static int
+serve (char **argv, int argc, char *result, size_t size)
+{
+	const char       *cmd = argv[0];
+	macchanger_mac_t  mac;
+	int               ret;
+
+	/* Every command takes one or two arguments */
+	if (argc < 2 || argc > 3) {
+		snprintf (result, size, "Wrong number of arguments");
+		return -1;
+	}
+
+	if (strcmp (cmd, "show") == 0 && argc == 2) {
+		ret = do_show (argv[1], result, size);
+	} else if (strcmp (cmd, "set") == 0 && argc == 3) {
+		ret = macchanger_parse (ctx, argv[2], &mac);
+		if (ret == 0) {
+			ret = change (argv[1], &mac, result);
+		}
+	} else if (strcmp (cmd, "random") == 0 &&
+		   (argc == 2 || strcmp (argv[2], "bia") == 0)) {
+		ret = change_random (argv[1], MACCHANGER_RANDOM, argc == 3, result);
+	} else if (strcmp (cmd, "ending") == 0 && argc == 2) {
+		ret = change_random (argv[1], MACCHANGER_ENDING, 0, result);
+	} else if (strcmp (cmd, "vendor-random") == 0 &&
+		   (argc == 2 || strcmp (argv[2], "any") == 0)) {
+		ret = change_random (argv[1], argc == 3 ? MACCHANGER_ANOTHER_ANY
+							 : MACCHANGER_ANOTHER, 0, result);
+	} else if (strcmp (cmd, "restore") == 0 && argc == 2) {
+		ret = do_restore (argv[1], result);
+	} else if (strcmp (cmd, "resolve") == 0 && argc == 2) {
+		ret = do_resolve (argv[1], result, size);
+	} else {
+		snprintf (result, size, "Unknown request: %s", cmd);
+		return -1;
+	}
+
+	if (ret < 0) {
+		snprintf (result, size, "%s", macchanger_error (ctx));
+	}
+	return ret;
+}
+
+
+/* Clients
+ */
+
+static void
+client_append (client_t *c, const char *text, size_t len)
+{
+	if (c->out_pos > 0 && c->out_pos == c->out_len) {
+		c->out_pos = c->out_len = 0;
+	}
+
+	if (c->out_len + len > c->out_size) {
+		if (c->out_pos > 0) {
+			memmove (c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+			c->out_len -= c->out_pos;
+			c->out_pos  = 0;
+		}
+		while (c->out_len + len > c->out_size) {
+			c->out_size = c->out_size ? 2 * c->out_size : 4096;
+		}
+		if ((c->out = realloc (c->out, c->out_size)) == NULL) {
+			message ("FATAL_ERROR", "Not enough memory");
+			exit (EXIT_ERROR);
+		}
+	}
+
+	memcpy (c->out + c->out_len, text, len);
+	c->out_len += len;
+}
+
+
+static void
+client_request (client_t *c, char *line)
+{
+	struct timespec start;
+	char           *argv[MCD_MAX_ARGS + 1];
+	char           *id, *save;
+	char            result[512];
+	char            reply[MCD_LINE_MAX + sizeof(result) + 64];
+	int             argc = 0;
+	int             ret;
+	int             len;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	if ((id = strtok_r (line, " \t\r", &save)) == NULL) {
+		return;  /* blank line */
+	}
+	while (argc <= MCD_MAX_ARGS &&
+	       (argv[argc] = strtok_r (NULL, " \t\r", &save)) != NULL) {
+		argc++;
+	}
+
+	if (argc == 0) {
+		snprintf (result, sizeof(result), "Missing request");
+		ret = -1;
+	} else if (argc > MCD_MAX_ARGS) {
+		snprintf (result, sizeof(result), "Wrong number of arguments");
+		ret = -1;
+	} else {
+		ret = serve (argv, argc, result, sizeof(result));
+	}
+
+	len = snprintf (reply, sizeof(reply), "%s %s %lu %s\n", id,
+			(ret == 0) ? "ok" : "error", elapsed_usec (&start), result);
+	client_append (c, reply, len);
+}
+
+
+/* Serves every complete line read so far */
+static void
+client_requests (client_t *c)
+{
+	char   *line = c->in;
+	char   *nl;
+	size_t  left = c->in_len;
+
+	while (c->out_len - c->out_pos < MCD_OUT_MAX &&
+	       (nl = memchr (line, '\n', left)) != NULL) {
+		*nl = '\0';
+		client_request (c, line);
+		left -= nl + 1 - line;
+		line  = nl + 1;
+	}
+
+	memmove (c->in, line, left);
+	c->in_len = left;
+
+	if (c->in_len == sizeof(c->in)) {
+		client_append (c, "- error 0 Request too long\n", 27);
+		c->eof    = 1;
+		c->in_len = 0;
+	}
+}
+
+
+/* Returns -1 if the client went away */
+static int
+client_read (client_t *c)
+{
+	ssize_t n;
+
+	while (!c->eof && c->out_len - c->out_pos < MCD_OUT_MAX) {
+		n = read (c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
+		if (n == 0) {
+			c->eof = 1;
+		}
+
+		c->in_len += n;
+		client_requests (c);
+	}
+
+	return 0;
+}
+
+
+/* Returns -1 if the client went away */
+static int
+client_flush (client_t *c)
+{
+	ssize_t n;
+
+	while (c->out_pos < c->out_len) {
+		n = write (c->fd, c->out + c->out_pos, c->out_len - c->out_pos);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			return -1;
+		}
+		c->out_pos += n;
+	}
+
+	return 0;
+}
+
+
+static void
+client_close (int ep, client_t *c)
+{
+	epoll_ctl (ep, EPOLL_CTL_DEL, c->fd, NULL);
+	close (c->fd);
+	free (c->out);
+	free (c);
+}
+
+
+/* Runs whatever a readiness event allows, then watches for what the
+ * client waits on next.  Returns -1 once the client is gone.
+ */
+static int
+client_event (int ep, client_t *c, unsigned int events)
+{
+	struct epoll_event ev;
+	int                pending;
+
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && client_read (c) < 0) {
+		goto gone;
+	}
+
+	/* Lines left over from a full output buffer */
+	client_requests (c);
+	if (client_flush (c) < 0) {
+		goto gone;
+	}
+
+	pending = (c->out_pos < c->out_len);
+	if (c->eof && !pending) {
+		goto gone;
+	}
+
+	ev.events = (pending ? EPOLLOUT : 0) |
+		    ((c->eof || c->out_len - c->out_pos >= MCD_OUT_MAX) ? 0 : EPOLLIN);
+	if (ev.events != (unsigned int) c->events) {
+		ev.data.ptr = c;
+		epoll_ctl (ep, EPOLL_CTL_MOD, c->fd, &ev);
+		c->events = ev.events;
+	}
+	return 0;
+
+gone:
+	client_close (ep, c);
+	return -1;
+}
+
+
+static void
+accept_clients (int ep, int sock)
+{
+	struct epoll_event ev;
+	client_t          *c;
+	int                fd;
+
+	while ((fd = accept4 (sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if ((c = calloc (1, sizeof(client_t))) == NULL) {
+			close (fd);
+			continue;
+		}
+		c->fd     = fd;
+		c->events = EPOLLIN;
+
+		ev.events   = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl (ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close (fd);
+			free (c);
+		}
+	}
+}
+
+
+/* Rotation
+ */
+
+static int64_t
+now_msec (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/* The next turn of 'rot' after 'now', or never */
+static int64_t
+next_due (const rotation_t *rot, int64_t now)
+{
+	int64_t due = mcd_schedule_next (&rot->schedule, now, random ());
+
+	return (due < 0) ? INT64_MAX : due;
+}
+
+
+/* Splits a rule into at most MCD_RULE_WORDS words of 'copy' */
+static int
+split_rule (const char *rule, char **copy, char **argv)
+{
+	char *save;
+	int   argc = 0;
+
+	*copy = allocate (NULL, strlen (rule) + 1);
+	strcpy (*copy, rule);
+	while (argc <= MCD_RULE_WORDS &&
+	       (argv[argc] = strtok_r (argc ? NULL : *copy, " \t\r\n", &save)) != NULL) {
+		argc++;
+	}
+	return argc;
+}
+
+
+/* Fills 'p' from a pattern and the MODE words that follow the
+ * 'used' ones.  'set MAC' is only for policies that may be 'fixed'.
+ */
+static int
+parse_policy (policy_t *p, char **argv, int argc, int used, int fixed,
+	      char *err, size_t size)
+{
+	int n;
+
+	memset (p, 0, sizeof(*p));
+	p->mode = MACCHANGER_RANDOM;
+
+	if (used < argc && strcmp (argv[used], "random") == 0) {
+		used++;
+		if (used < argc && strcmp (argv[used], "bia") == 0) {
+			p->bia = 1;
+			used++;
+		}
+	} else if (used < argc && (strcmp (argv[used], "ending") == 0 ||
+				   strcmp (argv[used], "same-vendor") == 0)) {
+		p->mode = MACCHANGER_ENDING;
+		used++;
+	} else if (used < argc && strcmp (argv[used], "vendor-random") == 0) {
+		p->mode = MACCHANGER_ANOTHER;
+		used++;
+		if (used < argc && strcmp (argv[used], "any") == 0) {
+			p->mode = MACCHANGER_ANOTHER_ANY;
+			used++;
+		}
+	} else if (used + 1 < argc && strcmp (argv[used], "shard") == 0) {
+		if (sscanf (argv[used+1], "%lu/%u%n", &p->node, &p->bits, &n) != 2 ||
+		    argv[used+1][n] != '\0') {
+			snprintf (err, size, "Expected shard NODE/BITS");
+			return -1;
+		}
+		if (macchanger_set_shard (ctx, p->node, p->bits) < 0) {
+			snprintf (err, size, "%s", macchanger_error (ctx));
+			return -1;
+		}
+		p->mode = MACCHANGER_SHARD;
+		used += 2;
+	} else if (fixed && used + 1 < argc && strcmp (argv[used], "set") == 0) {
+		if (macchanger_parse (ctx, argv[used+1], &p->mac) < 0) {
+			snprintf (err, size, "%s", macchanger_error (ctx));
+			return -1;
+		}
+		p->fixed = 1;
+		used += 2;
+	}
+	if (used < argc) {
+		snprintf (err, size, "Unknown mode: %s", argv[used]);
+		return -1;
+	}
+
+	p->pattern = allocate (NULL, strlen (argv[0]) + 1);
+	strcpy (p->pattern, argv[0]);
+	return 0;
+}
+
+
+/* The address 'p' gives an interface whose address is 'mac' now */
+static int
+policy_mac (const policy_t *p, macchanger_mac_t *mac)
+{
+	if (p->fixed) {
+		*mac = p->mac;
+		return 0;
+	}
+	if (p->mode == MACCHANGER_SHARD && macchanger_set_shard (ctx, p->node, p->bits) < 0) {
+		return -1;
+	}
+	return macchanger_random (ctx, mac, p->mode, p->bia);
+}
+
+
+/* Parses a rule and queues its first rotation.  Returns -1 with a
+ * message in 'err' if the rule is wrong.
+ */
+static int
+add_rotation (const char *rule, char *err, size_t size)
+{
+	rotation_t *rot;
+	char       *copy;
+	char       *argv[MCD_RULE_WORDS + 1];
+	int         argc, used;
+
+	argc = split_rule (rule, &copy, argv);
+	if (argc < 2 || argc > MCD_RULE_WORDS) {
+		snprintf (err, size, "Expected PATTERN SCHEDULE [MODE]");
+		free (copy);
+		return -1;
+	}
+
+	rot = allocate (NULL, sizeof(rotation_t));
+	memset (rot, 0, sizeof(*rot));
+	if ((used = mcd_schedule_parse (&rot->schedule, argv + 1, argc - 1, err, size)) < 0 ||
+	    parse_policy (&rot->policy, argv, argc, used + 1, 0, err, size) < 0) {
+		goto wrong;
+	}
+
+	if ((rot->timer.due = next_due (rot, now_msec ())) == INT64_MAX) {
+		snprintf (err, size, "The schedule never comes");
+		goto wrong;
+	}
+	if (mcd_timer_add (&timers, &rot->timer) < 0) {
+		message ("FATAL_ERROR", "Not enough memory");
+		exit (EXIT_ERROR);
+	}
+	free (copy);
+	return 0;
+
+wrong:
+	free (rot->policy.pattern);
+	free (rot);
+	free (copy);
+	return -1;
+}
+
+
+/* Parses a rule for the interfaces that appear from now on */
+static int
+add_policy (const char *rule, char *err, size_t size)
+{
+	char *copy;
+	char *argv[MCD_RULE_WORDS + 1];
+	int   argc, ret = -1;
+
+	argc = split_rule (rule, &copy, argv);
+	if (argc < 1 || argc > MCD_RULE_WORDS) {
+		snprintf (err, size, "Expected PATTERN [MODE]");
+	} else {
+		policies = allocate (policies, (npolicies + 1) * sizeof(policy_t));
+		if ((ret = parse_policy (&policies[npolicies], argv, argc, 1, 1, err, size)) == 0) {
+			npolicies++;
+		}
+	}
+
+	free (copy);
+	return ret;
+}
+
+
+/* Adds every rule of a file, one a line */
+static int
+read_rules (const char *path, int (*add) (const char *, char *, size_t))
+{
+	FILE         *f;
+	char          line[MCD_LINE_MAX];
+	char          err[256];
+	const char   *p;
+	unsigned long n = 0;
+	int           ret = 0;
+
+	if ((f = fopen (path, "r")) == NULL) {
+		message ("ERROR", "Could not open %s: %s", path, strerror (errno));
+		return -1;
+	}
+
+	while (fgets (line, sizeof(line), f) != NULL) {
+		n++;
+		for (p = line; *p == ' ' || *p == '\t'; p++);
+		if (*p == '#' || *p == '\n' || *p == '\0') {
+			continue;
+		}
+		if (add (p, err, sizeof(err)) < 0) {
+			message ("ERROR", "%s:%lu: %s", path, n, err);
+			ret = -1;
+		}
+	}
+
+	fclose (f);
+	return ret;
+}
+
+
+/* The first due rule whose pattern matches 'link', or NULL */
+static rotation_t *
+rotation_for (rotation_t **due, size_t ndue, const macchanger_link_t *link)
+{
+	size_t i;
+
+	if (!link->has_mac || (link->flags & IFF_LOOPBACK)) {
+		return NULL;
+	}
+	for (i=0; i<ndue; i++) {
+		if (fnmatch (due[i]->policy.pattern, link->name, 0) == 0) {
+			return due[i];
+		}
+	}
+	return NULL;
+}
+
+
+/* Rotates the interfaces of every due rule, all in one batch */
+static void
+rotate (rotation_t **due, size_t ndue)
+{
+	macchanger_link_t *links;
+	macchanger_mac_t  *macs;
+	rotation_t        *rot;
+	const char       **names;
+	unsigned int      *indexes;
+	int               *errors;
+	size_t             nlinks, n = 0, i;
+
+	if (macchanger_links (ctx, 0, &links, &nlinks) < 0) {
+		message ("ERROR", "Could not rotate: %s", macchanger_error (ctx));
+		return;
+	}
+
+	names  = allocate (NULL, nlinks * sizeof(char *));
+	macs   = allocate (NULL, nlinks * sizeof(macchanger_mac_t));
+	errors = allocate (NULL, nlinks * sizeof(int));
+	indexes = allocate (NULL, nlinks * sizeof(unsigned int));
+
+	for (i=0; i<nlinks; i++) {
+		if ((rot = rotation_for (due, ndue, &links[i])) == NULL) {
+			continue;
+		}
+		macs[n] = links[i].mac;
+		if (policy_mac (&rot->policy, &macs[n]) < 0) {
+			message ("ERROR", "Could not rotate %s: %s", links[i].name,
+				 macchanger_error (ctx));
+			continue;
+		}
+		indexes[n] = links[i].index;
+		names[n++] = links[i].name;
+	}
+
+	if (n > 0) {
+		macchanger_set_macs (ctx, names, macs, errors, n);
+	}
+	for (i=0; i<n; i++) {
+		if (errors[i] != 0) {
+			message ("ERROR", "Could not rotate %s: %s", names[i], strerror (errors[i]));
+		} else {
+			watched_changed (indexes[i], &macs[i]);
+		}
+	}
+
+	free (indexes);
+	free (errors);
+	free (macs);
+	free (names);
+	free (links);
+}
+
+
+/* Runs the rules that are due and schedules their next turn.  After a
+ * clock change, 'reset' moves every rule to its next time from now.
+ */
+static void
+run_rotations (int reset)
+{
+	rotation_t  **due = NULL;
+	rotation_t   *rot;
+	mcd_timer_t  *first;
+	size_t        ndue = 0, i;
+	int64_t       now = now_msec ();
+
+	if (reset) {
+		for (i=0; i<timers.len; i++) {
+			rot = (rotation_t *) timers.timers[i];
+			if (rot->schedule.kind == MCD_CRON || rot->timer.due > now +
+			    (int64_t) (rot->schedule.every + rot->schedule.jitter) * 1000) {
+				rot->timer.due = next_due (rot, now);
+			}
+		}
+		mcd_timer_reorder (&timers);
+	}
+
+	while ((first = mcd_timer_first (&timers)) != NULL && first->due <= now) {
+		rot = (rotation_t *) first;
+		due = allocate (due, (ndue + 1) * sizeof(rotation_t *));
+		due[ndue++] = rot;
+
+		/* Missed turns are not made up for */
+		rot->timer.due = next_due (rot, now);
+		mcd_timer_update (&timers, &rot->timer);
+	}
+
+	if (ndue > 0) {
+		rotate (due, ndue);
+	}
+	free (due);
+}
+
+
+/* Arms the timerfd for the earliest rule */
+static void
+arm_timer (int tfd)
+{
+	struct itimerspec spec;
+	mcd_timer_t      *first = mcd_timer_first (&timers);
+
+	memset (&spec, 0, sizeof(spec));
+	if (first != NULL && first->due != INT64_MAX) {
+		spec.it_value.tv_sec  = first->due / 1000;
+		spec.it_value.tv_nsec = (first->due % 1000) * 1000000;
+	}
+	timerfd_settime (tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL);
+}
+
+
+static void
+timer_event (int tfd)
+{
+	uint64_t expired;
+	int      reset = 0;
+
+	if (read (tfd, &expired, sizeof(expired)) < 0 && errno == ECANCELED) {
+		reset = 1;  /* the clock was set */
+	}
+
+	run_rotations (reset);
+	arm_timer (tfd);
+}
+
+
+/* Watching
+ */
+
+static const policy_t *
+policy_for (const macchanger_link_t *link)
+{
+	size_t i;
+
+	if (!link->has_mac || (link->flags & IFF_LOOPBACK)) {
+		return NULL;
+	}
+	for (i=0; i<npolicies; i++) {
+		if (fnmatch (policies[i].pattern, link->name, 0) == 0) {
+			return &policies[i];
+		}
+	}
+	return NULL;
+}
+
+
+/* Forgets the interfaces a complete list did not have */
+static void
+watched_sweep (void)
+{
+	watched_t *old = watched;
+	size_t     old_size = watched_size;
+	size_t     i;
+
+	watched      = allocate (NULL, watched_size * sizeof(watched_t));
+	watched_len  = 0;
+	memset (watched, 0, watched_size * sizeof(watched_t));
+	for (i=0; i<old_size; i++) {
+		if (old[i].index != 0 && old[i].seen == batch) {
+			watched[watched_slot (old[i].index)] = old[i];
+			watched_len++;
+		}
+	}
+	free (old);
+}
+
+
+/* Takes note of what the interfaces are now, without changing them */
+static int
+watch_start (int *fd)
+{
+	macchanger_link_t *links;
+	size_t             n, i;
+
+	if (macchanger_watch (ctx, fd) < 0 ||
+	    macchanger_links (ctx, 0, &links, &n) < 0) {
+		message ("ERROR", "%s", macchanger_error (ctx));
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		watched_add (links[i].index);
+	}
+	free (links);
+	return 0;
+}
+
+
+/* Applies the policies to the interfaces that appeared, and the
+ * addresses they chose again to those that lost them.  Everything
+ * one read returns is changed in one batch.
+ */
+static void
+watch_event (void)
+{
+	macchanger_link_event_t *events;
+	const macchanger_link_t *link;
+	const policy_t          *p;
+	watched_t               *w;
+	macchanger_mac_t        *macs;
+	macchanger_outage_t      outage;
+	const char             **names;
+	unsigned int            *indexes;
+	int                     *errors;
+	size_t                   nevents, n = 0, i;
+	int                      complete;
+
+	if (macchanger_watch_read (ctx, &events, &nevents, &complete) < 0) {
+		message ("ERROR", "%s", macchanger_error (ctx));
+		return;
+	}
+
+	names   = allocate (NULL, (nevents + 1) * sizeof(char *));
+	macs    = allocate (NULL, (nevents + 1) * sizeof(macchanger_mac_t));
+	indexes = allocate (NULL, (nevents + 1) * sizeof(unsigned int));
+	errors  = allocate (NULL, (nevents + 1) * sizeof(int));
+	batch++;
+
+	for (i=0; i<nevents; i++) {
+		link = &events[i].link;
+		if (events[i].removed) {
+			watched_remove (link->index);
+			continue;
+		}
+
+		if ((w = watched_find (link->index)) == NULL) {
+			/* New: its policy decides, once */
+			w = watched_add (link->index);
+			if ((p = policy_for (link)) != NULL) {
+				w->mac = link->mac;
+				if (policy_mac (p, &w->mac) < 0) {
+					message ("ERROR", "%s: %s", link->name, macchanger_error (ctx));
+				} else {
+					w->managed = 1;
+				}
+			}
+		}
+		w->seen = batch;
+
+		if (!w->managed || w->failed || w->queued == batch ||
+		    memcmp (&w->mac, &link->mac, sizeof(w->mac)) == 0) {
+			continue;
+		}
+
+		w->queued  = batch;
+		names[n]   = link->name;
+		macs[n]    = w->mac;
+		indexes[n] = link->index;
+		n++;
+	}
+
+	if (complete) {
+		watched_sweep ();
+	}
+
+	if (n > 0) {
+		macchanger_set_macs (ctx, names, macs, errors, n);
+	}
+	for (i=0; i<n; i++) {
+		/* Came up before it could be changed, with a driver
+		 * that will not change it while up.
+		 */
+		if (errors[i] == EBUSY &&
+		    macchanger_set_mac_bounce (ctx, names[i], &macs[i], &outage) == 0) {
+			errors[i] = 0;
+		}
+
+		if (errors[i] != 0 && errors[i] != ENODEV &&
+		    (w = watched_find (indexes[i])) != NULL) {
+			message ("ERROR", "Could not change MAC of %s: %s", names[i],
+				 strerror (errors[i]));
+			w->failed = 1;  /* until the daemon sets it otherwise */
+		}
+	}
+
+	free (errors);
+	free (indexes);
+	free (macs);
+	free (names);
+	free (events);
+}
+
+
+/* Set up
+ */
+
+static int
+listen_on (const char *path)
+{
+	struct sockaddr_un addr;
+	int                sock;
+	mode_t             mask;
+
+	if (strlen (path) >= sizeof(addr.sun_path)) {
+		message ("ERROR", "Socket path too long: %s", path);
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+
+	if ((sock = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		message ("ERROR", "Socket: %s", strerror (errno));
+		return -1;
+	}
+
+	/* Take over the socket of a daemon that is no longer there */
+	if (connect (sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		message ("ERROR", "Another daemon is listening on %s", path);
+		close (sock);
+		return -1;
+	}
+	unlink (path);
+
+	/* Only the owner may change addresses */
+	mask = umask (0077);
+	if (bind (sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    listen (sock, SOMAXCONN) < 0) {
+		message ("ERROR", "Could not listen on %s: %s", path, strerror (errno));
+		umask (mask);
+		close (sock);
+		return -1;
+	}
+	umask (mask);
+
+	return sock;
+}
+
+
+static int
+watch (int ep, int fd, void *tag)
+{
+	struct epoll_event ev;
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = tag;
+	return epoll_ctl (ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	const char *path = MCD_SOCKET;
+	const char *weights = NULL;
+	const char *state_file = NULL;
+	char        keep_state = 1;
+	char        err[256];
+	int         sock, sig, ep, tfd, wfd;
+	int         running = 1;
+	int         val, n, i;
+	int         ret, wrong = 0;
+	sigset_t    signals;
+	struct signalfd_siginfo info;
+	struct epoll_event      events[MCD_MAX_EVENTS];
+
+	struct option long_options[] = {
+		{"help",           no_argument,       NULL, 'h'},
+		{"version",        no_argument,       NULL, 'V'},
+		{"socket",         required_argument, NULL, 's'},
+		{"vendor-weights", required_argument, NULL, OPT_VENDOR_WEIGHTS},
+		{"rotate",         required_argument, NULL, 'r'},
+		{"rotate-file",    required_argument, NULL, 'f'},
+		{"watch",          required_argument, NULL, 'w'},
+		{"watch-file",     required_argument, NULL, OPT_WATCH_FILE},
+		{"state-file",     required_argument, NULL, OPT_STATE_FILE},
+		{"no-state",       no_argument,       NULL, OPT_NO_STATE},
+		{NULL, 0, NULL, 0}
+	};
+
+	srandom (time (NULL) ^ getpid ());
+
+	if ((ctx = macchanger_new ()) == NULL) {
+		message ("FATAL_ERROR", "Could not initialize the library.");
+		exit (EXIT_ERROR);
+	}
+
+	while ((val = getopt_long (argc, argv, "hVs:r:f:w:", long_options, NULL)) != -1) {
+		switch (val) {
+		case 'V':
+			printf ("GNU MAC changer daemon %s\n", VERSION);
+			exit (EXIT_OK);
+			break;
+		case 's':
+			path = optarg;
+			break;
+		case OPT_VENDOR_WEIGHTS:
+			weights = optarg;
+			break;
+		case 'r':
+			if (add_rotation (optarg, err, sizeof(err)) < 0) {
+				message ("ERROR", "%s: %s", optarg, err);
+				wrong = 1;
+			}
+			break;
+		case 'f':
+			if (read_rules (optarg, add_rotation) < 0) {
+				wrong = 1;
+			}
+			break;
+		case 'w':
+			if (add_policy (optarg, err, sizeof(err)) < 0) {
+				message ("ERROR", "%s: %s", optarg, err);
+				wrong = 1;
+			}
+			break;
+		case OPT_WATCH_FILE:
+			if (read_rules (optarg, add_policy) < 0) {
+				wrong = 1;
+			}
+			break;
+		case OPT_STATE_FILE:
+			state_file = optarg;
+			break;
+		case OPT_NO_STATE:
+			keep_state = 0;
+			break;
+		case 'h':
+		default:
+			print_help ();
+			exit ((val == 'h') ? EXIT_OK : EXIT_ERROR);
+			break;
+		}
+	}
+
+	if (wrong) {
+		exit (EXIT_ERROR);
+	}
+
+	if (weights) {
+		if (strcmp (weights, "oui") == 0) {
+			ret = macchanger_set_vendor_dist (ctx, MACCHANGER_VENDOR_BY_OUI, NULL);
+		} else if (strcmp (weights, "vendor") == 0) {
+			ret = macchanger_set_vendor_dist (ctx, MACCHANGER_VENDOR_BY_NAME, NULL);
+		} else {
+			ret = macchanger_set_vendor_dist (ctx, MACCHANGER_VENDOR_BY_WEIGHT, weights);
+		}
+		if (ret < 0) {
+			message ("ERROR", "%s", macchanger_error (ctx));
+			exit (EXIT_ERROR);
+		}
+	}
+
+	if (keep_state && macchanger_use_state (ctx, state_file) < 0) {
+		if (state_file) {
+			message ("ERROR", "%s", macchanger_error (ctx));
+			exit (EXIT_ERROR);
+		}
+		message ("WARNING", "%s; original MACs will not be saved",
+			 macchanger_error (ctx));
+	}
+
+	/* Pay for the vendor lists now, not on the first request */
+	if (macchanger_preload (ctx) < 0) {
+		message ("ERROR", "%s", macchanger_error (ctx));
+		exit (EXIT_ERROR);
+	}
+	show_warnings ();
+
+	/* Shut down cleanly on a signal, from the loop */
+	signal (SIGPIPE, SIG_IGN);
+	sigemptyset (&signals);
+	sigaddset (&signals, SIGINT);
+	sigaddset (&signals, SIGTERM);
+	sigprocmask (SIG_BLOCK, &signals, NULL);
+
+	if ((sock = listen_on (path)) < 0) {
+		exit (EXIT_ERROR);
+	}
+
+	if ((sig = signalfd (-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+	    (tfd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+	    (ep = epoll_create1 (EPOLL_CLOEXEC)) < 0 ||
+	    watch (ep, sock, &listen_tag) < 0 ||
+	    watch (ep, sig, &signal_tag) < 0 ||
+	    watch (ep, tfd, &timer_tag) < 0) {
+		message ("ERROR", "Could not set up the event loop: %s", strerror (errno));
+		unlink (path);
+		exit (EXIT_ERROR);
+	}
+
+	/* Subscribe before listing, so no interface falls in between */
+	if (npolicies > 0) {
+		if (watch_start (&wfd) < 0) {
+			unlink (path);
+			exit (EXIT_ERROR);
+		}
+		if (watch (ep, wfd, &watch_tag) < 0) {
+			message ("ERROR", "Could not set up the event loop: %s", strerror (errno));
+			unlink (path);
+			exit (EXIT_ERROR);
+		}
+	}
+
+	arm_timer (tfd);
+
+	while (running) {
+		n = epoll_wait (ep, events, MCD_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			message ("ERROR", "epoll_wait: %s", strerror (errno));
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			if (events[i].data.ptr == &listen_tag) {
+				accept_clients (ep, sock);
+			} else if (events[i].data.ptr == &signal_tag) {
+				while (read (sig, &info, sizeof(info)) == sizeof(info)) {
+					running = 0;
+				}
+			} else if (events[i].data.ptr == &timer_tag) {
+				timer_event (tfd);
+			} else if (events[i].data.ptr == &watch_tag) {
+				watch_event ();
+			} else {
+				client_event (ep, events[i].data.ptr, events[i].events);
+			}
+		}
+		show_warnings ();
+	}
+
+	/* Clients still connected are dropped */
+	unlink (path);
+	close (sock);
+	close (sig);
+	close (tfd);
+	close (ep);
+	for (i=0; i<(int) timers.len; i++) {
+		free (((rotation_t *) timers.timers[i])->policy.pattern);
+		free (timers.timers[i]);
+	}
+	mcd_timer_free (&timers);
+	for (i=0; i<(int) npolicies; i++) {
+		free (policies[i].pattern);
+	}
+	free (policies);
+	free (watched);
+	macchanger_free (ctx);
+
+	return EXIT_OK;
+}
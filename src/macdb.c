@@ -0,0 +1,318 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "macdb.h"
+#include "common.h"
+
+#define ALIGN8(x)  (((x) + 7) & ~((size_t) 7))
+
+
+/* FNV-1a, fed a 32-bit word at a time
+ */
+uint32_t
+mc_macdb_checksum (const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t             hash = 2166136261u;
+	uint32_t             word;
+
+	while (len >= 4) {
+		memcpy (&word, p, 4);
+		hash = (hash ^ word) * 16777619u;
+		p += 4;
+		len -= 4;
+	}
+	while (len-- > 0) {
+		hash = (hash ^ *p++) * 16777619u;
+	}
+
+	return hash;
+}
+
+
+static const void *
+section_ptr (const void *base, const mc_macdb_header_t *hdr, mc_macdb_section_id_t id)
+{
+	return (const char *) base + hdr->section[id].offset;
+}
+
+
+static int
+mc_macdb_validate (const void *base, size_t size)
+{
+	const mc_macdb_header_t *hdr = base;
+	const char              *strings;
+	int                      i;
+
+	if (size < sizeof(mc_macdb_header_t) ||
+	    memcmp (hdr->magic, MC_MACDB_MAGIC, 4) != 0 ||
+	    hdr->bom != MC_MACDB_BOM ||
+	    mc_macdb_checksum (hdr, offsetof(mc_macdb_header_t, checksum)) != hdr->checksum ||
+	    hdr->version != MC_MACDB_VERSION ||
+	    hdr->nsections != MC_MACDB_SECTIONS ||
+	    hdr->size != size) {
+		return -1;
+	}
+
+	for (i=0; i<MC_MACDB_SECTIONS; i++) {
+		if ((hdr->section[i].offset & 7) ||
+		    hdr->section[i].offset < sizeof(mc_macdb_header_t) ||
+		    hdr->section[i].offset > size ||
+		    hdr->section[i].size > size - hdr->section[i].offset) {
+			return -1;
+		}
+	}
+
+	/* Each key table has a name table of the same length */
+	for (i=MC_MACDB_OTHERS_KEYS; i<MC_MACDB_STRINGS; i+=2) {
+		if (hdr->section[i].size != hdr->section[i+1].size) {
+			return -1;
+		}
+	}
+
+	/* Prefix tables pair 64-bit keys with 32-bit names */
+	if (hdr->section[MC_MACDB_MAM_KEYS].size != 2 * hdr->section[MC_MACDB_MAM_NAMES].size ||
+	    hdr->section[MC_MACDB_MAS_KEYS].size != 2 * hdr->section[MC_MACDB_MAS_NAMES].size) {
+		return -1;
+	}
+
+	/* One postings offset per trigram, plus the end of the last one */
+	if (hdr->section[MC_MACDB_SEARCH_OFFSETS].size !=
+	    hdr->section[MC_MACDB_SEARCH_KEYS].size + sizeof(uint32_t)) {
+		return -1;
+	}
+
+	/* Names must not run off the end of the blob */
+	strings = section_ptr (base, hdr, MC_MACDB_STRINGS);
+	if (hdr->section[MC_MACDB_STRINGS].size == 0 ||
+	    strings[hdr->section[MC_MACDB_STRINGS].size - 1] != '\0') {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int
+mc_macdb_verify (const void *map, mc_macdb_section_id_t id)
+{
+	const mc_macdb_header_t *hdr = map;
+
+	if (mc_macdb_checksum (section_ptr (map, hdr, id), hdr->section[id].size) !=
+	    hdr->section[id].checksum) {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+table_from_sections (mc_oui_table_t *table, const void *base,
+		     const mc_macdb_header_t *hdr, mc_macdb_section_id_t keys)
+{
+	table->keys  = section_ptr (base, hdr, keys);
+	table->names = section_ptr (base, hdr, keys + 1);
+	table->len   = hdr->section[keys].size / sizeof(uint32_t);
+}
+
+
+int
+mc_macdb_map (const char *path, mc_macdb_t *db, void **map, size_t *map_size)
+{
+	int                      fd;
+	struct stat              st;
+	void                    *base;
+	const mc_macdb_header_t *hdr;
+
+	if ((fd = open (path, O_RDONLY)) < 0) {
+		return -1;
+	}
+
+	if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof(mc_macdb_header_t)) {
+		close (fd);
+		return -1;
+	}
+
+	base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+
+	if (mc_macdb_validate (base, st.st_size) < 0) {
+		warning ("Ignoring invalid vendor database: %s", path);
+		munmap (base, st.st_size);
+		return -1;
+	}
+
+	hdr = base;
+	table_from_sections (&db->others,   base, hdr, MC_MACDB_OTHERS_KEYS);
+	table_from_sections (&db->wireless, base, hdr, MC_MACDB_WIRELESS_KEYS);
+	table_from_sections (&db->index,    base, hdr, MC_MACDB_INDEX_KEYS);
+	db->strings     = section_ptr (base, hdr, MC_MACDB_STRINGS);
+	db->strings_len = hdr->section[MC_MACDB_STRINGS].size;
+
+	db->search.keys         = section_ptr (base, hdr, MC_MACDB_SEARCH_KEYS);
+	db->search.offsets      = section_ptr (base, hdr, MC_MACDB_SEARCH_OFFSETS);
+	db->search.postings     = section_ptr (base, hdr, MC_MACDB_SEARCH_POSTINGS);
+	db->search.len          = hdr->section[MC_MACDB_SEARCH_KEYS].size / sizeof(uint32_t);
+	db->search.postings_len = hdr->section[MC_MACDB_SEARCH_POSTINGS].size / sizeof(uint32_t);
+
+	db->mam.keys  = section_ptr (base, hdr, MC_MACDB_MAM_KEYS);
+	db->mam.names = section_ptr (base, hdr, MC_MACDB_MAM_NAMES);
+	db->mam.len   = hdr->section[MC_MACDB_MAM_NAMES].size / sizeof(uint32_t);
+	db->mas.keys  = section_ptr (base, hdr, MC_MACDB_MAS_KEYS);
+	db->mas.names = section_ptr (base, hdr, MC_MACDB_MAS_NAMES);
+	db->mas.len   = hdr->section[MC_MACDB_MAS_NAMES].size / sizeof(uint32_t);
+
+	*map      = base;
+	*map_size = st.st_size;
+	return 0;
+}
+
+
+void
+mc_macdb_unmap (void *map, size_t map_size)
+{
+	if (map) {
+		munmap (map, map_size);
+	}
+}
+
+
+static size_t
+add_section (mc_macdb_header_t *hdr, mc_macdb_section_id_t id, size_t offset, size_t size)
+{
+	hdr->section[id].offset = offset;
+	hdr->section[id].size   = size;
+	return ALIGN8 (offset + size);
+}
+
+
+int
+mc_macdb_write (const char *path, const mc_macdb_t *db)
+{
+	mc_macdb_header_t  hdr;
+	const void        *data[MC_MACDB_SECTIONS];
+	size_t             sizes[MC_MACDB_SECTIONS];
+	const mc_oui_table_t *tables[3];
+	char              *buf, *tmp_path;
+	size_t             size;
+	FILE              *f;
+	int                i, ret = 0;
+
+	memset (&hdr, 0, sizeof(hdr));
+	memcpy (hdr.magic, MC_MACDB_MAGIC, 4);
+	hdr.bom       = MC_MACDB_BOM;
+	hdr.version   = MC_MACDB_VERSION;
+	hdr.nsections = MC_MACDB_SECTIONS;
+
+	tables[0] = &db->others;
+	tables[1] = &db->wireless;
+	tables[2] = &db->index;
+
+	for (i=0; i<3; i++) {
+		data[2*i]    = tables[i]->keys;
+		data[2*i+1]  = tables[i]->names;
+		sizes[2*i]   = tables[i]->len * sizeof(uint32_t);
+		sizes[2*i+1] = tables[i]->len * sizeof(uint32_t);
+	}
+	data[MC_MACDB_STRINGS]          = db->strings;
+	sizes[MC_MACDB_STRINGS]         = db->strings_len;
+	data[MC_MACDB_SEARCH_KEYS]      = db->search.keys;
+	sizes[MC_MACDB_SEARCH_KEYS]     = db->search.len * sizeof(uint32_t);
+	data[MC_MACDB_SEARCH_OFFSETS]   = db->search.offsets;
+	sizes[MC_MACDB_SEARCH_OFFSETS]  = (db->search.len + 1) * sizeof(uint32_t);
+	data[MC_MACDB_SEARCH_POSTINGS]  = db->search.postings;
+	sizes[MC_MACDB_SEARCH_POSTINGS] = db->search.postings_len * sizeof(uint32_t);
+	data[MC_MACDB_MAM_KEYS]         = db->mam.keys;
+	sizes[MC_MACDB_MAM_KEYS]        = db->mam.len * sizeof(uint64_t);
+	data[MC_MACDB_MAM_NAMES]        = db->mam.names;
+	sizes[MC_MACDB_MAM_NAMES]       = db->mam.len * sizeof(uint32_t);
+	data[MC_MACDB_MAS_KEYS]         = db->mas.keys;
+	sizes[MC_MACDB_MAS_KEYS]        = db->mas.len * sizeof(uint64_t);
+	data[MC_MACDB_MAS_NAMES]        = db->mas.names;
+	sizes[MC_MACDB_MAS_NAMES]       = db->mas.len * sizeof(uint32_t);
+
+	/* Lay out the sections */
+	size = ALIGN8 (sizeof(mc_macdb_header_t));
+	for (i=0; i<MC_MACDB_SECTIONS; i++) {
+		size = add_section (&hdr, i, size, sizes[i]);
+	}
+	hdr.size = size;
+
+	/* Fill the image */
+	buf = xcalloc (1, size);
+	for (i=0; i<MC_MACDB_SECTIONS; i++) {
+		if (hdr.section[i].size > 0) {
+			memcpy (buf + hdr.section[i].offset, data[i], hdr.section[i].size);
+		}
+		hdr.section[i].checksum = mc_macdb_checksum (buf + hdr.section[i].offset,
+							     hdr.section[i].size);
+	}
+	hdr.checksum = mc_macdb_checksum (&hdr, offsetof(mc_macdb_header_t, checksum));
+	memcpy (buf, &hdr, sizeof(hdr));
+
+	/* Write it next to the target and rename it into place, so a
+	 * reader never maps a half written file.
+	 */
+	tmp_path = xmalloc (strlen(path) + 5);
+	sprintf (tmp_path, "%s.tmp", path);
+
+	if ((f = fopen (tmp_path, "wb")) == NULL) {
+		error ("Could not write vendor database: %s", tmp_path);
+		free (tmp_path);
+		free (buf);
+		return -1;
+	}
+
+	if (fwrite (buf, 1, size, f) != size) {
+		ret = -1;
+	}
+	if (fclose (f) != 0) {
+		ret = -1;
+	}
+	if (ret == 0 && rename (tmp_path, path) != 0) {
+		ret = -1;
+	}
+	if (ret != 0) {
+		error ("Could not write vendor database: %s", path);
+		unlink (tmp_path);
+	}
+
+	free (tmp_path);
+	free (buf);
+	return ret;
+}
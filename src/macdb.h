@@ -0,0 +1,131 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef __MAC_CHANGER_MACDB_H__
+#define __MAC_CHANGER_MACDB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Precompiled vendor database
+ *
+ * The file is a header followed by a set of 8-byte aligned sections.
+ * Every section is a plain array that is used in place once the file
+ * is mapped, so loading it costs one mmap() and no parsing.  Integers
+ * are stored in host byte order; the byte order mark in the header
+ * makes a foreign file fail validation instead of being misread.
+ *
+ * Each section carries its own checksum, verified the first time the
+ * section is used, so a run only touches the pages it needs.
+ */
+
+#define MC_MACDB_FILE     "macchanger.db"
+#define MC_MACDB_MAGIC    "MCDB"
+#define MC_MACDB_BOM      0x01020304
+#define MC_MACDB_VERSION  4
+
+typedef enum {
+	MC_MACDB_OTHERS_KEYS,     /* uint32_t[]: OUI.list, file order   */
+	MC_MACDB_OTHERS_NAMES,    /* uint32_t[]: offsets into STRINGS   */
+	MC_MACDB_WIRELESS_KEYS,   /* uint32_t[]: wireless.list          */
+	MC_MACDB_WIRELESS_NAMES,  /* uint32_t[]                         */
+	MC_MACDB_INDEX_KEYS,      /* uint32_t[]: sorted lookup index    */
+	MC_MACDB_INDEX_NAMES,     /* uint32_t[]                         */
+	MC_MACDB_STRINGS,         /* char[]: NUL terminated names       */
+	MC_MACDB_SEARCH_KEYS,     /* uint32_t[]: sorted name trigrams   */
+	MC_MACDB_SEARCH_OFFSETS,  /* uint32_t[]: postings start, +1 end */
+	MC_MACDB_SEARCH_POSTINGS, /* uint32_t[]: row ids, ascending     */
+	MC_MACDB_MAM_KEYS,        /* uint64_t[]: sorted 28-bit prefixes */
+	MC_MACDB_MAM_NAMES,       /* uint32_t[]                         */
+	MC_MACDB_MAS_KEYS,        /* uint64_t[]: sorted 36-bit prefixes */
+	MC_MACDB_MAS_NAMES,       /* uint32_t[]                         */
+	MC_MACDB_SECTIONS
+} mc_macdb_section_id_t;
+
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t checksum;
+} mc_macdb_section_t;
+
+typedef struct {
+	char               magic[4];
+	uint32_t           bom;
+	uint32_t           version;
+	uint32_t           size;       /* of the whole file */
+	uint32_t           nsections;
+	mc_macdb_section_t section[MC_MACDB_SECTIONS];
+	uint32_t           checksum;   /* of the header fields above */
+} mc_macdb_header_t;
+
+/* One vendor table: parallel arrays of keys (OUI << 8 | flags) and
+ * name offsets into the shared string blob.
+ */
+typedef struct {
+	const uint32_t *keys;
+	const uint32_t *names;
+	uint32_t        len;
+} mc_oui_table_t;
+
+/* MA-M (28-bit) and MA-S (36-bit) assignments.  Keys are the 48-bit
+ * address with the host bits cleared, so a probe masks the address
+ * and looks for an exact match.
+ */
+typedef struct {
+	const uint64_t *keys;
+	const uint32_t *names;
+	uint32_t        len;
+} mc_prefix_table_t;
+
+/* Trigram index over the lower-cased vendor names.  Rows are
+ * numbered across both lists: OUI.list first, then wireless.list.
+ */
+typedef struct {
+	const uint32_t *keys;
+	const uint32_t *offsets;
+	const uint32_t *postings;
+	uint32_t        len;
+	uint32_t        postings_len;
+} mc_search_index_t;
+
+typedef struct {
+	mc_oui_table_t     others;
+	mc_oui_table_t     wireless;
+	mc_oui_table_t     index;
+	const char        *strings;
+	uint32_t           strings_len;
+	mc_search_index_t  search;
+	mc_prefix_table_t  mam;
+	mc_prefix_table_t  mas;
+} mc_macdb_t;
+
+uint32_t mc_macdb_checksum (const void *data, size_t len);
+
+int      mc_macdb_map      (const char *path, mc_macdb_t *db, void **map, size_t *map_size);
+int      mc_macdb_verify   (const void *map, mc_macdb_section_id_t id);
+void     mc_macdb_unmap    (void *map, size_t map_size);
+int      mc_macdb_write    (const char *path, const mc_macdb_t *db);
+
+#endif /* __MAC_CHANGER_MACDB_H__ */
@@ -25,219 +25,1547 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "maclist.h"
+#include "macdb.h"
+#include "search.h"
+#include "sample.h"
 #include "common.h"
 
-card_mac_list_item_t *list_others   = NULL; /* IEEE OUI */
-card_mac_list_item_t *list_wireless = NULL; /* Wireless cards */
+/* Vendor tables: either mapped straight from the precompiled
+ * database or built from the text lists.
+ */
+static mc_macdb_t  db;
+static void       *db_map      = NULL;
+static size_t      db_map_size = 0;
+static int         db_tried    = 0;
+static const char *listdir     = LISTDIR;
+
+/* Parts of the database loaded so far.  Nothing is read until some
+ * lookup needs it, and then only the parts that lookup touches.
+ */
+#define LIST_OTHERS    (1 << 0)
+#define LIST_WIRELESS  (1 << 1)
+#define LIST_INDEX     (1 << 2)
+#define LIST_STRINGS   (1 << 3)
+#define LIST_SEARCH    (1 << 4)
+#define LIST_PREFIXES  (1 << 5)
+#define LIST_ALL       (LIST_OTHERS | LIST_WIRELESS | LIST_INDEX | LIST_STRINGS | \
+			LIST_SEARCH | LIST_PREFIXES)
+
+static int         loaded      = 0;
+static int         published   = 0;    /* 'loaded', as seen by readers */
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void mc_maclist_need (int parts);
+
+/* Every key is (OUI << 8 | flags), so a single probe of the index
+ * answers both the vendor name and the wireless question.  The
+ * SUBBLOCK flag marks OUIs split into MA-M/MA-S assignments: only
+ * those need the longer prefixes looked up.
+ */
+#define OUI_FLAG_WIRELESS  0x01
+#define OUI_FLAG_SUBBLOCK  0x02
+#define OUI_FLAGS_MASK     0xFF
+
+/* Host bits of MA-M (28-bit) and MA-S (36-bit) assignments */
+#define MAM_HOST_MASK      ((uint64_t) 0xFFFFF)
+#define MAS_HOST_MASK      ((uint64_t) 0xFFF)
 
-int list_others_len   = 0;
-int list_wireless_len = 0;
+#define OUI_NAME(table, i) (db.strings + (table)->names[i])
 
 
-static char *
-mc_maclist_get_cardname_from_list (const mac_t *mac, card_mac_list_item_t *list)
+static inline uint32_t
+mc_maclist_oui (const unsigned char *byte)
 {
-	int i = 0;
+	return ((uint32_t) byte[0] << 16) | ((uint32_t) byte[1] << 8) | byte[2];
+}
 
-	while (list[i].name) {
-		if ((mac->byte[0] == list[i].byte[0]) &&
-		    (mac->byte[1] == list[i].byte[1]) &&
-		    (mac->byte[2] == list[i].byte[2]))
-		{
-			return list[i].name;
-		}
-		i++;
+
+static inline uint64_t
+mc_maclist_mac48 (const mac_t *mac)
+{
+	return ((uint64_t) mc_maclist_oui (mac->byte) << 24) |
+	       mc_maclist_oui (mac->byte + 3);
+}
+
+
+/* Returns the index row of the OUI of 'mac', or -1 if it is unknown
+ */
+static long
+mc_maclist_index_find (const mac_t *mac)
+{
+	const uint32_t *base = db.index.keys;
+	uint32_t        key  = (mc_maclist_oui (mac->byte) << 8) | OUI_FLAGS_MASK;
+	size_t          n    = db.index.len;
+	size_t          half;
+
+	if (n == 0) {
+		return -1;
+	}
+
+	/* Branchless search for the last key <= 'key'. It compiles
+	 * to a conditional move, so there is nothing to mispredict.
+	 */
+	while (n > 1) {
+		half = n / 2;
+		base = (base[half] <= key) ? base + half : base;
+		n -= half;
+	}
+
+	if ((*base >> 8) != (key >> 8)) {
+		return -1;
+	}
+
+	return base - db.index.keys;
+}
+
+
+/* Name of the assignment whose prefix is exactly 'key', if any */
+static const char *
+mc_maclist_prefix_find (const mc_prefix_table_t *table, uint64_t key)
+{
+	const uint64_t *base = table->keys;
+	size_t          n    = table->len;
+	size_t          half;
+
+	if (n == 0) {
+		return NULL;
+	}
+
+	while (n > 1) {
+		half = n / 2;
+		base = (base[half] <= key) ? base + half : base;
+		n -= half;
+	}
+
+	if (*base != key) {
+		return NULL;
 	}
 
-	return NULL;
+	return db.strings + table->names[base - table->keys];
 }
 
 
-static char *
-mc_maclist_get_cardname (const mac_t *mac)
+/* Longest prefix match: a 36-bit MA-S assignment wins over a 28-bit
+ * MA-M one, which wins over the 24-bit OUI.  Only OUIs flagged in the
+ * index pay for the extra probes.
+ */
+const char *
+mc_maclist_lookup (const mac_t *mac, int *is_wireless)
 {
-	char *name;
+	const char *name = NULL;
+	uint64_t    mac48;
+	long        row;
+
+	mc_maclist_need (LIST_INDEX | LIST_STRINGS);
+
+	row = mc_maclist_index_find (mac);
+	if (is_wireless) {
+		*is_wireless = (row >= 0) && (db.index.keys[row] & OUI_FLAG_WIRELESS);
+	}
+
+	if (row < 0) {
+		return NULL;
+	}
+
+	if (db.index.keys[row] & OUI_FLAG_SUBBLOCK) {
+		mc_maclist_need (LIST_PREFIXES);
+
+		mac48 = mc_maclist_mac48 (mac);
+		name  = mc_maclist_prefix_find (&db.mas, mac48 & ~MAS_HOST_MASK);
+		if (name == NULL) {
+			name = mc_maclist_prefix_find (&db.mam, mac48 & ~MAM_HOST_MASK);
+		}
+	}
 
-	name = mc_maclist_get_cardname_from_list (mac, list_wireless);
-	if (name) {
-		return name;
+	if (name == NULL) {
+		name = OUI_NAME(&db.index, row);
 	}
 
-	name = mc_maclist_get_cardname_from_list (mac, list_others);
-	return name;
+	/* OUIs only known through their sub-blocks have no name */
+	return (name[0] != '\0') ? name : NULL;
 }
 
 
 const char *
 mc_maclist_get_cardname_with_default (const mac_t *mac, const char *def)
 {
-	char *name;
-	name = mc_maclist_get_cardname (mac);
+	const char *name;
+	name = mc_maclist_lookup (mac, NULL);
 	return name ? name : def;
 }
 
+/* Vendor sampling for -a/-A
+ *
+ * Rows are numbered as in the search index: OUI.list first, then
+ * wireless.list.  Each kind of vendor draws from its own range of
+ * rows, either uniformly or through an alias table built the first
+ * time that kind is asked for.
+ */
+typedef struct {
+	uint32_t oui;
+	double   weight;
+	uint32_t rows;     /* rows carrying the OUI, while matching */
+} oui_weight_t;
+
+typedef struct {
+	char    *name;
+	double   weight;
+	uint32_t rows;     /* rows carrying the name, while matching */
+} name_weight_t;
+
+struct mc_vendor_picker {
+	mc_vendor_dist_t dist;
+	char            *path;
+	oui_weight_t    *oui_weights;
+	uint32_t         oui_weights_len;
+	name_weight_t   *name_weights;
+	uint32_t         name_weights_len;
+
+	mc_alias_t       tables[3];   /* by mac_type_t, built on first use */
+	int              built[3];
+	pthread_mutex_t  lock;
+};
+
+/* Used by -a/-A */
+static mc_vendor_picker_t default_picker = {
+	.dist = mc_vendor_by_oui,
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+
 static void
-mc_maclist_set_random_vendor_from_list (mac_t *mac, card_mac_list_item_t *list, int list_len)
+vendor_rows (mac_type_t type, uint32_t *first, uint32_t *count)
 {
-	int i, num = list_len;
+	*first = (type == mac_is_wireless) ? db.others.len : 0;
+	*count = 0;
+	switch (type) {
+	case mac_is_anykind:  *count = db.others.len + db.wireless.len; break;
+	case mac_is_wireless: *count = db.wireless.len; break;
+	case mac_is_others:   *count = db.others.len; break;
+	}
+}
+
 
-	/* Choose one randomly */
-	long int random_data;
-	if (strong_random_get((unsigned char *) &random_data,
-				sizeof(random_data)) != 0) {
-		fatal("Failed to get random vendor.");
+static inline const mc_oui_table_t *
+vendor_row_table (uint32_t *row)
+{
+	if (*row < db.others.len) {
+		return &db.others;
 	}
-	num = labs(random_data)%num;
+	*row -= db.others.len;
+	return &db.wireless;
+}
+
+
+static inline uint32_t
+vendor_row_oui (uint32_t row)
+{
+	const mc_oui_table_t *table = vendor_row_table (&row);
+	return table->keys[row] >> 8;
+}
+
+
+static inline uint32_t
+vendor_row_name (uint32_t row)
+{
+	const mc_oui_table_t *table = vendor_row_table (&row);
+	return table->names[row];
+}
+
+
+static int
+oui_weight_cmp (const void *a, const void *b)
+{
+	uint32_t x = ((const oui_weight_t *) a)->oui;
+	uint32_t y = ((const oui_weight_t *) b)->oui;
+	return (x > y) - (x < y);
+}
+
+
+static int
+name_weight_cmp (const void *a, const void *b)
+{
+	return strcasecmp (((const name_weight_t *) a)->name, ((const name_weight_t *) b)->name);
+}
+
+
+static int
+name_row_cmp (const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+
+/* "XX:XX:XX", "XX-XX-XX" or "XXXXXX" */
+static int
+parse_oui (const char *str, uint32_t *oui)
+{
+	size_t len = strlen (str);
+	char   hex[3] = {0};
+	int    i, step;
+
+	if (len == 6) {
+		step = 2;
+	} else if (len == 8 && str[2] == str[5] && (str[2] == ':' || str[2] == '-')) {
+		step = 3;
+	} else {
+		return -1;
+	}
+
+	*oui = 0;
+	for (i=0; i<3; i++, str+=step) {
+		if (!isxdigit ((unsigned char) str[0]) || !isxdigit ((unsigned char) str[1])) {
+			return -1;
+		}
+		hex[0] = str[0];
+		hex[1] = str[1];
+		*oui = (*oui << 8) | strtoul (hex, NULL, 16);
+	}
+
+	return 0;
+}
+
+
+/* Reads "<weight> <OUI or vendor name>" lines.  A vendor name matches
+ * regardless of case, and its weight is shared by all of its rows, as
+ * is that of an OUI listed both as wireless and not.
+ */
+static int
+vendor_weights_read (mc_vendor_picker_t *p, const char *path)
+{
+	FILE     *f;
+	char      line[1024];
+	char     *key, *end;
+	double    weight;
+	uint32_t  oui, lineno = 0;
+	uint32_t  oui_size = 0, name_size = 0;
+	size_t    len;
+	int       ret = 0;
+
+	if ((f = fopen (path, "r")) == NULL) {
+		error ("Could not open vendor weights %s: %s", path, strerror (errno));
+		return -1;
+	}
+
+	while (fgets (line, sizeof(line), f) != NULL) {
+		lineno++;
+
+		len = strlen (line);
+		while (len > 0 && isspace ((unsigned char) line[len-1])) {
+			line[--len] = '\0';
+		}
+		for (key=line; isspace ((unsigned char) *key); key++);
+		if (*key == '\0' || *key == '#') {
+			continue;
+		}
+
+		weight = strtod (key, &end);
+		if (end == key || !isspace ((unsigned char) *end) || !(weight >= 0)) {
+			error ("%s:%u: expected a weight and a vendor", path, lineno);
+			ret = -1;
+			break;
+		}
+		for (key=end; isspace ((unsigned char) *key); key++);
+
+		if (parse_oui (key, &oui) == 0) {
+			if (p->oui_weights_len == oui_size) {
+				oui_size = oui_size ? oui_size * 2 : 64;
+				p->oui_weights = xrealloc (p->oui_weights, sizeof(oui_weight_t) * oui_size);
+			}
+			p->oui_weights[p->oui_weights_len].oui    = oui;
+			p->oui_weights[p->oui_weights_len].weight = weight;
+			p->oui_weights[p->oui_weights_len].rows   = 0;
+			p->oui_weights_len++;
+		} else {
+			if (p->name_weights_len == name_size) {
+				name_size = name_size ? name_size * 2 : 64;
+				p->name_weights = xrealloc (p->name_weights, sizeof(name_weight_t) * name_size);
+			}
+			p->name_weights[p->name_weights_len].name   = strdup (key);
+			p->name_weights[p->name_weights_len].weight = weight;
+			p->name_weights[p->name_weights_len].rows   = 0;
+			p->name_weights_len++;
+		}
+	}
+
+	fclose (f);
+
+	if (p->oui_weights_len > 0) {
+		qsort (p->oui_weights, p->oui_weights_len, sizeof(oui_weight_t), oui_weight_cmp);
+	}
+	if (p->name_weights_len > 0) {
+		qsort (p->name_weights, p->name_weights_len, sizeof(name_weight_t), name_weight_cmp);
+	}
+
+	return ret;
+}
+
+
+static void
+vendor_weights_free (mc_vendor_picker_t *p)
+{
+	uint32_t i;
+
+	for (i=0; i<p->name_weights_len; i++) {
+		free (p->name_weights[i].name);
+	}
+	free (p->name_weights);
+	free (p->oui_weights);
+	p->name_weights     = NULL;
+	p->oui_weights      = NULL;
+	p->name_weights_len = 0;
+	p->oui_weights_len  = 0;
+}
+
+
+/* Weight of every row in [first, first + count) */
+static void
+vendor_weights_fill (mc_vendor_picker_t *p, double *weights,
+		     uint32_t first, uint32_t count)
+{
+	uint64_t      *pairs;
+	uint32_t      *matches;
+	oui_weight_t   okey, *ofound;
+	name_weight_t  nkey, *nfound;
+	uint32_t       i, j, run;
+
+	if (p->dist == mc_vendor_by_name) {
+		/* Equal names share an offset: one unit of weight per
+		 * name, split over its rows.
+		 */
+		pairs = (uint64_t *) xmalloc (sizeof(uint64_t) * count);
+		for (i=0; i<count; i++) {
+			pairs[i] = ((uint64_t) vendor_row_name (first + i) << 32) | i;
+		}
+		qsort (pairs, count, sizeof(uint64_t), name_row_cmp);
+
+		for (i=0; i<count; i=j) {
+			for (j=i; j<count && (pairs[j] >> 32) == (pairs[i] >> 32); j++);
+			for (run=i; run<j; run++) {
+				weights[(uint32_t) pairs[run]] = 1.0 / (j - i);
+			}
+		}
+		free (pairs);
+		return;
+	}
+
+	/* From the weights file: first count the rows each entry
+	 * matches, then share its weight among them.
+	 */
+	matches = (uint32_t *) xmalloc (sizeof(uint32_t) * count * 2);
+	for (i=0; i<p->name_weights_len; i++) {
+		p->name_weights[i].rows = 0;
+	}
+	for (i=0; i<p->oui_weights_len; i++) {
+		p->oui_weights[i].rows = 0;
+	}
+
+	for (i=0; i<count; i++) {
+		nkey.name = (char *) (db.strings + vendor_row_name (first + i));
+		nfound = p->name_weights_len ?
+			bsearch (&nkey, p->name_weights, p->name_weights_len, sizeof(name_weight_t), name_weight_cmp) : NULL;
+		matches[2*i] = nfound ? (uint32_t) (nfound - p->name_weights) : UINT32_MAX;
+		if (nfound) {
+			nfound->rows++;
+		}
+
+		okey.oui = vendor_row_oui (first + i);
+		ofound = p->oui_weights_len ?
+			bsearch (&okey, p->oui_weights, p->oui_weights_len, sizeof(oui_weight_t), oui_weight_cmp) : NULL;
+		matches[2*i+1] = ofound ? (uint32_t) (ofound - p->oui_weights) : UINT32_MAX;
+		if (ofound) {
+			ofound->rows++;
+		}
+	}
+
+	for (i=0; i<count; i++) {
+		weights[i] = 0;
+		if (matches[2*i] != UINT32_MAX) {
+			weights[i] += p->name_weights[matches[2*i]].weight / p->name_weights[matches[2*i]].rows;
+		}
+		if (matches[2*i+1] != UINT32_MAX) {
+			weights[i] += p->oui_weights[matches[2*i+1]].weight / p->oui_weights[matches[2*i+1]].rows;
+		}
+	}
+
+	free (matches);
+}
+
+
+static uint32_t
+vendor_sample (mc_vendor_picker_t *p, mac_type_t type)
+{
+	mc_alias_t     *table = &p->tables[type];
+	error_cleanup_t unlock;
+	double         *weights;
+	uint32_t        first, count;
+
+	vendor_rows (type, &first, &count);
+	if (count == 0) {
+		fatal ("No vendors of the requested kind are known.");
+	}
+
+	if (p->dist == mc_vendor_by_oui) {
+		return first + mc_sample_uniform (count);
+	}
+
+	/* Built once, by whichever thread gets here first */
+	if (!__atomic_load_n (&p->built[type], __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock (&p->lock);
+		error_cleanup_push (&unlock, error_cleanup_unlock, &p->lock);
+		if (!p->built[type]) {
+			weights = (double *) xmalloc (sizeof(double) * count);
+			vendor_weights_fill (p, weights, first, count);
+			if (mc_alias_build (table, weights, count) < 0) {
+				error_cleanup_pop (&unlock);
+				pthread_mutex_unlock (&p->lock);
+				free (weights);
+				fatal ("No vendor of the requested kind has a weight in %s", p->path);
+			}
+			free (weights);
+			__atomic_store_n (&p->built[type], 1, __ATOMIC_RELEASE);
+		}
+		error_cleanup_pop (&unlock);
+		pthread_mutex_unlock (&p->lock);
+	}
+
+	return first + mc_alias_sample (table);
+}
+
+
+static void
+vendor_picker_reset (mc_vendor_picker_t *p)
+{
+	int i;
 
-	/* Copy the vendor MAC range */
 	for (i=0; i<3; i++) {
-		mac->byte[i] = list[num].byte[i];
+		mc_alias_free (&p->tables[i]);
+		p->built[i] = 0;
+	}
+}
+
+
+/* A picker for 'dist'; 'path' names the weights file of
+ * mc_vendor_by_weight.  Returns NULL if the file cannot be read.
+ */
+mc_vendor_picker_t *
+mc_vendor_picker_new (mc_vendor_dist_t dist, const char *path)
+{
+	mc_vendor_picker_t *p;
+
+	p = (mc_vendor_picker_t *) xcalloc (1, sizeof(mc_vendor_picker_t));
+	pthread_mutex_init (&p->lock, NULL);
+	p->dist = dist;
+
+	if (dist == mc_vendor_by_weight) {
+		p->path = strdup (path);
+		if (vendor_weights_read (p, path) < 0) {
+			mc_vendor_picker_free (p);
+			return NULL;
+		}
 	}
+
+	return p;
 }
 
 
 void
-mc_maclist_set_random_vendor (mac_t *mac, mac_type_t type)
+mc_vendor_picker_free (mc_vendor_picker_t *p)
 {
-	int num;
+	if (p == NULL) {
+		return;
+	}
 
-	long int random_data;
-	if (strong_random_get((unsigned char *) &random_data,
-				sizeof(random_data)) != 0) {
-		fatal("Failed to get random vendor.");
+	vendor_picker_reset (p);
+	vendor_weights_free (p);
+	pthread_mutex_destroy (&p->lock);
+	free (p->path);
+	free (p);
+}
+
+
+/* Sets the first three bytes of 'mac' to an OUI of the given kind,
+ * chosen by 'p', or by the default picker if it is NULL.
+ */
+void
+mc_maclist_pick_vendor (mc_vendor_picker_t *p, mac_t *mac, mac_type_t type)
+{
+	uint32_t oui;
+
+	if (p == NULL) {
+		p = &default_picker;
 	}
-	num = labs(random_data) % ( list_others_len + list_wireless_len );
 
 	switch (type) {
-	case mac_is_anykind:
-		if (num < list_others_len) {
-			mc_maclist_set_random_vendor_from_list (mac, list_others, list_others_len);
-		} else {
-			mc_maclist_set_random_vendor_from_list (mac, list_wireless, list_wireless_len);
-		}
-		break;
-	case mac_is_wireless:
-		mc_maclist_set_random_vendor_from_list (mac, list_wireless, list_wireless_len);
-		break;
-	case mac_is_others:
-		mc_maclist_set_random_vendor_from_list (mac, list_others, list_others_len);
-		break;
+	case mac_is_anykind:  mc_maclist_need (LIST_OTHERS | LIST_WIRELESS); break;
+	case mac_is_wireless: mc_maclist_need (LIST_WIRELESS); break;
+	case mac_is_others:   mc_maclist_need (LIST_OTHERS); break;
+	}
+	if (p->dist != mc_vendor_by_oui) {
+		mc_maclist_need (LIST_STRINGS);
+	}
+
+	/* Copy the vendor MAC range */
+	oui = vendor_row_oui (vendor_sample (p, type));
+	mac->byte[0] = (oui >> 16) & 0xFF;
+	mac->byte[1] = (oui >> 8) & 0xFF;
+	mac->byte[2] = oui & 0xFF;
+}
+
+
+void
+mc_maclist_set_random_vendor (mac_t *mac, mac_type_t type)
+{
+	mc_maclist_pick_vendor (NULL, mac, type);
+}
+
+
+/* Chooses how the default picker, used by -a/-A, picks vendors */
+int
+mc_maclist_set_vendor_dist (mc_vendor_dist_t dist, const char *path)
+{
+	mc_vendor_picker_t *p;
+
+	if ((p = mc_vendor_picker_new (dist, path)) == NULL) {
+		return -1;
 	}
+
+	vendor_picker_reset (&default_picker);
+	vendor_weights_free (&default_picker);
+	free (default_picker.path);
+
+	default_picker.dist             = p->dist;
+	default_picker.path             = p->path;
+	default_picker.oui_weights      = p->oui_weights;
+	default_picker.oui_weights_len  = p->oui_weights_len;
+	default_picker.name_weights     = p->name_weights;
+	default_picker.name_weights_len = p->name_weights_len;
+
+	pthread_mutex_destroy (&p->lock);
+	free (p);
+	return 0;
 }
 
 
 int
 mc_maclist_is_wireless (const mac_t *mac)
 {
-	return (mc_maclist_get_cardname_from_list (mac, list_wireless) != NULL);
+	uint32_t oui, i;
+	long     row;
+
+	/* Use the index if it is around; otherwise the short wireless
+	 * list alone answers this.
+	 */
+	if (__atomic_load_n (&published, __ATOMIC_ACQUIRE) & LIST_INDEX) {
+		row = mc_maclist_index_find (mac);
+		return (row >= 0) && (db.index.keys[row] & OUI_FLAG_WIRELESS);
+	}
+
+	mc_maclist_need (LIST_WIRELESS);
+
+	oui = mc_maclist_oui (mac->byte);
+	for (i=0; i<db.wireless.len; i++) {
+		if ((db.wireless.keys[i] >> 8) == oui) {
+			return 1;
+		}
+	}
+
+	return 0;
 }
 
 
+/* Output is assembled in a large buffer and written in big chunks,
+ * however many rows match.
+ */
+typedef struct {
+	char   data[64 * 1024];
+	size_t len;
+	int    fd;
+	int    failed;
+} print_buf_t;
+
+
 static void
-mc_maclist_print_from_list (card_mac_list_item_t *list, const char *keyword)
+print_buf_flush (print_buf_t *out)
 {
-	int i = 0;
+	size_t  done = 0;
+	ssize_t n;
 
-	while (list[i].name) {
-		if (!keyword || (keyword && strstr(list[i].name, keyword))) {
-			printf ("%04i - %02x:%02x:%02x - %s\n", i,
-				list[i].byte[0], list[i].byte[1],list[i].byte[2],
-				list[i].name);
+	while (done < out->len && !out->failed) {
+		n = write (out->fd, out->data + done, out->len - done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error ("Could not write vendor list: %s", strerror (errno));
+			out->failed = 1;
+			break;
 		}
-		i++;
+		done += n;
 	}
+	out->len = 0;
 }
 
 
-void
-mc_maclist_print (const char *keyword)
+static void
+print_buf_add (print_buf_t *out, const char *str, size_t len)
 {
-	printf ("Misc MACs:\n"
-		"Num    MAC        Vendor\n"
-		"---    ---        ------\n");
-	mc_maclist_print_from_list (list_others, keyword);
+	size_t n;
+
+	while (len > 0) {
+		if (out->len == sizeof(out->data)) {
+			print_buf_flush (out);
+		}
+		n = sizeof(out->data) - out->len;
+		n = (len < n) ? len : n;
+		memcpy (out->data + out->len, str, n);
+		out->len += n;
+		str += n;
+		len -= n;
+	}
+}
 
-	printf ("\n"
+
+static void
+print_buf_row (print_buf_t *out, uint32_t num, uint32_t oui, const char *name)
+{
+	static const char hex[] = "0123456789abcdef";
+	char              line[32];
+	char              digits[10];
+	int               i, n = 0, nd = 0;
+
+	/* "%04i - xx:xx:xx - " */
+	do {
+		digits[nd++] = '0' + num % 10;
+		num /= 10;
+	} while (num > 0);
+	for (i=nd; i<4; i++) {
+		line[n++] = '0';
+	}
+	while (nd > 0) {
+		line[n++] = digits[--nd];
+	}
+
+	line[n++] = ' ';
+	line[n++] = '-';
+	line[n++] = ' ';
+	for (i=16; i>=0; i-=8) {
+		line[n++] = hex[(oui >> (i+4)) & 0xF];
+		line[n++] = hex[(oui >> i) & 0xF];
+		line[n++] = (i > 0) ? ':' : ' ';
+	}
+	line[n++] = '-';
+	line[n++] = ' ';
+
+	print_buf_add (out, line, n);
+	print_buf_add (out, name, strlen (name));
+	print_buf_add (out, "\n", 1);
+}
+
+
+/* Prints every vendor whose name contains all the keywords,
+ * ignoring case.  With no keywords, prints them all.
+ */
+int
+mc_maclist_print (const char *const *keywords, size_t nkeywords, int out_fd)
+{
+	static const char misc_hdr[] =
+		"Misc MACs:\n"
+		"Num    MAC        Vendor\n"
+		"---    ---        ------\n";
+	static const char wireless_hdr[] =
+		"\n"
 		"Wireless MACs:\n"
 		"Num    MAC        Vendor\n"
-		"---    ---        ------\n");
-	mc_maclist_print_from_list (list_wireless, keyword);
+		"---    ---        ------\n";
+
+	print_buf_t *out;
+	uint32_t    *rows = NULL;
+	uint32_t     i, nrows, row;
+	int          wireless = 0;
+	int          ret;
+
+	if (nkeywords > 0) {
+		mc_maclist_need (LIST_OTHERS | LIST_WIRELESS | LIST_STRINGS | LIST_SEARCH);
+		nrows = mc_search_query (&db, keywords, nkeywords, &rows);
+	} else {
+		mc_maclist_need (LIST_OTHERS | LIST_WIRELESS | LIST_STRINGS);
+		nrows = db.others.len + db.wireless.len;
+	}
+
+	out = (print_buf_t *) xmalloc (sizeof(print_buf_t));
+	out->len    = 0;
+	out->fd     = out_fd;
+	out->failed = 0;
+
+	print_buf_add (out, misc_hdr, sizeof(misc_hdr) - 1);
+	for (i=0; i<nrows; i++) {
+		row = rows ? rows[i] : i;
+
+		if (row >= db.others.len) {
+			if (!wireless) {
+				print_buf_add (out, wireless_hdr, sizeof(wireless_hdr) - 1);
+				wireless = 1;
+			}
+			row -= db.others.len;
+			print_buf_row (out, row, db.wireless.keys[row] >> 8,
+				       OUI_NAME(&db.wireless, row));
+		} else {
+			print_buf_row (out, row, db.others.keys[row] >> 8,
+				       OUI_NAME(&db.others, row));
+		}
+	}
+	if (!wireless) {
+		print_buf_add (out, wireless_hdr, sizeof(wireless_hdr) - 1);
+	}
+
+	print_buf_flush (out);
+	ret = out->failed ? -1 : 0;
+	free (out);
+	free (rows);
+	return ret;
+}
+
+
+/* Tables built from text own three growable arrays: the two per-list
+ * tables and a bump arena holding every vendor name once.  Tearing
+ * them down is a handful of free() calls, whatever the list size.
+ *
+ * Once names are published, lookups may be reading the arena, so it
+ * grows into a copy and the old storage is kept until
+ * mc_maclist_free().
+ */
+static char     *strings_buf  = NULL;
+static size_t    strings_len  = 0;
+static size_t    strings_size = 0;
+static char    **strings_old  = NULL;
+static size_t    strings_nold = 0;
+
+/* Open addressing table interning names while loading: many OUIs
+ * share a vendor ("XEROX CORPORATION", ...), which is stored once.
+ * Slots hold (arena offset + 1), 0 meaning empty.
+ */
+static uint32_t *intern_slots = NULL;
+static size_t    intern_size  = 0;
+static size_t    intern_used  = 0;
+
+
+static uint32_t
+intern_hash (const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	while (len-- > 0) {
+		hash = (hash ^ (unsigned char) *str++) * 16777619u;
+	}
+	return hash;
+}
+
+
+static uint32_t *
+intern_find (const char *str, size_t len)
+{
+	uint32_t   *slot;
+	const char *cur;
+	size_t      i;
+
+	i = intern_hash (str, len) & (intern_size - 1);
+	for (;; i = (i + 1) & (intern_size - 1)) {
+		slot = &intern_slots[i];
+		if (*slot == 0) {
+			return slot;
+		}
+
+		cur = strings_buf + *slot - 1;
+		if (strncmp (cur, str, len) == 0 && cur[len] == '\0') {
+			return slot;
+		}
+	}
+}
+
+
+static void
+intern_grow (void)
+{
+	uint32_t *old      = intern_slots;
+	size_t    old_size = intern_size;
+	size_t    i;
+	char     *name;
+
+	intern_size  = old_size ? old_size * 2 : 32768;
+	intern_slots = (uint32_t *) xcalloc (intern_size, sizeof(uint32_t));
+
+	for (i=0; i<old_size; i++) {
+		if (old[i]) {
+			name = strings_buf + old[i] - 1;
+			*intern_find (name, strlen(name)) = old[i];
+		}
+	}
+
+	free (old);
+}
+
+
+static void
+intern_free (void)
+{
+	free (intern_slots);
+	intern_slots = NULL;
+	intern_size  = 0;
+	intern_used  = 0;
+}
+
+
+static void
+strings_grow (void)
+{
+	char *buf;
+
+	if (!(published & LIST_STRINGS)) {
+		strings_buf = (char *) xrealloc (strings_buf, strings_size);
+		return;
+	}
+
+	buf = (char *) xmalloc (strings_size);
+	memcpy (buf, strings_buf, strings_len);
+	strings_old = (char **) xrealloc (strings_old, (strings_nold + 1) * sizeof(char *));
+	strings_old[strings_nold++] = strings_buf;
+	strings_buf = buf;
+}
+
+
+static uint32_t
+mc_maclist_add_string (const char *str, size_t len)
+{
+	uint32_t  offset = strings_len;
+	uint32_t *slot;
+
+	if (2 * (intern_used + 1) > intern_size) {
+		intern_grow ();
+	}
+
+	slot = intern_find (str, len);
+	if (*slot) {
+		return *slot - 1;
+	}
+
+	/* Bump allocate it in the arena */
+	if (strings_len + len + 1 > strings_size) {
+		while (strings_len + len + 1 > strings_size) {
+			strings_size = strings_size ? strings_size * 2 : 64 * 1024;
+		}
+		strings_grow ();
+	}
+
+	memcpy (strings_buf + strings_len, str, len);
+	strings_buf[strings_len + len] = '\0';
+	strings_len += len + 1;
+
+	*slot = offset + 1;
+	intern_used++;
+
+	return offset;
+}
+
+
+static inline int
+hex_nibble (char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return 0;
 }
 
 
-static card_mac_list_item_t *
-mc_maclist_read_from_file (const char *fullpath, int *list_len)
+static inline uint32_t
+hex_byte (const char *s)
 {
-	FILE *f;
-	char *line;
-	char  tmp[512];
-	int   num = 0;
-	card_mac_list_item_t *list;
+	if (s[0] == '\0') {
+		return 0;
+	}
+	return (hex_nibble (s[0]) << 4) | hex_nibble (s[1]);
+}
+
+
+typedef void (*line_parser_t) (void *table, uint32_t *size,
+			       const char *line, size_t len, uint32_t arg);
 
-	if ((f = fopen(fullpath, "r")) == NULL) {
+
+/* Parses "XX XX XX Vendor name" lines into growable key and name
+ * arrays; 'arg' holds the flags of the list.
+ */
+static void
+mc_maclist_parse_line (void *data, uint32_t *size,
+		       const char *line, size_t len, uint32_t flags)
+{
+	mc_oui_table_t *table = data;
+	uint32_t       *keys  = (uint32_t *) table->keys;
+	uint32_t       *names = (uint32_t *) table->names;
+
+	if (len < 8) {
+		return;
+	}
+
+	if (table->len == *size) {
+		*size = *size ? *size * 2 : 1024;
+		keys  = (uint32_t *) xrealloc (keys,  sizeof(uint32_t) * *size);
+		names = (uint32_t *) xrealloc (names, sizeof(uint32_t) * *size);
+		table->keys  = keys;
+		table->names = names;
+	}
+
+	keys[table->len] = (hex_byte (line)   << 24) |
+			   (hex_byte (line+3) << 16) |
+			   (hex_byte (line+6) << 8)  |
+			   flags;
+	names[table->len] = mc_maclist_add_string (line+9, (len > 9) ? len-9 : 0);
+	table->len++;
+}
+
+
+/* Parses MA-M "XX XX XX X Vendor" and MA-S "XX XX XX XX X Vendor"
+ * lines; 'arg' is the number of hex digits of the prefix.
+ */
+static void
+mc_maclist_parse_prefix_line (void *data, uint32_t *size,
+			      const char *line, size_t len, uint32_t nibbles)
+{
+	mc_prefix_table_t *table = data;
+	uint64_t          *keys  = (uint64_t *) table->keys;
+	uint32_t          *names = (uint32_t *) table->names;
+	uint64_t           prefix = 0;
+	uint32_t           digits = 0;
+	size_t             i = 0;
+
+	for (; i < len && digits < nibbles; i++) {
+		if (line[i] == ' ' || line[i] == ':' || line[i] == '-') {
+			continue;
+		}
+		if (!isxdigit ((unsigned char) line[i])) {
+			return;
+		}
+		prefix = (prefix << 4) | hex_nibble (line[i]);
+		digits++;
+	}
+
+	if (digits < nibbles) {
+		return;
+	}
+	while (i < len && line[i] == ' ') {
+		i++;
+	}
+
+	if (table->len == *size) {
+		*size = *size ? *size * 2 : 1024;
+		keys  = (uint64_t *) xrealloc (keys,  sizeof(uint64_t) * *size);
+		names = (uint32_t *) xrealloc (names, sizeof(uint32_t) * *size);
+		table->keys  = keys;
+		table->names = names;
+	}
+
+	keys[table->len]  = prefix << (48 - 4 * nibbles);
+	names[table->len] = mc_maclist_add_string (line+i, len-i);
+	table->len++;
+}
+
+
+/* Streams a list file through 'parse' one line at a time, reading
+ * it in large chunks.  Missing optional lists read as empty.
+ */
+static int
+mc_maclist_read_from_file (const char *fullpath, int optional,
+			   line_parser_t parse, void *table, uint32_t arg)
+{
+	int       fd;
+	char      buf[64 * 1024];
+	char     *start, *end, *nl;
+	size_t    have = 0;
+	ssize_t   nread;
+	uint32_t  size = 0;
+
+	if ((fd = open(fullpath, O_RDONLY)) < 0) {
+		if (optional && errno == ENOENT) {
+			return 0;
+		}
 		error ("Could not read data file: %s", fullpath);
-		return NULL;
+		return -1;
 	}
 
-	/* Count lines */
-	while ((line = fgets (tmp, 511, f)) != NULL) num++;
-	rewind (f);
+	for (;;) {
+		nread = read (fd, buf + have, sizeof(buf) - have);
+		if (nread < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error ("Could not read data file: %s", fullpath);
+			close (fd);
+			return -1;
+		}
 
-	/* Get mem */
-	list = (card_mac_list_item_t *) xmalloc (sizeof(card_mac_list_item_t) * (num+1));
+		have += nread;
+		end   = buf + have;
+		start = buf;
 
-	/* Parse it */
-	num = 0;
-	while ((line = fgets (tmp, 511, f)) != NULL) {
-		list[num].byte[0] = (char) (strtoul (line, NULL, 16) & 0xFF);
-		list[num].byte[1] = (char) (strtoul (line+3, NULL, 16) & 0xFF);
-		list[num].byte[2] = (char) (strtoul (line+6, NULL, 16) & 0xFF);
+		while ((nl = memchr (start, '\n', end - start)) != NULL) {
+			parse (table, &size, start, nl - start, arg);
+			start = nl + 1;
+		}
 
-		line[strlen(line)-1] = '\0';
-		list[num].name = (char*)(strdup(line+9));
+		/* EOF: the last line may lack its newline */
+		if (nread == 0) {
+			parse (table, &size, start, end - start, arg);
+			break;
+		}
 
-		num ++;
+		/* Keep the partial line; overlong lines are dropped */
+		have = end - start;
+		if (have == sizeof(buf)) {
+			have = 0;
+		}
+		memmove (buf, start, have);
 	}
 
-	/* End of list */
-	list[num].byte[0] = list[num].byte[1] = list[num].byte[2] = 0;
-	list[num].name = NULL;
+	close (fd);
+	return 0;
+}
 
-	fclose (f);
 
-	*list_len = num;
-	return list;
+typedef struct {
+	uint64_t key;
+	uint32_t name;
+	uint32_t seq;
+} prefix_row_t;
+
+
+static int
+prefix_row_cmp (const void *a, const void *b)
+{
+	const prefix_row_t *ra = a;
+	const prefix_row_t *rb = b;
+
+	if (ra->key != rb->key) {
+		return (ra->key < rb->key) ? -1 : 1;
+	}
+	return (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq);
+}
+
+
+/* Sorts a prefix table in place, keeping the first row of every
+ * prefix.  The registries are small, qsort() is fine here.
+ */
+static void
+mc_maclist_prefix_sort (mc_prefix_table_t *table)
+{
+	prefix_row_t *rows;
+	uint64_t     *keys  = (uint64_t *) table->keys;
+	uint32_t     *names = (uint32_t *) table->names;
+	uint32_t      i, len = 0;
+
+	if (table->len == 0) {
+		return;
+	}
+
+	rows = (prefix_row_t *) xmalloc (sizeof(prefix_row_t) * table->len);
+	for (i=0; i<table->len; i++) {
+		rows[i].key  = keys[i];
+		rows[i].name = names[i];
+		rows[i].seq  = i;
+	}
+
+	qsort (rows, table->len, sizeof(prefix_row_t), prefix_row_cmp);
+
+	for (i=0; i<table->len; i++) {
+		if (len > 0 && keys[len-1] == rows[i].key) {
+			continue;
+		}
+		keys[len]  = rows[i].key;
+		names[len] = rows[i].name;
+		len++;
+	}
+
+	free (rows);
+	table->len = len;
+}
+
+
+typedef struct {
+	uint32_t key;
+	uint32_t name;
+} index_row_t;
+
+
+/* Stable LSD radix sort on the three OUI bytes of the keys.  Rows
+ * with the same OUI keep their relative order, so the first one of
+ * each OUI is still the one the lists give precedence to.
+ */
+static void
+index_rows_sort (index_row_t *rows, uint32_t num)
+{
+	index_row_t *tmp, *swap;
+	uint32_t     count[256];
+	uint32_t     i, shift, pos, c;
+
+	tmp = (index_row_t *) xmalloc (sizeof(index_row_t) * (num+1));
+
+	for (shift=8; shift<32; shift+=8) {
+		memset (count, 0, sizeof(count));
+		for (i=0; i<num; i++) {
+			count[(rows[i].key >> shift) & 0xFF]++;
+		}
+		for (i=0, pos=0; i<256; i++) {
+			c = count[i];
+			count[i] = pos;
+			pos += c;
+		}
+		for (i=0; i<num; i++) {
+			tmp[count[(rows[i].key >> shift) & 0xFF]++] = rows[i];
+		}
+		swap = rows; rows = tmp; tmp = swap;
+	}
+
+	/* Three passes: the sorted rows ended up in the scratch buffer */
+	memcpy (tmp, rows, sizeof(index_row_t) * num);
+	free (rows);
+}
+
+
+static void
+mc_maclist_index_build (uint32_t empty_name)
+{
+	index_row_t *rows;
+	uint32_t    *keys, *names;
+	uint32_t     i, len, num = 0;
+
+	rows = (index_row_t *) xmalloc (sizeof(index_row_t) *
+					(db.others.len + db.wireless.len + db.mam.len + db.mas.len + 1));
+
+	/* Wireless entries go first: they win when an OUI is in both lists
+	 */
+	for (i=0; i<db.wireless.len; i++, num++) {
+		rows[num].key  = db.wireless.keys[i];
+		rows[num].name = db.wireless.names[i];
+	}
+	for (i=0; i<db.others.len; i++, num++) {
+		rows[num].key  = db.others.keys[i];
+		rows[num].name = db.others.names[i];
+	}
+
+	/* Flag the OUIs that have sub-blocks.  When the OUI itself is
+	 * not listed, the row gets an empty name.
+	 */
+	for (i=0; i<db.mam.len; i++, num++) {
+		rows[num].key  = ((uint32_t) (db.mam.keys[i] >> 24) << 8) | OUI_FLAG_SUBBLOCK;
+		rows[num].name = empty_name;
+	}
+	for (i=0; i<db.mas.len; i++, num++) {
+		rows[num].key  = ((uint32_t) (db.mas.keys[i] >> 24) << 8) | OUI_FLAG_SUBBLOCK;
+		rows[num].name = empty_name;
+	}
+
+	index_rows_sort (rows, num);
+
+	keys  = (uint32_t *) xmalloc (sizeof(uint32_t) * (num+1));
+	names = (uint32_t *) xmalloc (sizeof(uint32_t) * (num+1));
+
+	/* Keep the first row of every OUI, as the linear scan used to
+	 */
+	len = 0;
+	for (i=0; i<num; i++) {
+		if (len > 0 && (keys[len-1] >> 8) == (rows[i].key >> 8)) {
+			keys[len-1] |= rows[i].key & OUI_FLAGS_MASK;
+			continue;
+		}
+		keys[len]  = rows[i].key;
+		names[len] = rows[i].name;
+		len++;
+	}
+
+	free (rows);
+
+	db.index.keys  = keys;
+	db.index.names = names;
+	db.index.len   = len;
+}
+
+
+/* The database is only trusted while it is newer than the lists
+ * it was compiled from.
+ */
+static int
+mc_maclist_db_is_fresh (const char *db_path)
+{
+	static const char *lists[] = {"OUI.list", "wireless.list", "MA-M.list", "MA-S.list"};
+	struct stat db_st, st;
+	char        path[1024];
+	size_t      i;
+
+	if (stat (db_path, &db_st) < 0) {
+		return 0;
+	}
+
+	for (i=0; i<sizeof(lists)/sizeof(lists[0]); i++) {
+		snprintf (path, sizeof(path), "%s/%s", listdir, lists[i]);
+		if (stat (path, &st) == 0 && st.st_mtime > db_st.st_mtime) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/* Maps the database and checks every section up front: once a part
+ * of it is in use, nothing can be swapped for the text lists.
+ */
+static void
+mc_maclist_db_open (void)
+{
+	char path[1024];
+	int  id;
+
+	snprintf (path, sizeof(path), "%s/%s", listdir, MC_MACDB_FILE);
+	if (!mc_maclist_db_is_fresh (path) ||
+	    mc_macdb_map (path, &db, &db_map, &db_map_size) < 0) {
+		return;
+	}
+
+	for (id=0; id<MC_MACDB_SECTIONS; id++) {
+		if (mc_macdb_verify (db_map, id) < 0) {
+			warning ("Ignoring corrupted vendor database in %s", listdir);
+			mc_macdb_unmap (db_map, db_map_size);
+			memset (&db, 0, sizeof(db));
+			db_map = NULL;
+			return;
+		}
+	}
+}
+
+
+static int
+mc_maclist_load_list (const char *file, int optional,
+		      line_parser_t parse, void *table, uint32_t arg)
+{
+	char path[1024];
+	int  ret;
+
+	snprintf (path, sizeof(path), "%s/%s", listdir, file);
+	ret = mc_maclist_read_from_file (path, optional, parse, table, arg);
+	intern_free ();
+
+	/* An empty blob would not be NUL terminated */
+	if (strings_len == 0) {
+		mc_maclist_add_string ("", 0);
+		intern_free ();
+	}
+
+	/* The arena may have moved */
+	__atomic_store_n (&db.strings, strings_buf, __ATOMIC_RELEASE);
+	db.strings_len = strings_len;
+
+	return ret;
+}
+
+
+static int
+mc_maclist_load_text_parts (int parts)
+{
+	if (parts & LIST_INDEX) {
+		parts |= LIST_PREFIXES;
+	}
+	if (parts & (LIST_INDEX | LIST_SEARCH)) {
+		parts |= LIST_OTHERS | LIST_WIRELESS;
+	}
+
+	if ((parts & LIST_OTHERS) && !(loaded & LIST_OTHERS)) {
+		if (mc_maclist_load_list ("OUI.list", 0, mc_maclist_parse_line,
+					  &db.others, 0) < 0) {
+			return -1;
+		}
+		loaded |= LIST_OTHERS | LIST_STRINGS;
+	}
+
+	if ((parts & LIST_WIRELESS) && !(loaded & LIST_WIRELESS)) {
+		if (mc_maclist_load_list ("wireless.list", 0, mc_maclist_parse_line,
+					  &db.wireless, OUI_FLAG_WIRELESS) < 0) {
+			return -1;
+		}
+		loaded |= LIST_WIRELESS | LIST_STRINGS;
+	}
+
+	/* The MA-M and MA-S registries are optional */
+	if ((parts & LIST_PREFIXES) && !(loaded & LIST_PREFIXES)) {
+		if (mc_maclist_load_list ("MA-M.list", 1, mc_maclist_parse_prefix_line,
+					  &db.mam, 7) < 0 ||
+		    mc_maclist_load_list ("MA-S.list", 1, mc_maclist_parse_prefix_line,
+					  &db.mas, 9) < 0) {
+			return -1;
+		}
+		mc_maclist_prefix_sort (&db.mam);
+		mc_maclist_prefix_sort (&db.mas);
+		loaded |= LIST_PREFIXES | LIST_STRINGS;
+	}
+
+	if ((parts & LIST_INDEX) && !(loaded & LIST_INDEX)) {
+		mc_maclist_index_build (mc_maclist_add_string ("", 0));
+		intern_free ();
+		__atomic_store_n (&db.strings, strings_buf, __ATOMIC_RELEASE);
+		db.strings_len = strings_len;
+		loaded |= LIST_INDEX;
+	}
+
+	if ((parts & LIST_SEARCH) && !(loaded & LIST_SEARCH)) {
+		mc_search_build (&db);
+		loaded |= LIST_SEARCH;
+	}
+
+	return 0;
+}
+
+
+/* Makes sure the given parts of the database are available, loading
+ * them on first use.  The precompiled database is preferred; the text
+ * lists are only parsed when it can not be used.
+ */
+static int
+mc_maclist_load_locked (int parts)
+{
+	if ((loaded & parts) == parts) {
+		return 0;
+	}
+
+	if (!db_tried) {
+		db_tried = 1;
+		mc_maclist_db_open ();
+	}
+
+	/* Every part of the mapping is already checked */
+	if (db_map) {
+		loaded = LIST_ALL;
+		return 0;
+	}
+
+	return mc_maclist_load_text_parts (parts);
+}
+
+
+/* Loads are serialized.  A part, once published, is never written
+ * or moved again until mc_maclist_free(), so lookups take no lock.
+ */
+static int
+mc_maclist_load (int parts)
+{
+	error_cleanup_t unlock;
+	int             ret;
+
+	if ((__atomic_load_n (&published, __ATOMIC_ACQUIRE) & parts) == parts) {
+		return 0;
+	}
+
+	pthread_mutex_lock (&load_lock);
+	error_cleanup_push (&unlock, error_cleanup_unlock, &load_lock);
+	ret = mc_maclist_load_locked (parts);
+	__atomic_store_n (&published, loaded, __ATOMIC_RELEASE);
+	error_cleanup_pop (&unlock);
+	pthread_mutex_unlock (&load_lock);
+
+	return ret;
+}
+
+
+static void
+mc_maclist_need (int parts)
+{
+	if (mc_maclist_load (parts) < 0) {
+		terminate (EXIT_FAILURE);
+	}
+}
+
+
+int
+mc_maclist_load_text (const char *dir)
+{
+	listdir  = dir;
+	db_tried = 1;
+
+	return mc_maclist_load (LIST_ALL);
+}
+
+
+int
+mc_maclist_write_db (const char *path)
+{
+	return mc_macdb_write (path, &db);
 }
 
 
 int
 mc_maclist_init (void)
 {
-	list_others = mc_maclist_read_from_file(LISTDIR "/OUI.list", &list_others_len);
-	list_wireless = mc_maclist_read_from_file(LISTDIR "/wireless.list", &list_wireless_len);
+	return mc_maclist_load (LIST_ALL);
+}
+
 
-	return (list_others && list_wireless)? 0 : -1;
+static void
+free_table (mc_oui_table_t *table)
+{
+	free ((void *) table->keys);
+	free ((void *) table->names);
 }
 
 
 static void
-free_list (card_mac_list_item_t *list)
+free_prefix_table (mc_prefix_table_t *table)
 {
-	int i = 0;
-	while (list[i].name) {
-		free(list[i].name);
-		i++;
-	}
-	free(list);
+	free ((void *) table->keys);
+	free ((void *) table->names);
 }
 
 
 void
 mc_maclist_free (void)
 {
-	free_list (list_others);
-	free_list (list_wireless);
+	intern_free ();
+
+	/* Samplers hold row numbers of the lists freed below */
+	vendor_picker_reset (&default_picker);
+
+	if (db_map) {
+		mc_macdb_unmap (db_map, db_map_size);
+		db_map = NULL;
+	} else {
+		free_table (&db.others);
+		free_table (&db.wireless);
+		free_table (&db.index);
+		free_prefix_table (&db.mam);
+		free_prefix_table (&db.mas);
+		mc_search_free (&db);
+		free (strings_buf);
+		strings_buf  = NULL;
+		strings_len  = 0;
+		strings_size = 0;
+		while (strings_nold > 0) {
+			free (strings_old[--strings_nold]);
+		}
+		free (strings_old);
+		strings_old = NULL;
+	}
+
+	memset (&db, 0, sizeof(db));
+	loaded    = 0;
+	published = 0;
+	db_tried  = 0;
 }
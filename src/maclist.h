@@ -26,21 +26,35 @@
 #ifndef __MAC_CHANGER_LIST_H__
 #define __MAC_CHANGER_LIST_H__
 
+#include <stddef.h>
 #include "mac.h"
 
-typedef struct {
-	char          *name;
-	unsigned char  byte[3];
-} card_mac_list_item_t;
-
 #define CARD_NAME(x)     mc_maclist_get_cardname_with_default(x, "unknown")
 
-int    mc_maclist_init  (void);
-void   mc_maclist_free  (void);
+/* How a random vendor is picked */
+typedef enum {
+	mc_vendor_by_oui,     /* every OUI equally likely (default) */
+	mc_vendor_by_name,    /* every vendor name equally likely   */
+	mc_vendor_by_weight   /* weights read from a file           */
+} mc_vendor_dist_t;
+
+typedef struct mc_vendor_picker mc_vendor_picker_t;
 
+int    mc_maclist_init      (void);
+void   mc_maclist_free      (void);
+int    mc_maclist_load_text (const char *listdir);
+int    mc_maclist_write_db  (const char *path);
+
+const char * mc_maclist_lookup                    (const mac_t *, int *is_wireless);
 const char * mc_maclist_get_cardname_with_default (const mac_t *, const char *);
 void         mc_maclist_set_random_vendor         (mac_t *, mac_type_t);
+int          mc_maclist_set_vendor_dist           (mc_vendor_dist_t, const char *path);
+void         mc_maclist_pick_vendor               (mc_vendor_picker_t *, mac_t *, mac_type_t);
 int          mc_maclist_is_wireless               (const mac_t *);
-void         mc_maclist_print                     (const char *keyword);
+
+mc_vendor_picker_t *mc_vendor_picker_new  (mc_vendor_dist_t, const char *path);
+void                mc_vendor_picker_free (mc_vendor_picker_t *);
+int          mc_maclist_print                     (const char *const *keywords, size_t nkeywords,
+						   int out_fd);
 
 #endif /* __MAC_CHANGER_LIST_H__ */
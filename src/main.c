@@ -28,38 +28,152 @@
 #endif
 
 #include <sys/types.h>
-#include <sys/uio.h>
-#include <sys/time.h>
 #include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <net/if.h>
 
-#include "mac.h"
-#include "maclist.h"
-#include "netinfo.h"
-#include "common.h"
+#include "macchanger.h"
 
 #define EXIT_OK    0
 #define EXIT_ERROR 1
 
+#define MAX_WORKERS 8   /* threads reading and planning devices */
+
+/* Long options without a short equivalent */
+enum {
+	OPT_NO_VENDOR = 256,
+	OPT_RESOLVE,
+	OPT_GENERATE,
+	OPT_VENDOR_WEIGHTS,
+	OPT_ALL,
+	OPT_SHOW_ALL,
+	OPT_BOUNCE,
+	OPT_RESTORE_ALL,
+	OPT_STATE_FILE,
+	OPT_NO_STATE,
+	OPT_TRANSACTION,
+	OPT_UNIQUE,
+	OPT_SHARD,
+	OPT_SHARD_OF,
+	OPT_POOL,
+	OPT_POOL_CREATE,
+	OPT_POOL_RELEASE,
+	OPT_POOL_COMPACT
+};
+
+/* What happens to each of many devices */
+typedef enum {
+	ACTION_SHOW,
+	ACTION_RANDOM,      /* as in 'mode' */
+	ACTION_PERMANENT
+} action_t;
+
+/* What the threads do to each job */
+typedef enum {
+	PHASE_PLAN,         /* read the device and make its new address */
+	PHASE_BOUNCE,       /* set the address, taking the link down if need be */
+	PHASE_READ_BACK     /* see what the device ended up with */
+} phase_t;
+
+typedef struct {
+	const char       *name;
+	macchanger_mac_t  mac;
+	macchanger_mac_t  permanent;
+	macchanger_mac_t  faked;
+	macchanger_mac_t  planned;    /* 'faked' before the read back */
+	int               read;       /* 'mac' and 'permanent' are known */
+	int               changed;    /* 'faked' was set */
+	int               applied;    /* the kernel took 'faked' */
+	int               undone;     /* 1: 'mac' is back, -1: could not be */
+	macchanger_outage_t outage;
+	char              error[256];
+	char              undo_error[256];
+} device_job_t;
+
+typedef struct {
+	device_job_t       *jobs;
+	size_t              njobs;
+	size_t              next;     /* first job nobody took yet */
+	phase_t             phase;
+	int                 rollback; /* the phase puts 'mac' back */
+	action_t            action;
+	macchanger_random_t mode;
+	unsigned long       node;     /* the shard of MACCHANGER_SHARD */
+	unsigned int        bits;
+	const char         *pool;     /* of MACCHANGER_POOL */
+	int                 bia;
+	int                 bounce;
+	int                 transaction;
+	int                 failed;   /* 'why' is set */
+	char                why[256]; /* a worker could not be set up */
+} device_queue_t;
+
+static char          show_vendor    = 1;
+static const char   *vendor_weights = NULL;
+static macchanger_t *ctx            = NULL;
+static char          keep_state     = 1;
+static const char   *state_file     = NULL;   /* NULL: the system one */
+static char          unique         = 0;
+static const char   *pool_file      = NULL;
+
 static void
 print_help (void)
 {
 	printf ("GNU MAC Changer\n"
-		"Usage: macchanger [options] device\n\n"
+		"Usage: macchanger [options] device...\n\n"
+		"Devices may be shell patterns, like 'veth*'.\n\n"
 		"  -h,  --help                   Print this help\n"
 		"  -V,  --version                Print version and exit\n"
 		"  -s,  --show                   Print the MAC address and exit\n"
+		"       --show-all[=format]      Print the MACs of every interface and exit;\n"
+		"                                format is text (default), tsv or json\n"
 		"  -e,  --ending                 Don't change the vendor bytes\n"
 		"  -a,  --another                Set random vendor MAC of the same kind\n"
 		"  -A                            Set random vendor MAC of any kind\n"
 		"  -p,  --permanent              Reset to original, permanent hardware MAC\n"
+		"                                (or, if there is none, the saved one)\n"
+		"       --restore-all            Put back the saved MAC of every interface\n"
 		"  -r,  --random                 Set fully random MAC\n"
-		"  -l,  --list[=keyword]         Print known vendors\n"
+		"       --shard=node/bits        Set random MAC in the shard of node, of\n"
+		"                                bits bits (1 to 32), of the locally\n"
+		"                                administered space\n"
+		"       --shard-of=MAC/bits      Print the node whose shard holds MAC and exit\n"
+		"       --pool=file              Set MAC allocated from the pool in file\n"
+		"       --pool-create=MAC/bits   Make the pool of the addresses after the\n"
+		"                                first bits (20 to 47) of MAC\n"
+		"       --pool-release=MAC       Give MAC back to the pool (- reads them\n"
+		"                                from stdin, one a line) and exit\n"
+		"       --pool-compact           Tidy up the pool, print its use and exit\n"
+		"  -l,  --list[=keyword]         Print known vendors (repeat to narrow)\n"
 		"  -b,  --bia                    Pretend to be a burned-in-address\n"
-		"  -m,  --mac=XX:XX:XX:XX:XX:XX  Set the MAC XX:XX:XX:XX:XX:XX\n\n"
+		"  -m,  --mac=XX:XX:XX:XX:XX:XX  Set the MAC XX:XX:XX:XX:XX:XX (also accepts\n"
+		"                                XX-XX-..., XXXX.XXXX.XXXX and XXXXXXXXXXXX)\n"
+		"       --all                    Act on every interface but the loopback\n"
+		"       --bounce                 Take the link down for the change if the\n"
+		"                                driver needs it, and report for how long\n"
+		"       --transaction            With many devices, change all of them or,\n"
+		"                                if any fails, none\n"
+		"       --unique                 Don't pick a MAC that a local interface or\n"
+		"                                a neighbour already uses\n"
+		"       --no-vendor              Don't look up vendor names\n"
+		"       --state-file=file        Save original MACs in file\n"
+		"       --no-state               Don't save original MACs\n"
+		"       --resolve[=file]         Print the vendor of every MAC read from\n"
+		"                                file (or stdin) and exit\n"
+		"       --generate=N             Print N distinct addresses made as -r, -e,\n"
+		"                                -a or -A would make them (default -r), and\n"
+		"                                exit; the device is only needed for -e and -a\n"
+		"       --vendor-weights=how     How -a and -A pick vendors: 'oui' (every OUI\n"
+		"                                alike), 'vendor' (every vendor alike) or a\n"
+		"                                file of \"weight vendor-or-OUI\" lines\n\n"
 		"Report bugs to https://github.com/alobbs/macchanger/issues\n");
 }
 
@@ -74,17 +188,850 @@ print_usage (void)
 
 
 static void
-print_mac (const char *s, const mac_t *mac)
+message (const char *kind, const char *format, ...)
+{
+	va_list va;
+
+	fprintf (stderr, "[%s]: ", kind);
+	va_start (va, format);
+	vfprintf (stderr, format, va);
+	va_end (va);
+	fputc ('\n', stderr);
+}
+
+
+/* Passes on what the library warned about */
+static void
+show_warnings (macchanger_t *c)
 {
-	char string[18];
-	int  is_wireless;
+	const char *msg;
+
+	if ((msg = macchanger_warning (c)) != NULL) {
+		message ("WARNING", "%s", msg);
+	}
+}
 
-	is_wireless = mc_maclist_is_wireless(mac);
-	mc_mac_into_string (mac, string);
+
+static void
+quit (int exit_code)
+{
+	show_warnings (ctx);
+	macchanger_free (ctx);
+	exit (exit_code);
+}
+
+
+/* Reports the last library error and leaves */
+static void
+fail (void)
+{
+	show_warnings (ctx);
+	message ("ERROR", "%s", macchanger_error (ctx));
+	quit (EXIT_ERROR);
+}
+
+
+static int
+set_vendor_weights (macchanger_t *c, const char *how)
+{
+	if (strcmp (how, "oui") == 0) {
+		return macchanger_set_vendor_dist (c, MACCHANGER_VENDOR_BY_OUI, NULL);
+	} else if (strcmp (how, "vendor") == 0) {
+		return macchanger_set_vendor_dist (c, MACCHANGER_VENDOR_BY_NAME, NULL);
+	}
+	return macchanger_set_vendor_dist (c, MACCHANGER_VENDOR_BY_WEIGHT, how);
+}
+
+
+static void
+print_mac (const char *s, const macchanger_mac_t *mac)
+{
+	char        string[MACCHANGER_MAC_STRING_LEN];
+	int         is_wireless = 0;
+	const char *name = NULL;
+
+	macchanger_format (mac, string);
+	if (!show_vendor) {
+		printf ("%s%s\n", s, string);
+		return;
+	}
+
+	if (macchanger_lookup (ctx, mac, &name, &is_wireless) < 0) {
+		fail ();
+	}
 	printf ("%s%s%s (%s)\n", s,
 		string,
 		is_wireless ? " [wireless]": "",
-		CARD_NAME(mac));
+		name ? name : "unknown");
+}
+
+
+static int
+mac_is_zero (const macchanger_mac_t *mac)
+{
+	static const macchanger_mac_t zero;
+
+	return memcmp (mac, &zero, sizeof(zero)) == 0;
+}
+
+
+/* The bits of --shard and --shard-of */
+static int
+parse_bits (const char *text, unsigned int *bits)
+{
+	unsigned long n;
+	char         *end;
+
+	n = strtoul (text, &end, 10);
+	if (*text == '\0' || *end != '\0' || n > 64) {
+		return -1;
+	}
+
+	*bits = n;
+	return 0;
+}
+
+
+/* The use of the pool */
+static void
+print_pool (void)
+{
+	macchanger_pool_stats_t stats;
+	char                    prefix[MACCHANGER_MAC_STRING_LEN];
+
+	if (macchanger_pool_stats (ctx, &stats) < 0) {
+		fail ();
+	}
+	macchanger_format (&stats.prefix, prefix);
+	printf ("%s/%u: %llu of %llu addresses allocated\n", prefix, stats.prefix_bits,
+		stats.used, stats.size);
+}
+
+
+/* --pool-release */
+static int
+release_pooled (const char *what)
+{
+	macchanger_mac_t *macs = NULL;
+	size_t            n = 0, size = 0, len;
+	char             *line = NULL;
+	size_t            line_size = 0;
+	int               ret;
+
+	if (strcmp (what, "-") != 0) {
+		macchanger_mac_t mac;
+
+		if (macchanger_parse (ctx, what, &mac) < 0) {
+			return -1;
+		}
+		return macchanger_pool_release (ctx, &mac, 1);
+	}
+
+	/* All of them or none */
+	while (getline (&line, &line_size, stdin) >= 0) {
+		len = strcspn (line, "\r\n");
+		line[len] = '\0';
+		if (len == 0) {
+			continue;
+		}
+		if (n == size) {
+			size = size ? 2 * size : 1024;
+			if ((macs = (macchanger_mac_t *) realloc (macs, size * sizeof(*macs))) == NULL) {
+				message ("FATAL_ERROR", "Not enough memory");
+				quit (EXIT_ERROR);
+			}
+		}
+		if (macchanger_parse (ctx, line, &macs[n]) < 0) {
+			free (line);
+			free (macs);
+			return -1;
+		}
+		n++;
+	}
+
+	ret = macchanger_pool_release (ctx, macs, n);
+	free (line);
+	free (macs);
+	return ret;
+}
+
+
+/* --restore-all */
+static int
+restore_saved (void)
+{
+	macchanger_restored_t *restored;
+	size_t                 n, i, done = 0, failed = 0, gone = 0;
+	int                    ret;
+
+	ret = macchanger_restore_all (ctx, &restored, &n);
+	if (ret < 0 && restored == NULL) {
+		fail ();
+	}
+
+	for (i=0; i<n; i++) {
+		if (restored[i].error == 0) {
+			done++;
+		} else if (restored[i].error == ENODEV) {
+			gone++;
+		} else {
+			message ("ERROR", "Could not restore %s: %s", restored[i].name,
+				 strerror (restored[i].error));
+			failed++;
+		}
+	}
+	printf ("%lu interfaces: %lu restored, %lu failed, %lu gone\n",
+		(unsigned long) n, (unsigned long) done, (unsigned long) failed,
+		(unsigned long) gone);
+
+	free (restored);
+	return failed ? -1 : 0;
+}
+
+
+/* What a --bounce change cost the link */
+static void
+print_outage (const char *indent, const macchanger_outage_t *outage)
+{
+	if (!outage->bounced) {
+		printf ("%sLink down:     no, changed live\n", indent);
+		return;
+	}
+
+	printf ("%sLink down:     %lu us\n", indent, outage->down_usec);
+	if (outage->carrier) {
+		printf ("%sCarrier back:  %lu us\n", indent, outage->carrier_usec);
+	}
+}
+
+
+/* Every interface
+ */
+
+static void
+print_json_string (const char *s)
+{
+	putchar ('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			printf ("\\%c", *s);
+		} else if ((unsigned char) *s < 0x20) {
+			printf ("\\u%04x", *s);
+		} else {
+			putchar (*s);
+		}
+	}
+	putchar ('"');
+}
+
+
+static int
+show_all (const char *format)
+{
+	macchanger_link_t *links, *link;
+	char               mac[MACCHANGER_MAC_STRING_LEN];
+	char               permanent[MACCHANGER_MAC_STRING_LEN];
+	size_t             n, i;
+	int                text = 0, tsv = 0;
+
+	if (format == NULL || strcmp (format, "text") == 0) {
+		text = 1;
+	} else if (strcmp (format, "tsv") == 0) {
+		tsv = 1;
+	} else if (strcmp (format, "json") != 0) {
+		message ("ERROR", "Unknown format: %s", format);
+		return -1;
+	}
+
+	if (macchanger_links (ctx, show_vendor, &links, &n) < 0) {
+		message ("ERROR", "%s", macchanger_error (ctx));
+		return -1;
+	}
+
+	if (text) {
+		printf ("%-16s %-18s %-18s%s\n", "Interface", "Current MAC", "Permanent MAC",
+			show_vendor ? " Vendor" : "");
+	} else if (!tsv) {
+		printf ("[");
+	}
+
+	for (i=0; i<n; i++) {
+		link = &links[i];
+		strcpy (mac, "-");
+		strcpy (permanent, "-");
+		if (link->has_mac) {
+			macchanger_format (&link->mac, mac);
+		}
+		if (link->has_permanent) {
+			macchanger_format (&link->permanent, permanent);
+		}
+
+		if (text) {
+			printf ("%-16s %-18s %-18s", link->name, mac, permanent);
+			if (show_vendor && link->has_mac) {
+				printf (" %s%s", link->vendor ? link->vendor : "unknown",
+					link->is_wireless ? " [wireless]" : "");
+			}
+			printf ("\n");
+		} else if (tsv) {
+			printf ("%s\t%u\t%s\t%s\t%s\t%s\n", link->name, link->index, mac, permanent,
+				!(show_vendor && link->has_mac) ? "-" :
+				link->is_wireless ? "wireless" : "other",
+				(show_vendor && link->vendor) ? link->vendor : "-");
+		} else {
+			printf ("%s\n  {\"name\": ", i ? "," : "");
+			print_json_string (link->name);
+			printf (", \"index\": %u, \"up\": %s, \"mac\": ", link->index,
+				(link->flags & IFF_UP) ? "true" : "false");
+			if (link->has_mac) {
+				print_json_string (mac);
+			} else {
+				printf ("null");
+			}
+			printf (", \"permanent\": ");
+			if (link->has_permanent) {
+				print_json_string (permanent);
+			} else {
+				printf ("null");
+			}
+			if (show_vendor && link->has_mac) {
+				printf (", \"wireless\": %s, \"vendor\": ",
+					link->is_wireless ? "true" : "false");
+				if (link->vendor) {
+					print_json_string (link->vendor);
+				} else {
+					printf ("null");
+				}
+			}
+			printf ("}");
+		}
+	}
+
+	if (!text && !tsv) {
+		printf ("%s]\n", n ? "\n" : "");
+	}
+
+	free (links);
+	return 0;
+}
+
+
+/* Many devices
+ *
+ * The devices are read, and their new addresses made, by a few
+ * threads at once.  The changes then go to the kernel together, and
+ * the threads read back what the devices ended up with.
+ */
+
+static void
+job_failed (device_job_t *job, macchanger_t *c)
+{
+	snprintf (job->error, sizeof(job->error), "%s", macchanger_error (c));
+}
+
+
+static void
+job_plan (device_queue_t *q, device_job_t *job, macchanger_t *c)
+{
+	if (macchanger_get_mac (c, job->name, &job->mac) < 0) {
+		job_failed (job, c);
+		return;
+	}
+	if (macchanger_get_permanent_mac (c, job->name, &job->permanent) < 0) {
+		memset (&job->permanent, 0, sizeof(job->permanent));
+	}
+	job->read = 1;
+
+	switch (q->action) {
+	case ACTION_SHOW:
+		return;
+	case ACTION_RANDOM:
+		job->faked = job->mac;
+		if (macchanger_random (c, &job->faked, q->mode, q->bia) < 0) {
+			job_failed (job, c);
+			return;
+		}
+		break;
+	case ACTION_PERMANENT:
+		job->faked = job->permanent;
+		if (mac_is_zero (&job->permanent) &&
+		    (!keep_state ||
+		     macchanger_get_original_mac (c, job->name, &job->faked) < 0)) {
+			job_failed (job, c);
+			return;
+		}
+		break;
+	}
+	job->planned = job->faked;
+	job->changed = 1;
+}
+
+
+/* The jobs a change, or its rollback, is about */
+static int
+job_selected (const device_queue_t *q, const device_job_t *job)
+{
+	if (q->rollback) {
+		return job->applied && job->undone == 0;
+	}
+	return job->changed && job->error[0] == '\0';
+}
+
+
+static void
+job_bounce (device_queue_t *q, device_job_t *job, macchanger_t *c)
+{
+	macchanger_outage_t outage;
+
+	if (!job_selected (q, job)) {
+		return;
+	}
+
+	if (q->rollback) {
+		if (macchanger_set_mac_bounce (c, job->name, &job->mac, &outage) < 0) {
+			snprintf (job->undo_error, sizeof(job->undo_error), "%s", macchanger_error (c));
+			job->undone = -1;
+		} else {
+			job->undone = 1;
+		}
+	} else if (macchanger_set_mac_bounce (c, job->name, &job->faked, &job->outage) < 0) {
+		job_failed (job, c);
+	} else {
+		job->applied = 1;
+	}
+}
+
+
+static void
+job_read_back (device_queue_t *q, device_job_t *job, macchanger_t *c)
+{
+	macchanger_mac_t now;
+	char             got[MACCHANGER_MAC_STRING_LEN];
+
+	if (q->rollback) {
+		if (job->undone != 1) {
+			return;
+		}
+		if (macchanger_get_mac (c, job->name, &now) < 0) {
+			snprintf (job->undo_error, sizeof(job->undo_error), "%s", macchanger_error (c));
+			job->undone = -1;
+		} else if (memcmp (&now, &job->mac, sizeof(now)) != 0) {
+			macchanger_format (&now, got);
+			snprintf (job->undo_error, sizeof(job->undo_error),
+				  "The device reports %s", got);
+			job->undone = -1;
+		}
+		return;
+	}
+
+	if (!job_selected (q, job)) {
+		return;
+	}
+	if (macchanger_get_mac (c, job->name, &now) < 0) {
+		job_failed (job, c);
+		return;
+	}
+
+	/* Outside a transaction, whatever the driver made of it is fine */
+	if (q->transaction && memcmp (&now, &job->faked, sizeof(now)) != 0) {
+		macchanger_format (&now, got);
+		snprintf (job->error, sizeof(job->error), "The device reports %s", got);
+	}
+	job->faked = now;
+}
+
+
+/* Marks the job as failed with 'why' when the phase would have
+ * worked on it, so no device is left without a result.
+ */
+static void
+job_not_run (device_queue_t *q, device_job_t *job, const char *why)
+{
+	if (q->rollback) {
+		if (q->phase == PHASE_READ_BACK ? job->undone == 1 : job_selected (q, job)) {
+			snprintf (job->undo_error, sizeof(job->undo_error), "%s", why);
+			job->undone = -1;
+		}
+	} else if (q->phase == PHASE_PLAN || job_selected (q, job)) {
+		snprintf (job->error, sizeof(job->error), "%s", why);
+	}
+}
+
+
+/* Sets up a context like the one of the calling thread; the first
+ * worker that cannot keeps the reason in the queue.
+ */
+static macchanger_t *
+worker_context (device_queue_t *q)
+{
+	macchanger_t *c;
+	int           unset = 0;
+
+	if ((c = macchanger_new ()) == NULL) {
+		if (__atomic_compare_exchange_n (&q->failed, &unset, 1, 0,
+						 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			snprintf (q->why, sizeof(q->why), "Could not initialize the library");
+		}
+		return NULL;
+	}
+	if ((vendor_weights && set_vendor_weights (c, vendor_weights) < 0) ||
+	    (keep_state && q->action != ACTION_SHOW &&
+	     macchanger_use_state (c, state_file) < 0) ||
+	    (q->action == ACTION_RANDOM && q->mode == MACCHANGER_SHARD &&
+	     macchanger_set_shard (c, q->node, q->bits) < 0) ||
+	    (q->action == ACTION_RANDOM && q->mode == MACCHANGER_POOL &&
+	     macchanger_use_pool (c, q->pool) < 0) ||
+	    (unique && q->action == ACTION_RANDOM &&
+	     macchanger_avoid_in_use (c, ctx) < 0)) {
+		if (__atomic_compare_exchange_n (&q->failed, &unset, 1, 0,
+						 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			snprintf (q->why, sizeof(q->why), "%s", macchanger_error (c));
+		}
+		macchanger_free (c);
+		return NULL;
+	}
+	return c;
+}
+
+
+static void *
+device_worker (void *arg)
+{
+	device_queue_t *q = arg;
+	device_job_t   *job;
+	macchanger_t   *c;
+	size_t          i;
+
+	/* Leave the jobs to the others; run_queue() fails what none took */
+	if ((c = worker_context (q)) == NULL) {
+		return NULL;
+	}
+
+	while ((i = __atomic_fetch_add (&q->next, 1, __ATOMIC_RELAXED)) < q->njobs) {
+		job = &q->jobs[i];
+		switch (q->phase) {
+		case PHASE_PLAN:
+			job_plan (q, job, c);
+			break;
+		case PHASE_BOUNCE:
+			job_bounce (q, job, c);
+			break;
+		case PHASE_READ_BACK:
+			job_read_back (q, job, c);
+			break;
+		}
+	}
+
+	show_warnings (c);
+	macchanger_free (c);
+	return NULL;
+}
+
+
+/* Runs every job of the queue; the calling thread works as well */
+static void
+run_queue (device_queue_t *q, phase_t phase)
+{
+	pthread_t threads[MAX_WORKERS];
+	size_t    nthreads, i;
+
+	q->phase  = phase;
+	q->next   = 0;
+	q->failed = 0;
+	nthreads = (q->njobs < MAX_WORKERS) ? q->njobs : MAX_WORKERS;
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create (&threads[i], NULL, device_worker, q) != 0) {
+			break;
+		}
+	}
+	nthreads = i;
+
+	device_worker (q);
+	for (i=1; i<nthreads; i++) {
+		pthread_join (threads[i], NULL);
+	}
+
+	/* A worker that got going takes every job, so these only
+	 * remain when none could be set up.
+	 */
+	for (i=q->next; i<q->njobs; i++) {
+		job_not_run (q, &q->jobs[i], q->why);
+	}
+}
+
+
+/* Adds the devices named by 'arg', a name or a pattern */
+static void
+add_devices (const char *arg, const char ***names, size_t *n, char ***lists, size_t *nlists)
+{
+	char   **found;
+	size_t   nfound, i;
+
+	if (arg && strpbrk (arg, "*?[") == NULL) {
+		found  = NULL;
+		nfound = 1;
+	} else if (macchanger_devices (ctx, arg, &found, &nfound) < 0) {
+		fail ();
+	} else if (nfound == 0) {
+		message ("WARNING", "No interface matches %s", arg ? arg : "--all");
+	}
+
+	*names = (const char **) realloc (*names, (*n + nfound) * sizeof(char *));
+	*lists = (char **) realloc (*lists, (*nlists + 1) * sizeof(char *));
+	if (*names == NULL || *lists == NULL) {
+		message ("FATAL_ERROR", "Not enough memory");
+		quit (EXIT_ERROR);
+	}
+
+	(*lists)[(*nlists)++] = (char *) found;
+	for (i=0; i<nfound; i++) {
+		(*names)[(*n)++] = found ? found[i] : arg;
+	}
+}
+
+
+static unsigned long
+elapsed_usec (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000UL +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+static int
+job_name_compare (const void *a, const void *b)
+{
+	return strcmp ((*(device_job_t * const *) a)->name, (*(device_job_t * const *) b)->name);
+}
+
+
+/* Before a transaction changes anything: every device must have been
+ * read and planned, and none may be given twice.
+ */
+static int
+validate_jobs (device_queue_t *q)
+{
+	device_job_t **sorted;
+	size_t         i;
+	int            ret = 0;
+
+	if ((sorted = (device_job_t **) malloc (q->njobs * sizeof(device_job_t *))) == NULL) {
+		message ("FATAL_ERROR", "Not enough memory");
+		quit (EXIT_ERROR);
+	}
+	for (i=0; i<q->njobs; i++) {
+		sorted[i] = &q->jobs[i];
+		if (q->jobs[i].error[0] != '\0') {
+			ret = -1;
+		}
+	}
+
+	qsort (sorted, q->njobs, sizeof(device_job_t *), job_name_compare);
+	for (i=1; i<q->njobs; i++) {
+		if (strcmp (sorted[i-1]->name, sorted[i]->name) == 0) {
+			snprintf (sorted[i]->error, sizeof(sorted[i]->error),
+				  "Given more than once");
+			ret = -1;
+		}
+	}
+
+	free (sorted);
+	return ret;
+}
+
+
+/* Sets the new address of every planned device, or puts the old one
+ * back.  Without --bounce they go to the kernel in one batch; with it
+ * the threads take each link down on its own, in parallel.
+ */
+static void
+apply_jobs (device_queue_t *q)
+{
+	const char      **names;
+	macchanger_mac_t *macs;
+	int              *errors;
+	device_job_t     *job;
+	size_t            i, n = 0;
+
+	if (q->bounce) {
+		run_queue (q, PHASE_BOUNCE);
+		return;
+	}
+
+	names  = (const char **) malloc (q->njobs * sizeof(char *));
+	macs   = (macchanger_mac_t *) malloc (q->njobs * sizeof(macchanger_mac_t));
+	errors = (int *) malloc (q->njobs * sizeof(int));
+	if (names == NULL || macs == NULL || errors == NULL) {
+		message ("FATAL_ERROR", "Not enough memory");
+		quit (EXIT_ERROR);
+	}
+
+	for (i=0; i<q->njobs; i++) {
+		if (job_selected (q, &q->jobs[i])) {
+			names[n] = q->jobs[i].name;
+			macs[n]  = q->rollback ? q->jobs[i].mac : q->jobs[i].faked;
+			n++;
+		}
+	}
+	if (n > 0) {
+		macchanger_set_macs (ctx, names, macs, errors, n);
+	}
+
+	for (i=0, n=0; i<q->njobs; i++) {
+		job = &q->jobs[i];
+		if (!job_selected (q, job)) {
+			continue;
+		}
+		if (q->rollback) {
+			if (errors[n] != 0) {
+				snprintf (job->undo_error, sizeof(job->undo_error),
+					  "Could not change MAC: %s", strerror (errors[n]));
+				job->undone = -1;
+			} else {
+				job->undone = 1;
+			}
+		} else if (errors[n] != 0) {
+			snprintf (job->error, sizeof(job->error),
+				  "Could not change MAC: %s", strerror (errors[n]));
+		} else {
+			job->applied = 1;
+		}
+		n++;
+	}
+
+	free (errors);
+	free (macs);
+	free (names);
+}
+
+
+/* Gives back to the pool the addresses of the devices that did not
+ * keep theirs, or of every device with 'all'.
+ */
+static void
+release_unused (device_queue_t *q, int all)
+{
+	macchanger_mac_t *macs;
+	size_t            i, n = 0;
+
+	if (q->action != ACTION_RANDOM || q->mode != MACCHANGER_POOL) {
+		return;
+	}
+
+	if ((macs = (macchanger_mac_t *) malloc (q->njobs * sizeof(macchanger_mac_t))) == NULL) {
+		message ("FATAL_ERROR", "Not enough memory");
+		quit (EXIT_ERROR);
+	}
+	for (i=0; i<q->njobs; i++) {
+		device_job_t *job = &q->jobs[i];
+
+		if (job->changed && (all || !job->applied || job->undone > 0)) {
+			macs[n++] = job->planned;
+		}
+	}
+	if (n > 0 && macchanger_pool_release (ctx, macs, n) < 0) {
+		message ("WARNING", "%s", macchanger_error (ctx));
+	}
+	free (macs);
+}
+
+
+static int
+change_devices (device_queue_t *q)
+{
+	struct timespec start;
+	unsigned long   usec_plan, usec_apply = 0, usec_verify = 0, usec_rollback = 0;
+	size_t          i, changed = 0, failed = 0, undone = 0, not_undone = 0;
+	int             aborted = 0;
+
+	/* Read and plan */
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	run_queue (q, PHASE_PLAN);
+	if (q->transaction && validate_jobs (q) < 0) {
+		/* Nothing is changed */
+		release_unused (q, 1);
+		for (i=0; i<q->njobs; i++) {
+			q->jobs[i].changed = 0;
+		}
+		aborted = 1;
+	}
+	usec_plan = elapsed_usec (&start);
+
+	if (!aborted) {
+		/* Change every planned device */
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		apply_jobs (q);
+		usec_apply = elapsed_usec (&start);
+
+		/* See what the devices made of it */
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		run_queue (q, PHASE_READ_BACK);
+		usec_verify = elapsed_usec (&start);
+	}
+
+	/* A transaction that failed anywhere puts back what it changed */
+	for (i=0; i<q->njobs && q->transaction && !aborted; i++) {
+		if (q->jobs[i].error[0] != '\0') {
+			clock_gettime (CLOCK_MONOTONIC, &start);
+			q->rollback = 1;
+			apply_jobs (q);
+			run_queue (q, PHASE_READ_BACK);
+			usec_rollback = elapsed_usec (&start);
+			break;
+		}
+	}
+
+	if (!aborted) {
+		release_unused (q, 0);
+	}
+
+	/* One report for all */
+	for (i=0; i<q->njobs; i++) {
+		device_job_t *job = &q->jobs[i];
+
+		printf ("%s\n", job->name);
+		if (job->read) {
+			print_mac ("  Current MAC:   ", &job->mac);
+			print_mac ("  Permanent MAC: ", &job->permanent);
+		}
+		if (job->error[0] != '\0') {
+			printf ("  Error:         %s\n", job->error);
+			failed++;
+		} else if (job->changed && !q->rollback) {
+			print_mac ("  New MAC:       ", &job->faked);
+			changed++;
+		}
+		if (q->bounce && job->changed && (job->error[0] == '\0' || job->outage.bounced)) {
+			print_outage ("  ", &job->outage);
+		}
+		if (job->undone > 0) {
+			printf ("  Rolled back:   yes\n");
+			undone++;
+		} else if (job->undone < 0) {
+			printf ("  Rolled back:   no, %s\n", job->undo_error);
+			not_undone++;
+		}
+	}
+	if (q->action != ACTION_SHOW) {
+		printf ("%lu interfaces: %lu changed, %lu failed\n",
+			(unsigned long) q->njobs, (unsigned long) changed,
+			(unsigned long) failed);
+	}
+	if (q->transaction && q->action != ACTION_SHOW) {
+		if (aborted) {
+			printf ("Transaction aborted, nothing changed\n");
+		} else if (q->rollback) {
+			printf ("Transaction rolled back: %lu restored, %lu not\n",
+				(unsigned long) undone, (unsigned long) not_undone);
+		}
+		printf ("Validate: %lu us, apply: %lu us, verify: %lu us, rollback: %lu us\n",
+			usec_plan, usec_apply, usec_verify, usec_rollback);
+	}
+
+	return failed ? -1 : 0;
 }
 
 
@@ -100,7 +1047,22 @@ main (int argc, char *argv[])
 	char show         = 0;
 	char set_bia      = 0;
 	char *set_mac     = NULL;
-	char *search_word = NULL;
+	char resolve      = 0;
+	char *resolve_file = NULL;
+	char *generate    = NULL;
+	char all          = 0;
+	char show_every   = 0;
+	char *show_format = NULL;
+	char bounce       = 0;
+	char restore_all  = 0;
+	char transaction  = 0;
+	char *shard       = NULL;
+	char *shard_of    = NULL;
+	char *pool_create  = NULL;
+	char *pool_release = NULL;
+	char pool_compact = 0;
+	const char **search_words;
+	size_t       nsearch_words = 0;
 
 	struct option long_options[] = {
 		/* Options without arguments */
@@ -116,16 +1078,55 @@ main (int argc, char *argv[])
 		{"bia",         no_argument,       NULL, 'b'},
 		{"list",        optional_argument, NULL, 'l'},
 		{"mac",         required_argument, NULL, 'm'},
+		{"no-vendor",   no_argument,       NULL, OPT_NO_VENDOR},
+		{"resolve",     optional_argument, NULL, OPT_RESOLVE},
+		{"generate",    required_argument, NULL, OPT_GENERATE},
+		{"vendor-weights", required_argument, NULL, OPT_VENDOR_WEIGHTS},
+		{"all",         no_argument,       NULL, OPT_ALL},
+		{"show-all",    optional_argument, NULL, OPT_SHOW_ALL},
+		{"bounce",      no_argument,       NULL, OPT_BOUNCE},
+		{"restore-all", no_argument,       NULL, OPT_RESTORE_ALL},
+		{"state-file",  required_argument, NULL, OPT_STATE_FILE},
+		{"no-state",    no_argument,       NULL, OPT_NO_STATE},
+		{"transaction", no_argument,       NULL, OPT_TRANSACTION},
+		{"unique",      no_argument,       NULL, OPT_UNIQUE},
+		{"shard",       required_argument, NULL, OPT_SHARD},
+		{"shard-of",    required_argument, NULL, OPT_SHARD_OF},
+		{"pool",        required_argument, NULL, OPT_POOL},
+		{"pool-create", required_argument, NULL, OPT_POOL_CREATE},
+		{"pool-release", required_argument, NULL, OPT_POOL_RELEASE},
+		{"pool-compact", no_argument,      NULL, OPT_POOL_COMPACT},
 		{NULL, 0, NULL, 0}
 	};
 
-	net_info_t *net;
-	mac_t      *mac;
-	mac_t      *mac_permanent;
-	mac_t      *mac_faked;
+	macchanger_mac_t    mac;
+	macchanger_mac_t    mac_permanent;
+	macchanger_mac_t    mac_faked;
+	macchanger_outage_t outage;
+	macchanger_mac_t   *base;
+	macchanger_random_t mode;
 	char       *device_name;
 	int         val;
 	int         ret;
+	int         fd;
+	unsigned long count, node = 0;
+	unsigned int  bits = 0;
+	char       *end, *slash;
+	const char **devices      = NULL;
+	char       **device_lists = NULL;
+	size_t       ndevices = 0, ndevice_lists = 0, i;
+	device_queue_t queue;
+
+	if ((ctx = macchanger_new ()) == NULL) {
+		message ("FATAL_ERROR", "Could not initialize the library.");
+		exit (EXIT_ERROR);
+	}
+
+	/* Every --list keyword must match */
+	if ((search_words = (const char **) malloc (sizeof(char *) * argc)) == NULL) {
+		message ("FATAL_ERROR", "Not enough memory");
+		quit (EXIT_ERROR);
+	}
 
 	/* Read the parameters */
 	while ((val = getopt_long (argc, argv, "VasAbrephlm:", long_options, NULL)) != -1) {
@@ -137,11 +1138,13 @@ main (int argc, char *argv[])
 				"This is free software; see the source for copying conditions.  There is NO\n"
 				"warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n",
 				VERSION);
-			terminate (EXIT_OK);
+			quit (EXIT_OK);
 			break;
 		case 'l':
 			print_list = 1;
-			search_word = optarg;
+			if (optarg) {
+				search_words[nsearch_words++] = optarg;
+			}
 			break;
 		case 'r':
 			random = 1;
@@ -167,102 +1170,384 @@ main (int argc, char *argv[])
 		case 'm':
 			set_mac = optarg;
 			break;
+		case OPT_NO_VENDOR:
+			show_vendor = 0;
+			break;
+		case OPT_RESOLVE:
+			resolve = 1;
+			resolve_file = optarg;
+			break;
+		case OPT_GENERATE:
+			generate = optarg;
+			break;
+		case OPT_VENDOR_WEIGHTS:
+			if (set_vendor_weights (ctx, optarg) < 0) {
+				fail ();
+			}
+			vendor_weights = optarg;
+			break;
+		case OPT_ALL:
+			all = 1;
+			break;
+		case OPT_SHOW_ALL:
+			show_every  = 1;
+			show_format = optarg;
+			break;
+		case OPT_BOUNCE:
+			bounce = 1;
+			break;
+		case OPT_RESTORE_ALL:
+			restore_all = 1;
+			break;
+		case OPT_STATE_FILE:
+			state_file = optarg;
+			break;
+		case OPT_NO_STATE:
+			keep_state = 0;
+			break;
+		case OPT_TRANSACTION:
+			transaction = 1;
+			break;
+		case OPT_UNIQUE:
+			unique = 1;
+			break;
+		case OPT_SHARD:
+			shard  = optarg;
+			random = 1;
+			break;
+		case OPT_SHARD_OF:
+			shard_of = optarg;
+			break;
+		case OPT_POOL:
+			pool_file = optarg;
+			random    = 1;
+			break;
+		case OPT_POOL_CREATE:
+			pool_create = optarg;
+			break;
+		case OPT_POOL_RELEASE:
+			pool_release = optarg;
+			break;
+		case OPT_POOL_COMPACT:
+			pool_compact = 1;
+			break;
 		case 'h':
 		case '?':
 		default:
 			print_help();
-			terminate (EXIT_OK);
+			quit (EXIT_OK);
 			break;
 		}
 	}
 
-	/* Read the MAC lists */
-	if (mc_maclist_init() < 0) {
-		terminate (EXIT_ERROR);
-	}
-
 	/* Print list? */
 	if (print_list) {
-		mc_maclist_print(search_word);
-		terminate (EXIT_OK);
+		if (macchanger_list (ctx, search_words, nsearch_words, STDOUT_FILENO) < 0) {
+			fail ();
+		}
+		quit (EXIT_OK);
+	}
+
+	/* Print every interface? */
+	if (show_every) {
+		quit ((show_all (show_format) == 0) ? EXIT_OK : EXIT_ERROR);
+	}
+
+	/* Resolve a stream of MACs? */
+	if (resolve) {
+		if (resolve_file && strcmp (resolve_file, "-") != 0) {
+			if ((fd = open (resolve_file, O_RDONLY)) < 0) {
+				message ("FATAL_ERROR", "Could not open %s", resolve_file);
+				quit (EXIT_ERROR);
+			}
+		} else {
+			fd = STDIN_FILENO;
+		}
+
+		if (macchanger_resolve (ctx, fd, STDOUT_FILENO) < 0) {
+			fail ();
+		}
+		quit (EXIT_OK);
+	}
+
+	/* Which shard holds an address? */
+	if (shard_of) {
+		slash = strrchr (shard_of, '/');
+		if (slash == NULL || parse_bits (slash + 1, &bits) < 0) {
+			message ("FATAL_ERROR", "Expected MAC/bits: %s", shard_of);
+			quit (EXIT_ERROR);
+		}
+		*slash = '\0';
+		if (macchanger_parse (ctx, shard_of, &mac) < 0 ||
+		    macchanger_shard_of (ctx, &mac, bits, &node) < 0) {
+			fail ();
+		}
+		printf ("%lu\n", node);
+		quit (EXIT_OK);
+	}
+
+	/* Our own shard */
+	if (shard) {
+		slash = strchr (shard, '/');
+		node  = strtoul (shard, &end, 10);
+		if (slash == NULL || end != slash || end == shard ||
+		    parse_bits (slash + 1, &bits) < 0) {
+			message ("FATAL_ERROR", "Expected node/bits: %s", shard);
+			quit (EXIT_ERROR);
+		}
+		if (macchanger_set_shard (ctx, node, bits) < 0) {
+			fail ();
+		}
+	}
+
+	/* Pool work */
+	if (pool_create || pool_release || pool_compact) {
+		if (pool_file == NULL) {
+			message ("FATAL_ERROR", "Which pool? Use --pool");
+			quit (EXIT_ERROR);
+		}
+		if (pool_create) {
+			slash = strrchr (pool_create, '/');
+			if (slash == NULL || parse_bits (slash + 1, &bits) < 0) {
+				message ("FATAL_ERROR", "Expected MAC/bits: %s", pool_create);
+				quit (EXIT_ERROR);
+			}
+			*slash = '\0';
+			if (macchanger_parse (ctx, pool_create, &mac) < 0 ||
+			    macchanger_create_pool (ctx, pool_file, &mac, bits) < 0) {
+				fail ();
+			}
+		}
+		if (macchanger_use_pool (ctx, pool_file) < 0 ||
+		    (pool_release && release_pooled (pool_release) < 0) ||
+		    (pool_compact && macchanger_pool_compact (ctx) < 0)) {
+			fail ();
+		}
+		print_pool ();
+
+		/* --pool-create may be followed by a first use */
+		if (pool_release || pool_compact || (optind >= argc && !all && !generate)) {
+			quit (EXIT_OK);
+		}
+	}
+	if (pool_file && macchanger_use_pool (ctx, pool_file) < 0) {
+		fail ();
+	}
+
+	/* -r is the default for --generate */
+	if (pool_file) {
+		mode = MACCHANGER_POOL;
+	} else if (shard) {
+		mode = MACCHANGER_SHARD;
+	} else if (ending) {
+		mode = MACCHANGER_ENDING;
+	} else if (another_same) {
+		mode = MACCHANGER_ANOTHER;
+	} else if (another_any) {
+		mode = MACCHANGER_ANOTHER_ANY;
+	} else {
+		mode = MACCHANGER_RANDOM;
+	}
+
+	/* One look at the addresses in use, shared by every pick */
+	if (unique && (generate || random || ending || another_same || another_any)) {
+		ret = macchanger_avoid_in_use (ctx, NULL);
+		if (ret < 0) {
+			fail ();
+		} else if (ret > 0) {
+			message ("WARNING", "Could not read the neighbour tables, "
+				 "only local addresses are avoided");
+		}
+	}
+
+	/* Generate addresses? */
+	if (generate) {
+		count = strtoul (generate, &end, 10);
+		if (*generate == '\0' || *end != '\0' || count == 0) {
+			message ("FATAL_ERROR", "Invalid number of addresses: %s", generate);
+			quit (EXIT_ERROR);
+		}
+
+		/* -e and -a start from the address of a device */
+		base = NULL;
+		if (ending || another_same) {
+			if (optind >= argc) {
+				message ("FATAL_ERROR", "--ending and --another need a device "
+					 "to take the vendor from");
+				quit (EXIT_ERROR);
+			}
+			if (macchanger_get_mac (ctx, argv[optind], &mac) < 0) {
+				fail ();
+			}
+			base = &mac;
+		}
+
+		if (macchanger_generate (ctx, STDOUT_FILENO, count, mode, base, set_bia) < 0) {
+			fail ();
+		}
+		quit (EXIT_OK);
+	}
+
+	/* Save the original MACs before changing any */
+	if (keep_state && (random || ending || another_same || another_any ||
+			   permanent || set_mac || restore_all) &&
+	    macchanger_use_state (ctx, state_file) < 0) {
+		/* Only a state file asked for by name is worth stopping for */
+		if (state_file || restore_all) {
+			fail ();
+		}
+		message ("WARNING", "%s; original MACs will not be saved",
+			 macchanger_error (ctx));
+		keep_state = 0;
+	}
+
+	/* Put every saved MAC back? */
+	if (restore_all) {
+		if (!keep_state) {
+			message ("FATAL_ERROR", "--restore-all needs the state file");
+			quit (EXIT_ERROR);
+		}
+		quit ((restore_saved () == 0) ? EXIT_OK : EXIT_ERROR);
 	}
 
 	/* Get device name argument */
-	if (optind >= argc) {
+	if (optind >= argc && !all) {
 		print_usage();
-		terminate (EXIT_OK);
+		quit (EXIT_OK);
 	}
-	device_name = argv[optind];
 
-	/* Seed a random number generator */
-	if (strong_random_init() != 0) {
-		fatal("Failed to initialize strong RNG.");
+	/* Many devices, or patterns? */
+	if (all || argc - optind > 1 || strpbrk (argv[optind], "*?[") != NULL) {
+		if (set_mac) {
+			message ("FATAL_ERROR", "--mac can only be used with a single device");
+			quit (EXIT_ERROR);
+		}
+
+		if (all) {
+			add_devices (NULL, &devices, &ndevices, &device_lists, &ndevice_lists);
+		}
+		for (val = optind; val < argc; val++) {
+			add_devices (argv[val], &devices, &ndevices, &device_lists, &ndevice_lists);
+		}
+
+		memset (&queue, 0, sizeof(queue));
+		queue.njobs = ndevices;
+		queue.jobs  = (device_job_t *) calloc (ndevices + 1, sizeof(device_job_t));
+		if (queue.jobs == NULL) {
+			message ("FATAL_ERROR", "Not enough memory");
+			quit (EXIT_ERROR);
+		}
+		for (i=0; i<ndevices; i++) {
+			queue.jobs[i].name = devices[i];
+		}
+
+		if (set_bia  &&  !random) {
+			message ("WARNING", "Ignoring --bia option that can only be used with --random");
+		}
+
+		queue.bia    = set_bia;
+		queue.bounce = bounce;
+		queue.transaction = transaction;
+		if (show) {
+			queue.action = ACTION_SHOW;
+		} else if (random || ending || another_same || another_any) {
+			queue.action = ACTION_RANDOM;
+			queue.mode   = (random && !shard && !pool_file) ? MACCHANGER_RANDOM : mode;
+			queue.node   = node;
+			queue.bits   = bits;
+			queue.pool   = pool_file;
+		} else if (permanent) {
+			queue.action = ACTION_PERMANENT;
+		} else {
+			queue.action = ACTION_SHOW;
+		}
+
+		ret = change_devices (&queue);
+
+		free (queue.jobs);
+		for (i=0; i<ndevice_lists; i++) {
+			free (device_lists[i]);
+		}
+		free (device_lists);
+		free (devices);
+		free (search_words);
+		quit ((ret == 0) ? EXIT_OK : EXIT_ERROR);
 	}
+	device_name = argv[optind];
 
 	/* Read the MAC */
-	if ((net = mc_net_info_new(device_name)) == NULL) {
-		terminate (EXIT_ERROR);
+	if (macchanger_get_mac (ctx, device_name, &mac) < 0) {
+		fail ();
+	}
+	if (macchanger_get_permanent_mac (ctx, device_name, &mac_permanent) < 0) {
+		message ("ERROR", "%s", macchanger_error (ctx));
+		memset (&mac_permanent, 0, sizeof(mac_permanent));
 	}
-	mac = mc_net_info_get_mac(net);
-	mac_permanent = mc_net_info_get_permanent_mac(net);
 
 	/* --bia can only be used with --random */
 	if (set_bia  &&  !random) {
-		warning ("Ignoring --bia option that can only be used with --random");
+		message ("WARNING", "Ignoring --bia option that can only be used with --random");
 	}
 
 	/* Print the current MAC info */
-	print_mac ("Current MAC:   ", mac);
-	print_mac ("Permanent MAC: ", mac_permanent);
+	print_mac ("Current MAC:   ", &mac);
+	print_mac ("Permanent MAC: ", &mac_permanent);
 
 	/* Change the MAC */
-	mac_faked = mc_mac_dup (mac);
+	mac_faked = mac;
 
 	if (show) {
-		terminate (EXIT_OK);
+		quit (EXIT_OK);
 	} else if (set_mac) {
-		if (mc_mac_read_string (mac_faked, set_mac) < 0) {
-			terminate (EXIT_ERROR);
+		if (macchanger_parse (ctx, set_mac, &mac_faked) < 0) {
+			fail ();
+		}
+	} else if (random || ending || another_same || another_any) {
+		if (macchanger_random (ctx, &mac_faked, (random && !shard && !pool_file) ? MACCHANGER_RANDOM : mode,
+				       set_bia) < 0) {
+			fail ();
 		}
-	} else if (random) {
-		mc_mac_random (mac_faked, 6, set_bia);
-	} else if (ending) {
-		mc_mac_random (mac_faked, 3, 1);
-	} else if (another_same) {
-		val = mc_maclist_is_wireless (mac);
-		mc_maclist_set_random_vendor (mac_faked, val);
-		mc_mac_random (mac_faked, 3, 1);
-	} else if (another_any) {
-		mc_maclist_set_random_vendor(mac_faked, mac_is_anykind);
-		mc_mac_random (mac_faked, 3, 1);
 	} else if (permanent) {
-		mac_faked = mc_mac_dup (mac_permanent);
+		mac_faked = mac_permanent;
+		if (mac_is_zero (&mac_permanent) &&
+		    (!keep_state || macchanger_get_original_mac (ctx, device_name, &mac_faked) < 0)) {
+			message ("ERROR", "%s has no permanent MAC%s", device_name,
+				 keep_state ? ", and none was saved" : "");
+			quit (EXIT_ERROR);
+		}
 	} else {
-		terminate (EXIT_OK); /* default to show */
+		quit (EXIT_OK); /* default to show */
 	}
 
 	/* Set the new MAC */
-	ret = mc_net_info_set_mac (net, mac_faked);
+	if (bounce) {
+		ret = macchanger_set_mac_bounce (ctx, device_name, &mac_faked, &outage);
+		if (ret == 0 || outage.bounced) {
+			print_outage ("", &outage);
+		}
+	} else {
+		ret = macchanger_set_mac (ctx, device_name, &mac_faked);
+	}
 	if (ret == 0) {
 		/* Re-read the MAC */
-		mc_mac_free (mac_faked);
-		mac_faked = mc_net_info_get_mac(net);
+		if (macchanger_get_mac (ctx, device_name, &mac_faked) < 0) {
+			fail ();
+		}
 
 		/* Print it */
-		print_mac ("New MAC:       ", mac_faked);
+		print_mac ("New MAC:       ", &mac_faked);
 
 		/* Is the same MAC? */
-		if (mc_mac_equal (mac, mac_faked)) {
+		if (memcmp (&mac, &mac_faked, sizeof(mac)) == 0) {
 			printf ("It's the same MAC!!\n");
 		}
+	} else {
+		message ("ERROR", "%s", macchanger_error (ctx));
+		if (pool_file && random && macchanger_pool_release (ctx, &mac_faked, 1) < 0) {
+			message ("WARNING", "%s", macchanger_error (ctx));
+		}
 	}
 
-	/* Memory free */
-	mc_mac_free (mac);
-	mc_mac_free (mac_faked);
-	mc_mac_free (mac_permanent);
-	mc_net_info_free (net);
-	mc_maclist_free();
-
-	terminate((ret == 0) ? EXIT_OK : EXIT_ERROR);
+	free (search_words);
+	quit ((ret == 0) ? EXIT_OK : EXIT_ERROR);
 }
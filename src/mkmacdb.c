@@ -0,0 +1,91 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* Compiles the text vendor lists into the precompiled database
+ * that macchanger maps at startup.  Run at build time:
+ *
+ *   mkmacdb [-t] <listdir> [<output>]
+ *
+ * With -t it also reports how long loading the text lists took and
+ * the peak resident set size of the process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "maclist.h"
+#include "common.h"
+
+static double
+elapsed_ms (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 +
+	       (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	struct timespec start;
+	struct rusage   usage;
+	int             timing = 0;
+	int             ret = 0;
+
+	if (argc > 1 && strcmp (argv[1], "-t") == 0) {
+		timing = 1;
+		argc--;
+		argv++;
+	}
+
+	if (argc != 3 && !(timing && argc == 2)) {
+		fprintf (stderr, "Usage: mkmacdb [-t] <listdir> [<output>]\n");
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	if (mc_maclist_load_text (argv[1]) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (timing) {
+		getrusage (RUSAGE_SELF, &usage);
+		printf ("Text lists loaded in %.3f ms, peak RSS %ld KiB\n",
+			elapsed_ms (&start), usage.ru_maxrss);
+	}
+
+	if (argc == 3) {
+		ret = mc_maclist_write_db (argv[2]);
+	}
+	mc_maclist_free ();
+
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
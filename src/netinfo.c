@@ -26,7 +26,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <fnmatch.h>
 #include <sys/ioctl.h>
 
 #include <linux/ethtool.h>
@@ -36,26 +39,67 @@
 #include "common.h"
 
 
+/* A control socket for the interface ioctls.  It reaches the
+ * interfaces of the network namespace it was opened in.
+ */
+int
+mc_net_info_socket (void)
+{
+	int sock, err;
+
+	sock = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		err = errno;
+		error ("Socket: %s", strerror (err));
+		errno = err;
+	}
+
+	return sock;
+}
+
+
+/* Like mc_net_info_new(), but borrows 'sock' instead of opening a
+ * socket of its own; the caller keeps it open and closes it.
+ */
 net_info_t *
-mc_net_info_new (const char *device)
+mc_net_info_new_shared (int sock, const char *device)
 {
 	net_info_t *new = (net_info_t *) xmalloc (sizeof(net_info_t));
+	int         err;
 
-	new->sock = socket (AF_INET, SOCK_DGRAM, 0);
-	if (new->sock<0) {
-		perror ("[ERROR] Socket");
-		free(new);
-		return NULL;
-	}
+	new->sock     = sock;
+	new->own_sock = 0;
 
 	strncpy (new->dev.ifr_name, device, sizeof(new->dev.ifr_name));
 	new->dev.ifr_name[sizeof(new->dev.ifr_name)-1] = '\0';
 	if (ioctl(new->sock, SIOCGIFHWADDR, &new->dev) < 0) {
-		perror ("[ERROR] Set device name");
+		err = errno;
+		error ("Set device name: %s", strerror (err));
 		free(new);
+		errno = err;
+		return NULL;
+	}
+
+	return new;
+}
+
+
+net_info_t *
+mc_net_info_new (const char *device)
+{
+	net_info_t *new;
+	int         sock;
+
+	if ((sock = mc_net_info_socket ()) < 0) {
+		return NULL;
+	}
+
+	if ((new = mc_net_info_new_shared (sock, device)) == NULL) {
+		close(sock);
 		return NULL;
 	}
 
+	new->own_sock = 1;
 	return new;
 }
 
@@ -63,7 +107,9 @@ mc_net_info_new (const char *device)
 void
 mc_net_info_free (net_info_t *net)
 {
-	close(net->sock);
+	if (net->own_sock) {
+		close(net->sock);
+	}
 	free(net);
 }
 
@@ -82,23 +128,93 @@ mc_net_info_get_mac (const net_info_t *net)
 }
 
 
+/* On failure errno is left as the ioctl set it, for callers that
+ * report each device on its own.
+ */
 int
 mc_net_info_set_mac (net_info_t *net, const mac_t *mac)
 {
-	int i;
+	int i, err;
 
 	for (i=0; i<6; i++) {
 		net->dev.ifr_hwaddr.sa_data[i] = mac->byte[i];
 	}
 
 	if (ioctl(net->sock, SIOCSIFHWADDR, &net->dev) < 0) {
-		perror ("[ERROR] Could not change MAC: interface up or insufficient permissions");
+		err = errno;
+		error ("Could not change MAC: interface up or insufficient permissions: %s",
+		       strerror (err));
+		errno = err;
 		return -1;
 	}
 
 	return 0;
 }
 
+
+/* Like mc_net_info_set_mac(), but a device that will not change its
+ * address while up is taken down for it and brought back up.  Each
+ * step is an ioctl of its own, so the link is down for three system
+ * calls; rtnetlink does better where the kernel has it.
+ */
+int
+mc_net_info_set_mac_bounce (net_info_t *net, const mac_t *mac, mc_outage_t *outage)
+{
+	struct ifreq    flags;
+	struct timespec start, end;
+	int             i, err = 0;
+
+	memset (outage, 0, sizeof(*outage));
+
+	for (i=0; i<6; i++) {
+		net->dev.ifr_hwaddr.sa_data[i] = mac->byte[i];
+	}
+	if (ioctl (net->sock, SIOCSIFHWADDR, &net->dev) == 0) {
+		return 0;
+	}
+	err = errno;
+
+	memcpy (&flags, &net->dev, sizeof(flags));
+	if (err != EBUSY || ioctl (net->sock, SIOCGIFFLAGS, &flags) < 0 ||
+	    !(flags.ifr_flags & IFF_UP)) {
+		error ("Could not change MAC: interface up or insufficient permissions: %s",
+		       strerror (err));
+		errno = err;
+		return -1;
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	flags.ifr_flags &= ~IFF_UP;
+	if (ioctl (net->sock, SIOCSIFFLAGS, &flags) < 0) {
+		err = errno;
+		error ("Could not take %s down: %s", net->dev.ifr_name, strerror (err));
+		errno = err;
+		return -1;
+	}
+
+	err = 0;
+	if (ioctl (net->sock, SIOCSIFHWADDR, &net->dev) < 0) {
+		err = errno;
+	}
+
+	flags.ifr_flags |= IFF_UP;
+	if (ioctl (net->sock, SIOCSIFFLAGS, &flags) < 0) {
+		err = errno;
+		error ("Could not bring %s back up: %s", net->dev.ifr_name, strerror (err));
+	} else if (err != 0) {
+		error ("Could not change MAC: %s", strerror (err));
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	outage->bounced   = 1;
+	outage->down_usec = (end.tv_sec - start.tv_sec) * 1000000UL +
+			    (end.tv_nsec - start.tv_nsec) / 1000;
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+
 mac_t *
 mc_net_info_get_permanent_mac (const net_info_t *net)
 {
@@ -117,7 +233,9 @@ mc_net_info_get_permanent_mac (const net_info_t *net)
 	req.ifr_data = (caddr_t)epa;
 
 	if (ioctl(net->sock, SIOCETHTOOL, &req) < 0) {
-		perror ("[ERROR] Could not read permanent MAC");
+		error ("Could not read permanent MAC: %s", strerror (errno));
+		free(newmac);
+		newmac = NULL;
 	} else {
 		for (i=0; i<6; i++) {
 			newmac->byte[i] = epa->data[i];
@@ -127,3 +245,58 @@ mc_net_info_get_permanent_mac (const net_info_t *net)
 	free(epa);
 	return newmac;
 }
+
+
+/* The names of the interfaces matching the shell 'pattern', or of all
+ * but the loopback ones if it is NULL.  The array and the names are a
+ * single allocation, terminated by a NULL.
+ */
+char **
+mc_net_info_devices (int sock, const char *pattern, size_t *n)
+{
+	struct if_nameindex *ifs, *i;
+	struct ifreq         req;
+	char               **names;
+	char                *p;
+	size_t               count = 0, size = 0;
+
+	if ((ifs = if_nameindex ()) == NULL) {
+		fatal ("Could not list the interfaces: %s", strerror (errno));
+	}
+
+	/* Mark the ones to keep by clearing the others' index */
+	for (i = ifs; i->if_name; i++) {
+		if (pattern) {
+			if (fnmatch (pattern, i->if_name, 0) != 0) {
+				i->if_index = 0;
+			}
+		} else {
+			memset (&req, 0, sizeof(req));
+			strncpy (req.ifr_name, i->if_name, sizeof(req.ifr_name) - 1);
+			if (ioctl (sock, SIOCGIFFLAGS, &req) < 0 ||
+			    (req.ifr_flags & IFF_LOOPBACK)) {
+				i->if_index = 0;
+			}
+		}
+
+		if (i->if_index) {
+			count++;
+			size += strlen (i->if_name) + 1;
+		}
+	}
+
+	names = (char **) xmalloc ((count + 1) * sizeof(char *) + size);
+	p = (char *) (names + count + 1);
+	count = 0;
+	for (i = ifs; i->if_name; i++) {
+		if (i->if_index) {
+			names[count++] = strcpy (p, i->if_name);
+			p += strlen (p) + 1;
+		}
+	}
+	names[count] = NULL;
+
+	if_freenameindex (ifs);
+	*n = count;
+	return names;
+}
@@ -32,15 +32,29 @@
 
 typedef struct {
 	   int sock;
+	   int own_sock;
 	   struct ifreq dev;
 } net_info_t;
 
-net_info_t *mc_net_info_new     (const char *device);
-void        mc_net_info_free    (net_info_t *);
+/* What changing an address cost the link */
+typedef struct {
+	int           bounced;       /* it was taken down */
+	unsigned long down_usec;     /* for at most this long */
+	int           carrier;       /* its carrier came back ... */
+	unsigned long carrier_usec;  /* ... this long after it went down */
+} mc_outage_t;
+
+int         mc_net_info_socket     (void);
+net_info_t *mc_net_info_new        (const char *device);
+net_info_t *mc_net_info_new_shared (int sock, const char *device);
+void        mc_net_info_free       (net_info_t *);
 
 mac_t      *mc_net_info_get_mac (const net_info_t *);
 int         mc_net_info_set_mac (net_info_t *, const mac_t *);
+int         mc_net_info_set_mac_bounce (net_info_t *, const mac_t *, mc_outage_t *);
 
 mac_t      *mc_net_info_get_permanent_mac (const net_info_t *);
 
+char      **mc_net_info_devices (int sock, const char *pattern, size_t *n);
+
 #endif /* __MAC_CHANGER_NETINFO_H__ */
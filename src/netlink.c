@@ -0,0 +1,847 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+/* The rtnetlink backend
+ *
+ * Changing an address through RTM_NEWLINK takes no socket per device
+ * and no ioctl per device: the interface is named in the message, and
+ * a few hundred changes go to the kernel in a single sendmsg().  The
+ * kernel answers every message with an acknowledgement that carries
+ * its own errno, and with extended acks also a description, so the
+ * failure of one interface is told apart from the others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include "netlink.h"
+#include "common.h"
+
+#ifndef NETLINK_CAP_ACK
+# define NETLINK_CAP_ACK  10
+#endif
+#ifndef NETLINK_EXT_ACK
+# define NETLINK_EXT_ACK  11
+#endif
+
+#define NL_RECV_SIZE  32768
+#define NL_DUMP_SIZE  65536
+
+#ifndef RTEXT_FILTER_SKIP_STATS
+# define RTEXT_FILTER_SKIP_STATS  (1 << 3)
+#endif
+#ifndef IFLA_PERM_ADDRESS
+# define IFLA_PERM_ADDRESS  54
+#endif
+#ifndef IFF_LOWER_UP
+# define IFF_LOWER_UP  0x10000
+#endif
+
+
+/* NULL, with errno set, if the kernel has no rtnetlink for us.
+ * Callers fall back to the ioctls, so this is not an error().
+ */
+mc_netlink_t *
+mc_netlink_open (void)
+{
+	mc_netlink_t       *nl;
+	struct sockaddr_nl  addr;
+	int                 one = 1;
+	int                 err;
+
+	nl = (mc_netlink_t *) xcalloc (1, sizeof(mc_netlink_t));
+	nl->sock = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl->sock < 0) {
+		free (nl);
+		return NULL;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind (nl->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = errno;
+		close (nl->sock);
+		free (nl);
+		errno = err;
+		return NULL;
+	}
+
+	/* Acks without a copy of the request, with a reason if there is
+	 * one.  Old kernels lack either, which only costs detail.
+	 */
+	setsockopt (nl->sock, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+	setsockopt (nl->sock, SOL_NETLINK, NETLINK_EXT_ACK, &one, sizeof(one));
+
+	nl->seq      = 1;
+	nl->messages = (char **) xcalloc (MC_NETLINK_BATCH, sizeof(char *));
+	return nl;
+}
+
+
+static void
+forget_messages (mc_netlink_t *nl)
+{
+	size_t i;
+
+	for (i=0; i<MC_NETLINK_BATCH; i++) {
+		free (nl->messages[i]);
+		nl->messages[i] = NULL;
+	}
+}
+
+
+void
+mc_netlink_close (mc_netlink_t *nl)
+{
+	if (nl == NULL) {
+		return;
+	}
+
+	forget_messages (nl);
+	close (nl->sock);
+	free (nl->messages);
+	free (nl->buf);
+	free (nl);
+}
+
+
+static void *
+reserve (mc_netlink_t *nl, size_t len)
+{
+	void *p;
+
+	if (nl->len + len > nl->size) {
+		while (nl->len + len > nl->size) {
+			nl->size = nl->size ? 2 * nl->size : 16384;
+		}
+		nl->buf = (char *) xrealloc (nl->buf, nl->size);
+	}
+
+	p = nl->buf + nl->len;
+	memset (p, 0, len);
+	nl->len += len;
+	return p;
+}
+
+
+/* Queues a message with its fixed 'header' (an ifinfomsg, ...).  All
+ * but dump requests ask for an ack.
+ */
+void
+mc_netlink_begin (mc_netlink_t *nl, int type, int flags, const void *header, size_t len)
+{
+	struct nlmsghdr *h;
+
+	if (nl->count == MC_NETLINK_BATCH) {
+		fatal ("Netlink batch overflow");
+	}
+
+	nl->last = nl->len;
+	h = reserve (nl, NLMSG_SPACE (len));
+	h->nlmsg_len   = NLMSG_LENGTH (len);
+	h->nlmsg_type  = type;
+	h->nlmsg_flags = flags | NLM_F_REQUEST | ((flags & NLM_F_DUMP) ? 0 : NLM_F_ACK);
+	h->nlmsg_seq   = nl->seq + nl->count;
+	memcpy (NLMSG_DATA (h), header, len);
+
+	nl->count++;
+}
+
+
+/* Adds an attribute to the message being built */
+void
+mc_netlink_attr (mc_netlink_t *nl, int type, const void *data, size_t len)
+{
+	struct nlmsghdr *h;
+	struct rtattr   *rta;
+
+	rta = reserve (nl, RTA_SPACE (len));
+	rta->rta_type = type;
+	rta->rta_len  = RTA_LENGTH (len);
+	memcpy (RTA_DATA (rta), data, len);
+
+	h = (struct nlmsghdr *) (nl->buf + nl->last);
+	h->nlmsg_len = nl->len - nl->last;
+}
+
+
+/* The text of an extended ack, if the kernel sent one */
+static void
+read_ext_ack (mc_netlink_t *nl, const struct nlmsghdr *h, size_t i)
+{
+	const struct nlmsgerr *err = NLMSG_DATA (h);
+	const struct rtattr   *rta;
+	size_t                 offset;
+	int                    len;
+
+	if (!(h->nlmsg_flags & NLM_F_ACK_TLVS)) {
+		return;
+	}
+
+	/* Unless capped, the ack quotes the whole request first */
+	offset = sizeof(*err);
+	if (!(h->nlmsg_flags & NLM_F_CAPPED)) {
+		offset += err->msg.nlmsg_len - sizeof(struct nlmsghdr);
+	}
+
+	rta = (const struct rtattr *) ((const char *) err + NLMSG_ALIGN (offset));
+	len = (int) h->nlmsg_len - (int) ((const char *) rta - (const char *) h);
+	for (; RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+		if (rta->rta_type == NLMSGERR_ATTR_MSG && RTA_PAYLOAD (rta) > 1) {
+			nl->messages[i] = strndup (RTA_DATA (rta), RTA_PAYLOAD (rta));
+		}
+	}
+}
+
+
+/* Sends every queued message and collects their acks.  'errors' gets
+ * 0 or the errno of each message, in the order they were queued, and
+ * any other reply to them goes to 'cb'.  Returns -1, with errno set,
+ * if the exchange itself failed; nothing is known about the messages
+ * then.
+ */
+static int
+exchange (mc_netlink_t *nl, int *errors, mc_netlink_cb_t cb, void *arg)
+{
+	struct sockaddr_nl  kernel;
+	struct msghdr       msg;
+	struct iovec        iov;
+	struct nlmsghdr    *h;
+	char               *buf;
+	size_t              count = nl->count;
+	size_t              pending = count;
+	size_t              i;
+	uint32_t            first = nl->seq;
+	ssize_t             n;
+	int                 len;
+	int                 err;
+	int                 ret = 0;
+
+	if (nl->count == 0) {
+		return 0;
+	}
+
+	forget_messages (nl);
+	for (i=0; i<nl->count; i++) {
+		errors[i] = EIO;
+	}
+
+	memset (&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+
+	iov.iov_base = nl->buf;
+	iov.iov_len  = nl->len;
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_name    = &kernel;
+	msg.msg_namelen = sizeof(kernel);
+	msg.msg_iov     = &iov;
+	msg.msg_iovlen  = 1;
+
+	/* The batch is spent whatever happens next */
+	nl->seq  += nl->count;
+	nl->len   = 0;
+	nl->count = 0;
+
+	while ((n = sendmsg (nl->sock, &msg, 0)) < 0 && errno == EINTR);
+	if (n < 0) {
+		return -1;
+	}
+
+	buf = (char *) xmalloc (NL_RECV_SIZE);
+	while (pending > 0) {
+		n = recv (nl->sock, buf, NL_RECV_SIZE, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ret = -1;
+			break;
+		}
+
+		len = n;
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, len); h = NLMSG_NEXT (h, len)) {
+			i = (uint32_t) (h->nlmsg_seq - first);
+			if (i >= count) {
+				continue;  /* not about this batch */
+			}
+			if (h->nlmsg_type != NLMSG_ERROR) {
+				if (cb) {
+					cb (h, arg);
+				}
+				continue;
+			}
+
+			errors[i] = -((const struct nlmsgerr *) NLMSG_DATA (h))->error;
+			if (errors[i] != 0) {
+				read_ext_ack (nl, h, i);
+			}
+			pending--;
+		}
+	}
+
+	err = errno;
+	free (buf);
+	errno = err;
+	return ret;
+}
+
+
+int
+mc_netlink_flush (mc_netlink_t *nl, int *errors)
+{
+	return exchange (nl, errors, NULL, NULL);
+}
+
+
+/* The description the kernel gave for the failure of message 'i' of
+ * the last flush, or NULL.  Valid until the next flush.
+ */
+const char *
+mc_netlink_message (const mc_netlink_t *nl, size_t i)
+{
+	return (i < MC_NETLINK_BATCH) ? nl->messages[i] : NULL;
+}
+
+
+/* Sets the address of every device, MC_NETLINK_BATCH at a time.
+ * 'errors' gets 0 or an errno per device, and error() is told about
+ * each failure.  Returns -1 only if rtnetlink itself failed, so the
+ * caller may fall back to another way.
+ */
+int
+mc_netlink_set_macs (mc_netlink_t *nl, const char *const *devices,
+		     const mac_t *macs, int *errors, size_t n)
+{
+	struct ifinfomsg  ifi;
+	char              name[IFNAMSIZ];
+	const char       *why;
+	size_t            start, i, len;
+
+	memset (&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+
+	for (start=0; start<n; start+=MC_NETLINK_BATCH) {
+		len = (n - start < MC_NETLINK_BATCH) ? n - start : MC_NETLINK_BATCH;
+
+		/* Index 0: the kernel finds the interface by its name */
+		for (i=0; i<len; i++) {
+			strncpy (name, devices[start+i], sizeof(name));
+			name[sizeof(name)-1] = '\0';
+
+			mc_netlink_begin (nl, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+			mc_netlink_attr (nl, IFLA_IFNAME, name, strlen (name) + 1);
+			mc_netlink_attr (nl, IFLA_ADDRESS, macs[start+i].byte, 6);
+		}
+
+		if (mc_netlink_flush (nl, errors + start) < 0) {
+			return -1;
+		}
+
+		for (i=0; i<len; i++) {
+			if (errors[start+i] == 0) {
+				continue;
+			}
+			why = mc_netlink_message (nl, i);
+			error ("Could not change MAC of %s: %s%s%s", devices[start+i],
+			       strerror (errors[start+i]), why ? ": " : "", why ? why : "");
+		}
+	}
+
+	return 0;
+}
+
+
+/* Sends the dump request queued alone, and hands every message of
+ * the answer to 'cb'.  Returns -1, with errno set, if the dump
+ * failed; EAGAIN means it was disturbed by a change and is worth
+ * running again.
+ */
+int
+mc_netlink_dump (mc_netlink_t *nl, mc_netlink_cb_t cb, void *arg)
+{
+	struct nlmsghdr *h;
+	char            *buf;
+	uint32_t         seq = nl->seq;
+	ssize_t          n;
+	int              len, err = 0, done = 0, intr = 0;
+
+	nl->seq  += nl->count;
+	nl->count = 0;
+	while ((n = send (nl->sock, nl->buf, nl->len, 0)) < 0 && errno == EINTR);
+	nl->len = 0;
+	if (n < 0) {
+		return -1;
+	}
+
+	buf = (char *) xmalloc (NL_DUMP_SIZE);
+	while (!done) {
+		n = recv (nl->sock, buf, NL_DUMP_SIZE, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err = errno;
+			break;
+		}
+
+		len = n;
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, len); h = NLMSG_NEXT (h, len)) {
+			if (h->nlmsg_seq != seq) {
+				continue;
+			}
+			if (h->nlmsg_flags & NLM_F_DUMP_INTR) {
+				intr = 1;
+			}
+			if (h->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				err  = -((const struct nlmsgerr *) NLMSG_DATA (h))->error;
+				done = 1;
+				break;
+			}
+			cb (h, arg);
+		}
+	}
+
+	free (buf);
+	if (err == 0 && intr) {
+		err = EAGAIN;
+	}
+	errno = err;
+	return err ? -1 : 0;
+}
+
+
+static void
+link_add (const struct nlmsghdr *h, void *arg)
+{
+	mc_link_list_t         *list = arg;
+	const struct ifinfomsg *ifi = NLMSG_DATA (h);
+	const struct rtattr    *rta;
+	mc_link_t              *link;
+	int                     len;
+
+	if (h->nlmsg_type != RTM_NEWLINK && h->nlmsg_type != RTM_DELLINK) {
+		return;
+	}
+
+	if (list->len == list->size) {
+		list->size  = list->size ? 2 * list->size : 64;
+		list->links = (mc_link_t *) xrealloc (list->links, list->size * sizeof(mc_link_t));
+	}
+	link = &list->links[list->len++];
+	memset (link, 0, sizeof(*link));
+	link->index   = ifi->ifi_index;
+	link->flags   = ifi->ifi_flags;
+	link->removed = (h->nlmsg_type == RTM_DELLINK);
+
+	rta = IFLA_RTA (ifi);
+	len = IFLA_PAYLOAD (h);
+	for (; RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			snprintf (link->name, sizeof(link->name), "%.*s",
+				  (int) RTA_PAYLOAD (rta), (const char *) RTA_DATA (rta));
+			break;
+		case IFLA_ADDRESS:
+			if (RTA_PAYLOAD (rta) == 6) {
+				memcpy (link->mac.byte, RTA_DATA (rta), 6);
+				link->has_mac = 1;
+			}
+			break;
+		case IFLA_PERM_ADDRESS:
+			list->perm_known = 1;
+			if (RTA_PAYLOAD (rta) == 6) {
+				memcpy (link->permanent.byte, RTA_DATA (rta), 6);
+				link->has_permanent = 1;
+			}
+			break;
+		}
+	}
+}
+
+
+/* Every link of the namespace, from a single RTM_GETLINK dump.  On
+ * success 'list->perm_known' tells whether the kernel reports
+ * permanent addresses; if it does, a link without one has none.
+ */
+int
+mc_netlink_links (mc_netlink_t *nl, mc_link_list_t *list)
+{
+	struct ifinfomsg ifi;
+	uint32_t         mask = RTEXT_FILTER_SKIP_STATS;
+	int              tries, ret = -1;
+
+	/* A link that comes or goes during the dump spoils it */
+	for (tries=0; tries<3 && ret < 0; tries++) {
+		list->len        = 0;
+		list->perm_known = 0;
+
+		memset (&ifi, 0, sizeof(ifi));
+		ifi.ifi_family = AF_UNSPEC;
+		mc_netlink_begin (nl, RTM_GETLINK, NLM_F_DUMP, &ifi, sizeof(ifi));
+		mc_netlink_attr (nl, IFLA_EXT_MASK, &mask, sizeof(mask));
+
+		ret = mc_netlink_dump (nl, link_add, list);
+		if (ret < 0 && errno != EAGAIN) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+typedef struct {
+	mc_netlink_mac_cb_t  cb;
+	void                *arg;
+} neigh_walk_t;
+
+
+static void
+neigh_add (const struct nlmsghdr *h, void *arg)
+{
+	neigh_walk_t        *walk = arg;
+	const struct ndmsg  *ndm = NLMSG_DATA (h);
+	const struct rtattr *rta;
+	mac_t                mac;
+	int                  len;
+
+	if (h->nlmsg_type != RTM_NEWNEIGH) {
+		return;
+	}
+
+	rta = (const struct rtattr *) ((const char *) ndm + NLMSG_ALIGN (sizeof(*ndm)));
+	len = h->nlmsg_len - NLMSG_LENGTH (sizeof(*ndm));
+	for (; RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+		if (rta->rta_type == NDA_LLADDR && RTA_PAYLOAD (rta) == 6) {
+			memcpy (mac.byte, RTA_DATA (rta), 6);
+			walk->cb (&mac, walk->arg);
+		}
+	}
+}
+
+
+/* The link layer address of every neighbour table entry, ARP and
+ * NDP alike, from a single RTM_GETNEIGH dump.  A dump that had to be
+ * run again may hand the same address to 'cb' more than once.
+ */
+int
+mc_netlink_neighbours (mc_netlink_t *nl, mc_netlink_mac_cb_t cb, void *arg)
+{
+	struct ndmsg ndm;
+	neigh_walk_t walk;
+	int          tries, ret = -1;
+
+	walk.cb  = cb;
+	walk.arg = arg;
+	for (tries=0; tries<3 && ret < 0; tries++) {
+		memset (&ndm, 0, sizeof(ndm));
+		ndm.ndm_family = AF_UNSPEC;
+		mc_netlink_begin (nl, RTM_GETNEIGH, NLM_F_DUMP, &ndm, sizeof(ndm));
+
+		ret = mc_netlink_dump (nl, neigh_add, &walk);
+		if (ret < 0 && errno != EAGAIN) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+/* One link, by name.  Returns -1 with errno set if it is not there. */
+int
+mc_netlink_link (mc_netlink_t *nl, const char *device, mc_link_t *link)
+{
+	mc_link_list_t   list;
+	struct ifinfomsg ifi;
+	char             name[IFNAMSIZ];
+	uint32_t         mask = RTEXT_FILTER_SKIP_STATS;
+	int              err;
+
+	strncpy (name, device, sizeof(name));
+	name[sizeof(name)-1] = '\0';
+
+	memset (&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	mc_netlink_begin (nl, RTM_GETLINK, 0, &ifi, sizeof(ifi));
+	mc_netlink_attr (nl, IFLA_IFNAME, name, strlen (name) + 1);
+	mc_netlink_attr (nl, IFLA_EXT_MASK, &mask, sizeof(mask));
+
+	memset (&list, 0, sizeof(list));
+	if (exchange (nl, &err, link_add, &list) < 0) {
+		free (list.links);
+		return -1;
+	}
+	if (err == 0 && list.len != 1) {
+		err = ENODEV;
+	}
+	if (err == 0) {
+		*link = list.links[0];
+	}
+
+	free (list.links);
+	errno = err;
+	return err ? -1 : 0;
+}
+
+
+static unsigned long
+usec_since (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000UL +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+/* A socket told of every link change (RTNLGRP_LINK), or -1 with
+ * errno set.  'nonblock' makes it a SOCK_NONBLOCK one.
+ */
+int
+mc_netlink_monitor (int nonblock)
+{
+	struct sockaddr_nl addr;
+	int                sock, err;
+
+	sock = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0),
+		       NETLINK_ROUTE);
+	if (sock < 0) {
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+	if (bind (sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = errno;
+		close (sock);
+		errno = err;
+		return -1;
+	}
+
+	return sock;
+}
+
+
+/* Adds the links every pending event of a monitor socket tells of,
+ * RTM_DELLINK ones marked 'removed', in the order they came.  Never
+ * blocks.  Returns -1 with errno set on failure; ENOBUFS means the
+ * kernel dropped events, so only a fresh dump tells what is there.
+ */
+int
+mc_netlink_events (int sock, mc_link_list_t *list)
+{
+	struct nlmsghdr *h;
+	char            *buf;
+	ssize_t          n;
+	int              len, err = 0;
+
+	buf = (char *) xmalloc (NL_RECV_SIZE);
+	for (;;) {
+		if ((n = recv (sock, buf, NL_RECV_SIZE, MSG_DONTWAIT)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				err = errno;
+			}
+			break;
+		}
+
+		len = n;
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, len); h = NLMSG_NEXT (h, len)) {
+			link_add (h, list);
+		}
+	}
+	free (buf);
+
+	errno = err;
+	return err ? -1 : 0;
+}
+
+
+/* Waits for the link to have been down, and then to be up with a
+ * carrier.  Returns 0 once it is, -1 on timeout.
+ */
+static int
+await_carrier (int sock, unsigned int index, int timeout_ms, const struct timespec *start)
+{
+	struct pollfd           pfd;
+	struct nlmsghdr        *h;
+	const struct ifinfomsg *ifi;
+	char                   *buf;
+	ssize_t                 n;
+	int                     len, was_down = 0, ret = -1;
+	int                     left;
+
+	pfd.fd     = sock;
+	pfd.events = POLLIN;
+	buf = (char *) xmalloc (NL_RECV_SIZE);
+
+	while (ret < 0 && (left = timeout_ms - (int) (usec_since (start) / 1000)) > 0) {
+		if (poll (&pfd, 1, left) <= 0) {
+			continue;
+		}
+		if ((n = recv (sock, buf, NL_RECV_SIZE, MSG_DONTWAIT)) <= 0) {
+			continue;
+		}
+
+		len = n;
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, len); h = NLMSG_NEXT (h, len)) {
+			ifi = NLMSG_DATA (h);
+			if (h->nlmsg_type != RTM_NEWLINK || (unsigned int) ifi->ifi_index != index) {
+				continue;
+			}
+			if (!(ifi->ifi_flags & IFF_UP)) {
+				was_down = 1;
+			} else if (was_down && (ifi->ifi_flags & IFF_LOWER_UP)) {
+				ret = 0;
+				break;
+			}
+		}
+	}
+
+	free (buf);
+	return ret;
+}
+
+
+/* Changes the address while the link is up if the driver allows it.
+ * Otherwise takes the link down, changes the address and brings it
+ * back up: three requests in one sendmsg(), so the link stays down
+ * only while the kernel works through them.  The link is brought back
+ * up even if the change fails.
+ *
+ * 'outage' tells whether the link was bounced, for how long it was
+ * down at most, and, for a link that had a carrier, how long the
+ * carrier took to return.  Returns -1 only if rtnetlink itself
+ * failed; a refused change is an error() and a non-zero 'errno_out'.
+ */
+int
+mc_netlink_set_mac_bounce (mc_netlink_t *nl, const char *device, const mac_t *mac,
+			   mc_outage_t *outage, int *errno_out)
+{
+	struct ifinfomsg ifi;
+	struct timespec  start;
+	mc_link_t        link;
+	const char      *why;
+	int              errors[3];
+	int              monitor = -1;
+
+	memset (outage, 0, sizeof(*outage));
+	*errno_out = 0;
+
+	if (mc_netlink_link (nl, device, &link) < 0) {
+		if (errno == ENODEV || errno == ENOENT) {
+			*errno_out = ENODEV;
+			error ("Could not change MAC of %s: %s", device, strerror (ENODEV));
+			return 0;
+		}
+		return -1;
+	}
+
+	memset (&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index  = link.index;
+
+	/* Live, if the driver takes it (IFF_LIVE_ADDR_CHANGE) */
+	mc_netlink_begin (nl, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+	mc_netlink_attr (nl, IFLA_ADDRESS, mac->byte, 6);
+	if (exchange (nl, errors, NULL, NULL) < 0) {
+		return -1;
+	}
+	if (errors[0] != EBUSY || !(link.flags & IFF_UP)) {
+		*errno_out = errors[0];
+		why = mc_netlink_message (nl, 0);
+		if (errors[0] != 0) {
+			error ("Could not change MAC of %s: %s%s%s", device, strerror (errors[0]),
+			       why ? ": " : "", why ? why : "");
+		}
+		return 0;
+	}
+
+	/* The driver wants the link down */
+	if (link.flags & IFF_LOWER_UP) {
+		monitor = mc_netlink_monitor (0);
+	}
+
+	ifi.ifi_change = IFF_UP;
+	ifi.ifi_flags  = 0;
+	mc_netlink_begin (nl, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+	ifi.ifi_change = 0;
+	mc_netlink_begin (nl, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+	mc_netlink_attr (nl, IFLA_ADDRESS, mac->byte, 6);
+	ifi.ifi_change = IFF_UP;
+	ifi.ifi_flags  = IFF_UP;
+	mc_netlink_begin (nl, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	if (exchange (nl, errors, NULL, NULL) < 0) {
+		if (monitor >= 0) {
+			close (monitor);
+		}
+		return -1;
+	}
+	outage->bounced   = 1;
+	outage->down_usec = usec_since (&start);
+
+	if (errors[2] != 0) {
+		*errno_out = errors[2];
+		error ("Could not bring %s back up: %s", device, strerror (errors[2]));
+	} else if (errors[1] != 0 || errors[0] != 0) {
+		*errno_out = errors[1] ? errors[1] : errors[0];
+		why = mc_netlink_message (nl, errors[1] ? 1 : 0);
+		error ("Could not change MAC of %s: %s%s%s", device, strerror (*errno_out),
+		       why ? ": " : "", why ? why : "");
+	}
+
+	if (monitor >= 0) {
+		if (errors[2] == 0 && await_carrier (monitor, link.index, MC_CARRIER_TIMEOUT, &start) == 0) {
+			outage->carrier      = 1;
+			outage->carrier_usec = usec_since (&start);
+		}
+		close (monitor);
+	}
+
+	return 0;
+}
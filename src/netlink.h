@@ -0,0 +1,99 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#ifndef __MAC_CHANGER_NETLINK_H__
+#define __MAC_CHANGER_NETLINK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mac.h"
+#include "netinfo.h"
+
+/* rtnetlink requests, sent in batches
+ *
+ * Messages are queued with mc_netlink_begin() and mc_netlink_attr()
+ * and go out together, in one sendmsg(), on mc_netlink_flush().  Each
+ * asks for an acknowledgement, and the flush waits for all of them.
+ */
+
+#define MC_NETLINK_BATCH  256    /* messages per flush, at most */
+
+/* A link, as a dump tells of it */
+typedef struct {
+	char          name[16];
+	unsigned int  index;
+	unsigned int  flags;        /* IFF_* */
+	mac_t         mac;
+	mac_t         permanent;
+	int           has_mac;      /* the address is an Ethernet one */
+	int           has_permanent;
+	int           removed;      /* an event of its removal */
+} mc_link_t;
+
+typedef struct {
+	mc_link_t *links;
+	size_t     len, size;
+	int        perm_known;
+} mc_link_list_t;
+
+#define MC_CARRIER_TIMEOUT  10000   /* ms */
+
+typedef struct nlmsghdr mc_netlink_msg_t;
+typedef void (*mc_netlink_cb_t) (const mc_netlink_msg_t *, void *arg);
+typedef void (*mc_netlink_mac_cb_t) (const mac_t *, void *arg);
+
+typedef struct {
+	int       sock;
+	uint32_t  seq;          /* of the first queued message */
+	char     *buf;
+	size_t    len, size;
+	size_t    last;         /* offset of the message being built */
+	size_t    count;
+	char    **messages;     /* extended ack text, per message */
+} mc_netlink_t;
+
+mc_netlink_t *mc_netlink_open  (void);
+void          mc_netlink_close (mc_netlink_t *);
+
+void        mc_netlink_begin   (mc_netlink_t *, int type, int flags,
+				const void *header, size_t len);
+void        mc_netlink_attr    (mc_netlink_t *, int type, const void *data, size_t len);
+int         mc_netlink_flush   (mc_netlink_t *, int *errors);
+const char *mc_netlink_message (const mc_netlink_t *, size_t i);
+
+int         mc_netlink_dump    (mc_netlink_t *, mc_netlink_cb_t, void *arg);
+
+int         mc_netlink_links    (mc_netlink_t *, mc_link_list_t *);
+int         mc_netlink_link     (mc_netlink_t *, const char *device, mc_link_t *);
+int         mc_netlink_neighbours (mc_netlink_t *, mc_netlink_mac_cb_t, void *arg);
+int         mc_netlink_monitor  (int nonblock);
+int         mc_netlink_events   (int sock, mc_link_list_t *);
+int         mc_netlink_set_mac_bounce (mc_netlink_t *, const char *device, const mac_t *,
+				       mc_outage_t *, int *errno_out);
+int         mc_netlink_set_macs (mc_netlink_t *, const char *const *devices,
+				 const mac_t *macs, int *errors, size_t n);
+
+#endif /* __MAC_CHANGER_NETLINK_H__ */
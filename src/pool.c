@@ -0,0 +1,497 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pool.h"
+#include "macdb.h"
+#include "common.h"
+
+#define POOL_PAGE        4096
+#define POOL_PAGE_WORDS  (POOL_PAGE / sizeof(uint64_t))
+
+/* The first page of the file, in host byte order */
+typedef struct {
+	char     magic[4];
+	uint32_t bom;
+	uint32_t version;
+	uint32_t prefix_bits;
+	uint8_t  prefix[8];     /* the first address of the range */
+	uint32_t checksum;      /* of the fields above */
+	uint32_t reserved;
+	uint64_t used;          /* addresses allocated */
+	uint64_t hint;          /* word the next scan starts from */
+} pool_header_t;
+
+struct mc_pool {
+	int             fd;
+	void           *map;
+	size_t          map_size;
+	pool_header_t  *hdr;
+	uint64_t       *words;
+	uint64_t        nwords;
+	uint64_t        size;     /* addresses in the range */
+	uint64_t        base;     /* the first one, as a number */
+	error_cleanup_t unlock;   /* while the file is locked */
+};
+
+
+static uint64_t
+mac_number (const mac_t *mac)
+{
+	uint64_t v = 0;
+	int      i;
+
+	for (i=0; i<6; i++) {
+		v = (v << 8) | mac->byte[i];
+	}
+	return v;
+}
+
+
+static void
+number_mac (uint64_t v, mac_t *mac)
+{
+	int i;
+
+	for (i=5; i>=0; i--, v >>= 8) {
+		mac->byte[i] = v & 0xFF;
+	}
+}
+
+
+static uint64_t
+range_size (unsigned int prefix_bits)
+{
+	return (uint64_t) 1 << (48 - prefix_bits);
+}
+
+
+/* Header page and bitmap, whole pages */
+static size_t
+file_size (unsigned int prefix_bits)
+{
+	uint64_t words = (range_size (prefix_bits) + 63) / 64;
+
+	return POOL_PAGE + ((words * sizeof(uint64_t) + POOL_PAGE - 1) & ~(uint64_t) (POOL_PAGE - 1));
+}
+
+
+static void
+header_fill (pool_header_t *hdr, const mac_t *prefix, unsigned int prefix_bits)
+{
+	uint64_t first;
+
+	first = mac_number (prefix) & ~(range_size (prefix_bits) - 1);
+
+	memset (hdr, 0, sizeof(*hdr));
+	memcpy (hdr->magic, MC_POOL_MAGIC, 4);
+	hdr->bom         = MC_POOL_BOM;
+	hdr->version     = MC_POOL_VERSION;
+	hdr->prefix_bits = prefix_bits;
+	number_mac (first, (mac_t *) hdr->prefix);
+	hdr->checksum    = mc_macdb_checksum (hdr, offsetof(pool_header_t, checksum));
+}
+
+
+static int
+header_valid (const pool_header_t *hdr, size_t size)
+{
+	return memcmp (hdr->magic, MC_POOL_MAGIC, 4) == 0 &&
+	       hdr->bom == MC_POOL_BOM &&
+	       hdr->checksum == mc_macdb_checksum (hdr, offsetof(pool_header_t, checksum)) &&
+	       hdr->version == MC_POOL_VERSION &&
+	       hdr->prefix_bits >= MC_POOL_MIN_PREFIX && hdr->prefix_bits <= MC_POOL_MAX_PREFIX &&
+	       size == file_size (hdr->prefix_bits);
+}
+
+
+/* Bits past the end of a range smaller than a word are never free */
+static uint64_t
+padding (uint64_t size)
+{
+	return (size < 64) ? ~(((uint64_t) 1 << size) - 1) : 0;
+}
+
+
+int
+mc_pool_create (const char *path, const mac_t *prefix, unsigned int prefix_bits)
+{
+	pool_header_t  hdr;
+	mc_pool_t     *pool;
+	uint64_t       pad;
+	char          *tmp_path;
+	int            fd, ret = 0;
+
+	if (prefix_bits < MC_POOL_MIN_PREFIX || prefix_bits > MC_POOL_MAX_PREFIX) {
+		error ("A pool prefix takes %d to %d bits", MC_POOL_MIN_PREFIX, MC_POOL_MAX_PREFIX);
+		return -1;
+	}
+	if (prefix->byte[0] & 1) {
+		error ("A pool can not hold multicast addresses");
+		return -1;
+	}
+	header_fill (&hdr, prefix, prefix_bits);
+
+	/* Already there? */
+	if ((pool = mc_pool_open (path)) != NULL) {
+		if (memcmp (pool->hdr->prefix, hdr.prefix, 6) != 0 ||
+		    pool->hdr->prefix_bits != prefix_bits) {
+			error ("%s holds another range", path);
+			ret = -1;
+		}
+		mc_pool_close (pool);
+		return ret;
+	}
+
+	/* Built aside and linked into place, so no one sees it half made,
+	 * and of two processes making it at once only one wins.
+	 */
+	tmp_path = xmalloc (strlen (path) + 32);
+	sprintf (tmp_path, "%s.%ld.tmp", path, (long) getpid ());
+
+	if ((fd = open (tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+		error ("Could not create %s: %s", tmp_path, strerror (errno));
+		free (tmp_path);
+		return -1;
+	}
+
+	pad = padding (range_size (prefix_bits));
+	if (pwrite (fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    pwrite (fd, &pad, sizeof(pad), POOL_PAGE) != sizeof(pad) ||
+	    ftruncate (fd, file_size (prefix_bits)) < 0 ||
+	    fsync (fd) < 0) {
+		error ("Could not write %s: %s", tmp_path, strerror (errno));
+		ret = -1;
+	} else if (link (tmp_path, path) < 0 && errno != EEXIST) {
+		error ("Could not create %s: %s", path, strerror (errno));
+		ret = -1;
+	}
+
+	close (fd);
+	unlink (tmp_path);
+	free (tmp_path);
+	if (ret < 0) {
+		return -1;
+	}
+
+	/* Someone else's, made meanwhile? */
+	return mc_pool_create (path, prefix, prefix_bits);
+}
+
+
+mc_pool_t *
+mc_pool_open (const char *path)
+{
+	mc_pool_t   *pool;
+	struct stat  sb;
+	void        *map;
+	int          fd;
+
+	if ((fd = open (path, O_RDWR | O_CLOEXEC)) < 0) {
+		error ("Could not open %s: %s", path, strerror (errno));
+		return NULL;
+	}
+	if (fstat (fd, &sb) < 0 || sb.st_size < POOL_PAGE) {
+		error ("%s is not a pool", path);
+		close (fd);
+		return NULL;
+	}
+
+	map = mmap (NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		error ("Could not map %s: %s", path, strerror (errno));
+		close (fd);
+		return NULL;
+	}
+	if (!header_valid (map, sb.st_size)) {
+		error ("%s is not a pool", path);
+		munmap (map, sb.st_size);
+		close (fd);
+		return NULL;
+	}
+
+	pool = (mc_pool_t *) xcalloc (1, sizeof(mc_pool_t));
+	pool->fd       = fd;
+	pool->map      = map;
+	pool->map_size = sb.st_size;
+	pool->hdr      = map;
+	pool->words    = (uint64_t *) ((char *) map + POOL_PAGE);
+	pool->size     = range_size (pool->hdr->prefix_bits);
+	pool->nwords   = (pool->size + 63) / 64;
+	pool->base     = mac_number ((const mac_t *) pool->hdr->prefix);
+	return pool;
+}
+
+
+void
+mc_pool_close (mc_pool_t *pool)
+{
+	if (pool == NULL) {
+		return;
+	}
+
+	munmap (pool->map, pool->map_size);
+	close (pool->fd);
+	free (pool);
+}
+
+
+/* Lets go of the file when an error jumps out with it locked */
+static void
+pool_unlock_fd (void *arg)
+{
+	flock (((mc_pool_t *) arg)->fd, LOCK_UN);
+}
+
+
+static int
+pool_lock (mc_pool_t *pool)
+{
+	if (flock (pool->fd, LOCK_EX) < 0) {
+		error ("Could not lock the pool: %s", strerror (errno));
+		return -1;
+	}
+	error_cleanup_push (&pool->unlock, pool_unlock_fd, pool);
+
+	/* Whatever a crash left in the counters is only a hint */
+	if (pool->hdr->hint >= pool->nwords) {
+		pool->hdr->hint = 0;
+	}
+	return 0;
+}
+
+
+static void
+pool_unlock (mc_pool_t *pool)
+{
+	error_cleanup_pop (&pool->unlock);
+	flock (pool->fd, LOCK_UN);
+}
+
+
+/* Writes out the header and the bitmap words 'lo' to 'hi' */
+static int
+pool_sync (mc_pool_t *pool, uint64_t lo, uint64_t hi)
+{
+	size_t start, end;
+
+	start = (POOL_PAGE + lo * sizeof(uint64_t)) & ~(size_t) (POOL_PAGE - 1);
+	end   = POOL_PAGE + (hi + 1) * sizeof(uint64_t);
+
+	if (msync ((char *) pool->map + start, end - start, MS_SYNC) < 0 ||
+	    msync (pool->map, POOL_PAGE, MS_SYNC) < 0) {
+		error ("Could not write the pool: %s", strerror (errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Clears the bits of the 'n' first of 'macs', all of them allocated */
+static void
+pool_clear (mc_pool_t *pool, const mac_t *macs, size_t n)
+{
+	uint64_t i;
+	size_t   j;
+
+	for (j=0; j<n; j++) {
+		i = mac_number (&macs[j]) - pool->base;
+		pool->words[i / 64] &= ~((uint64_t) 1 << (i % 64));
+	}
+}
+
+
+int
+mc_pool_alloc (mc_pool_t *pool, mac_t *macs, size_t n)
+{
+	uint64_t  w, word, lo, hi, scanned = 0;
+	size_t    got = 0;
+	int       b, ret;
+
+	if (pool_lock (pool) < 0) {
+		return -1;
+	}
+	if (n > pool->size - pool->hdr->used) {
+		error ("Only %llu addresses are left in the pool",
+		       (unsigned long long) (pool->size - pool->hdr->used));
+		pool_unlock (pool);
+		return -1;
+	}
+
+	w  = pool->hdr->hint;
+	lo = hi = w;
+	while (got < n) {
+		/* A full word in one test, the first clear bit in one more */
+		for (word = pool->words[w]; ~word != 0 && got < n; ) {
+			b = __builtin_ctzll (~word);
+			word |= (uint64_t) 1 << b;
+			number_mac (pool->base + w * 64 + b, &macs[got++]);
+		}
+		if (word != pool->words[w]) {
+			pool->words[w] = word;
+			lo = (w < lo) ? w : lo;
+			hi = (w > hi) ? w : hi;
+		}
+		if (got < n) {
+			w = (w + 1 == pool->nwords) ? 0 : w + 1;
+			if (++scanned > pool->nwords) {
+				/* The count was wrong */
+				pool_clear (pool, macs, got);
+				error ("The pool has fewer free addresses than it says; compact it");
+				pool_unlock (pool);
+				return -1;
+			}
+		}
+	}
+
+	pool->hdr->hint  = w;
+	pool->hdr->used += n;
+	ret = pool_sync (pool, lo, hi);
+	pool_unlock (pool);
+	return ret;
+}
+
+
+int
+mc_pool_release (mc_pool_t *pool, const mac_t *macs, size_t n)
+{
+	uint64_t i, bit, lo = pool->nwords, hi = 0;
+	size_t   j;
+	char     text[18];
+	int      ret;
+
+	if (pool_lock (pool) < 0) {
+		return -1;
+	}
+
+	for (j=0; j<n; j++) {
+		i   = mac_number (&macs[j]) - pool->base;
+		bit = (uint64_t) 1 << (i % 64);
+		if (i >= pool->size || !(pool->words[i / 64] & bit)) {
+			mc_mac_into_string (&macs[j], text);
+			if (i >= pool->size) {
+				error ("%s is not in the pool", text);
+			} else {
+				error ("%s is not allocated", text);
+			}
+			/* Put back the ones cleared so far */
+			for (; j-- > 0; ) {
+				i = mac_number (&macs[j]) - pool->base;
+				pool->words[i / 64] |= (uint64_t) 1 << (i % 64);
+			}
+			pool_unlock (pool);
+			return -1;
+		}
+
+		pool->words[i / 64] &= ~bit;
+		lo = (i / 64 < lo) ? i / 64 : lo;
+		hi = (i / 64 > hi) ? i / 64 : hi;
+	}
+
+	/* The lowest free addresses go first */
+	pool->hdr->used -= n;
+	if (n > 0 && lo < pool->hdr->hint) {
+		pool->hdr->hint = lo;
+	}
+	ret = (n > 0) ? pool_sync (pool, lo, hi) : 0;
+	pool_unlock (pool);
+	return ret;
+}
+
+
+int
+mc_pool_compact (mc_pool_t *pool)
+{
+	uint64_t w, k, used = 0, first = pool->nwords, page_used;
+	uint64_t pad = padding (pool->size);
+	int      ret;
+
+	if (pool_lock (pool) < 0) {
+		return -1;
+	}
+
+	for (w=0; w<pool->nwords; w++) {
+		used += __builtin_popcountll (pool->words[w] & ~pad);
+		if (first == pool->nwords && ~pool->words[w] != 0) {
+			first = w;
+		}
+	}
+	pool->hdr->used = used;
+	pool->hdr->hint = (first < pool->nwords) ? first : 0;
+
+	/* Pages with no address allocated need no disk.  A range smaller
+	 * than a word has its padding bits set, and keeps its one page.
+	 */
+	for (w=0; w<pool->nwords && pad == 0; w+=POOL_PAGE_WORDS) {
+		page_used = 0;
+		for (k=w; k<w+POOL_PAGE_WORDS && k<pool->nwords; k++) {
+			page_used |= pool->words[k];
+		}
+		if (page_used == 0 &&
+		    fallocate (pool->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			       POOL_PAGE + w * sizeof(uint64_t), POOL_PAGE) < 0 &&
+		    errno != EOPNOTSUPP) {
+			error ("Could not compact the pool: %s", strerror (errno));
+			pool_unlock (pool);
+			return -1;
+		}
+	}
+
+	ret = pool_sync (pool, 0, 0);
+	pool_unlock (pool);
+	return ret;
+}
+
+
+int
+mc_pool_stats (mc_pool_t *pool, mac_t *prefix, unsigned int *prefix_bits,
+	       uint64_t *used, uint64_t *size)
+{
+	if (pool_lock (pool) < 0) {
+		return -1;
+	}
+
+	memcpy (prefix->byte, pool->hdr->prefix, 6);
+	*prefix_bits = pool->hdr->prefix_bits;
+	*used        = pool->hdr->used;
+	*size        = pool->size;
+
+	pool_unlock (pool);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef __MAC_CHANGER_POOL_H__
+#define __MAC_CHANGER_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mac.h"
+
+/* Pools of addresses with a common prefix
+ *
+ * A pool owns every address after a prefix of 20 to 47 bits, a vendor
+ * OUI and a 24-bit suffix for instance.  Its file is a header page and
+ * a bitmap, one bit per address, mapped shared: allocating scans for
+ * clear bits a 64-bit word at a time, from the word where the previous
+ * allocation stopped.  Every process takes flock() on the file around
+ * each operation, and the pages it dirtied are on disk before it
+ * returns, so no address is ever handed out twice.
+ */
+
+#define MC_POOL_MAGIC       "MCPL"
+#define MC_POOL_BOM         0x01020304
+#define MC_POOL_VERSION     1
+#define MC_POOL_MIN_PREFIX  20
+#define MC_POOL_MAX_PREFIX  47
+
+typedef struct mc_pool mc_pool_t;
+
+/* Makes the pool file, or checks that the one there owns the same range */
+int        mc_pool_create  (const char *path, const mac_t *prefix, unsigned int prefix_bits);
+
+mc_pool_t *mc_pool_open    (const char *path);
+void       mc_pool_close   (mc_pool_t *);
+
+/* 'n' addresses, or none if there are not that many left */
+int        mc_pool_alloc   (mc_pool_t *, mac_t *macs, size_t n);
+
+/* Gives 'n' addresses back; all of them, or none if any is not allocated */
+int        mc_pool_release (mc_pool_t *, const mac_t *macs, size_t n);
+
+/* Recounts the allocated addresses, starts the next scan at the first
+ * free one, and returns the disk space of free bitmap pages.
+ */
+int        mc_pool_compact (mc_pool_t *);
+
+int        mc_pool_stats   (mc_pool_t *, mac_t *prefix, unsigned int *prefix_bits,
+			    uint64_t *used, uint64_t *size);
+
+#endif /* __MAC_CHANGER_POOL_H__ */
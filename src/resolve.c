@@ -0,0 +1,259 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* Batch vendor resolution
+ *
+ * Reads text (one address per line, or log lines with an address
+ * somewhere in them) and writes every address found annotated with
+ * its vendor.  Input and output go through large fixed buffers: no
+ * allocation and no syscall per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "resolve.h"
+#include "maclist.h"
+#include "mac.h"
+#include "common.h"
+
+#define IN_BUF_SIZE   (1024 * 1024)
+#define OUT_BUF_SIZE  (256 * 1024)
+#define MAX_OUT_LINE  512
+#define BATCH         256
+
+typedef struct {
+	int    fd;
+	size_t len;
+	int    failed;
+	char   data[OUT_BUF_SIZE];
+} out_buf_t;
+
+
+static void
+out_flush (out_buf_t *out)
+{
+	size_t  done = 0;
+	ssize_t n;
+
+	while (done < out->len && !out->failed) {
+		n = write (out->fd, out->data + done, out->len - done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			out->failed = 1;
+			break;
+		}
+		done += n;
+	}
+	out->len = 0;
+}
+
+
+static void
+out_add (out_buf_t *out, const char *str, size_t len)
+{
+	if (len > MAX_OUT_LINE) {
+		len = MAX_OUT_LINE;
+	}
+	if (out->len + len > sizeof(out->data)) {
+		out_flush (out);
+	}
+	memcpy (out->data + out->len, str, len);
+	out->len += len;
+}
+
+
+/* Characters an address can be written with */
+static const unsigned char mac_chars[256] = {
+	['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1,
+	['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+	['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1,
+	['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1,
+	[':'] = 1, ['-'] = 1, ['.'] = 1
+};
+
+static inline int
+is_mac_char (char c)
+{
+	return mac_chars[(unsigned char) c];
+}
+
+
+/* Finds the first address in a line, in any notation the parser
+ * knows.  The address must make up a whole token, so longer hex
+ * strings are not taken for addresses.
+ */
+static int
+find_mac (const char *line, size_t len, mac_t *mac)
+{
+	size_t start = 0, end, tok_end;
+
+	while (start < len) {
+		if (!is_mac_char (line[start])) {
+			start++;
+			continue;
+		}
+
+		end = start;
+		while (end < len && is_mac_char (line[end])) {
+			end++;
+		}
+
+		/* The token may end a sentence */
+		tok_end = end;
+		if (line[tok_end-1] == '.') {
+			tok_end--;
+		}
+
+		if (tok_end - start >= 12 && tok_end - start <= 17 &&
+		    mc_mac_parse_any (mac, line + start, tok_end - start, NULL) == 0) {
+			return 0;
+		}
+		start = end;
+	}
+
+	return -1;
+}
+
+
+static void
+resolve_mac (out_buf_t *out, const mac_t *mac)
+{
+	char        string[18];
+	const char *name;
+	int         is_wireless;
+
+	name = mc_maclist_lookup (mac, &is_wireless);
+	mc_mac_into_string (mac, string);
+
+	out_add (out, string, 17);
+	if (is_wireless) {
+		out_add (out, " [wireless]", 11);
+	}
+	out_add (out, " (", 2);
+	name = name ? name : "unknown";
+	out_add (out, name, strlen (name));
+	out_add (out, ")\n", 2);
+}
+
+
+static void
+resolve_line (out_buf_t *out, const char *line, size_t len)
+{
+	mac_t mac;
+
+	if (find_mac (line, len, &mac) == 0) {
+		resolve_mac (out, &mac);
+	}
+}
+
+
+/* Resolves every address read from 'in_fd' into 'out_fd'.  Returns
+ * 0, or -1 on a read or write error.
+ */
+int
+mc_resolve_stream (int in_fd, int out_fd)
+{
+	char      *in;
+	out_buf_t *out;
+	char      *start, *end, *nl;
+	mac_t      batch[BATCH];
+	size_t     have = 0, n, i;
+	ssize_t    nread;
+	int        ret = 0;
+
+	in  = (char *) xmalloc (IN_BUF_SIZE);
+	out = (out_buf_t *) xmalloc (sizeof(out_buf_t));
+	out->fd     = out_fd;
+	out->len    = 0;
+	out->failed = 0;
+
+	for (;;) {
+		nread = read (in_fd, in + have, IN_BUF_SIZE - have);
+		if (nread < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error ("Could not read input: %s", strerror (errno));
+			ret = -1;
+			break;
+		}
+
+		have += nread;
+		end   = in + have;
+		start = in;
+
+		while (start < end) {
+			/* Plain address lists take the bulk parser */
+			n = (end - start) / MC_MAC_LINE_LEN;
+			n = mc_mac_parse_lines (batch, start, n < BATCH ? n : BATCH);
+			for (i=0; i<n; i++) {
+				resolve_mac (out, &batch[i]);
+			}
+			start += n * MC_MAC_LINE_LEN;
+			if (n == BATCH) {
+				continue;
+			}
+
+			if ((nl = memchr (start, '\n', end - start)) == NULL) {
+				break;
+			}
+			resolve_line (out, start, nl - start);
+			start = nl + 1;
+		}
+
+		/* EOF: the last line may lack its newline */
+		if (nread == 0) {
+			resolve_line (out, start, end - start);
+			break;
+		}
+
+		/* Keep the partial line; overlong lines are dropped */
+		have = end - start;
+		if (have == IN_BUF_SIZE) {
+			have = 0;
+		}
+		memmove (in, start, have);
+
+		if (out->failed) {
+			break;
+		}
+	}
+
+	out_flush (out);
+	if (out->failed) {
+		error ("Could not write output: %s", strerror (errno));
+		ret = -1;
+	}
+
+	free (in);
+	free (out);
+	return ret;
+}
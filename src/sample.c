@@ -0,0 +1,181 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* Unbiased sampling
+ *
+ * A bounded integer is taken from the high half of a 32x32-bit
+ * product (Lemire's method); the rare low halves that would bias it
+ * are rejected and redrawn.  An alias table sample spends one 64-bit
+ * draw: 32 bits pick the column and 32 bits toss its coin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "sample.h"
+#include "common.h"
+
+#define SAMPLE_ONE  ((uint64_t) 1 << 32)
+
+
+static uint64_t
+sample_draw (void)
+{
+	uint64_t draw;
+
+	if (strong_random_get ((unsigned char *) &draw, sizeof(draw)) != 0) {
+		fatal ("Failed to get random data.");
+	}
+	return draw;
+}
+
+
+/* Maps the 32-bit 'bits' onto [0, range).  Returns 0 when 'bits' falls
+ * in the biased zone and must be redrawn.
+ */
+static inline int
+sample_bounded (uint32_t bits, uint32_t range, uint32_t *out)
+{
+	uint64_t product = (uint64_t) bits * range;
+	uint32_t low     = (uint32_t) product;
+
+	if (low < range && low < (uint32_t) -range % range) {
+		return 0;
+	}
+
+	*out = product >> 32;
+	return 1;
+}
+
+
+/* Uniform in [0, range) */
+uint32_t
+mc_sample_uniform (uint32_t range)
+{
+	uint64_t draw;
+	uint32_t out;
+
+	for (;;) {
+		draw = sample_draw ();
+		if (sample_bounded (draw, range, &out) ||
+		    sample_bounded (draw >> 32, range, &out)) {
+			return out;
+		}
+	}
+}
+
+
+/* Vose's construction.  Returns -1 if no outcome has any weight. */
+int
+mc_alias_build (mc_alias_t *table, const double *weights, uint32_t len)
+{
+	double   *scaled;
+	uint32_t *small, *large;
+	uint32_t  nsmall = 0, nlarge = 0, i, s, l;
+	double    total = 0;
+
+	for (i=0; i<len; i++) {
+		total += weights[i];
+	}
+	if (len == 0 || !(total > 0)) {
+		return -1;
+	}
+
+	table->len   = len;
+	table->prob  = (uint64_t *) xmalloc (sizeof(uint64_t) * len);
+	table->alias = (uint32_t *) xmalloc (sizeof(uint32_t) * len);
+
+	scaled = (double *) xmalloc (sizeof(double) * len);
+	small  = (uint32_t *) xmalloc (sizeof(uint32_t) * len);
+	large  = (uint32_t *) xmalloc (sizeof(uint32_t) * len);
+
+	for (i=0; i<len; i++) {
+		scaled[i] = weights[i] * len / total;
+		if (scaled[i] < 1.0) {
+			small[nsmall++] = i;
+		} else {
+			large[nlarge++] = i;
+		}
+	}
+
+	/* Top every short column up with a piece of a tall one */
+	while (nsmall > 0 && nlarge > 0) {
+		s = small[--nsmall];
+		l = large[--nlarge];
+
+		table->prob[s]  = (uint64_t) (scaled[s] * SAMPLE_ONE + 0.5);
+		table->alias[s] = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			small[nsmall++] = l;
+		} else {
+			large[nlarge++] = l;
+		}
+	}
+
+	/* What is left is full, up to rounding */
+	while (nlarge > 0) {
+		l = large[--nlarge];
+		table->prob[l]  = SAMPLE_ONE;
+		table->alias[l] = l;
+	}
+	while (nsmall > 0) {
+		s = small[--nsmall];
+		table->prob[s]  = SAMPLE_ONE;
+		table->alias[s] = s;
+	}
+
+	free (scaled);
+	free (small);
+	free (large);
+	return 0;
+}
+
+
+uint32_t
+mc_alias_sample (const mc_alias_t *table)
+{
+	uint64_t draw;
+	uint32_t column;
+
+	do {
+		draw = sample_draw ();
+	} while (!sample_bounded (draw, table->len, &column));
+
+	return ((draw >> 32) < table->prob[column]) ? column : table->alias[column];
+}
+
+
+void
+mc_alias_free (mc_alias_t *table)
+{
+	free (table->prob);
+	free (table->alias);
+	table->prob  = NULL;
+	table->alias = NULL;
+	table->len   = 0;
+}
@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef __MAC_CHANGER_SAMPLE_H__
+#define __MAC_CHANGER_SAMPLE_H__
+
+#include <stdint.h>
+
+/* Walker/Vose alias table: outcome i is drawn with probability
+ * weight[i] / sum(weight) in constant time.
+ */
+typedef struct {
+	uint64_t *prob;    /* keep the column if a 32-bit draw is below this */
+	uint32_t *alias;   /* outcome taken otherwise */
+	uint32_t  len;
+} mc_alias_t;
+
+uint32_t mc_sample_uniform (uint32_t range);
+
+int      mc_alias_build    (mc_alias_t *table, const double *weights, uint32_t len);
+uint32_t mc_alias_sample   (const mc_alias_t *table);
+void     mc_alias_free     (mc_alias_t *table);
+
+#endif /* __MAC_CHANGER_SAMPLE_H__ */
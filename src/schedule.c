@@ -0,0 +1,354 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "schedule.h"
+
+#define CRON_SEARCH_YEARS  5   /* give up on "30 of February" */
+
+
+/* "90", "90s", "15m", "2h" or "1d", in seconds */
+static int
+parse_duration (const char *text, unsigned long *seconds)
+{
+	unsigned long  n;
+	char          *end;
+
+	n = strtoul (text, &end, 10);
+	if (end == text) {
+		return -1;
+	}
+
+	switch (*end) {
+	case '\0':
+	case 's': break;
+	case 'm': n *= 60; break;
+	case 'h': n *= 3600; break;
+	case 'd': n *= 86400; break;
+	default:  return -1;
+	}
+	if (*end != '\0' && end[1] != '\0') {
+		return -1;
+	}
+
+	*seconds = n;
+	return 0;
+}
+
+
+/* One crontab field: '*', 'N', 'N-M', any of them followed by '/STEP',
+ * and lists of them separated by commas.  Sets the bit of every value
+ * from 'min' to 'max' it allows.
+ */
+static int
+parse_field (const char *text, int min, int max, uint64_t *bits, int *any)
+{
+	const char *p = text;
+	char       *end;
+	long        lo, hi, step;
+
+	*bits = 0;
+	*any  = (strcmp (text, "*") == 0);
+
+	for (;;) {
+		if (*p == '*') {
+			lo = min;
+			hi = max;
+			p++;
+		} else {
+			lo = strtol (p, &end, 10);
+			if (end == p) {
+				return -1;
+			}
+			hi = lo;
+			p  = end;
+			if (*p == '-') {
+				hi = strtol (p + 1, &end, 10);
+				if (end == p + 1) {
+					return -1;
+				}
+				p = end;
+			}
+		}
+
+		step = 1;
+		if (*p == '/') {
+			step = strtol (p + 1, &end, 10);
+			if (end == p + 1 || step < 1) {
+				return -1;
+			}
+			p = end;
+		}
+
+		if (lo < min || hi > max || lo > hi) {
+			return -1;
+		}
+		for (; lo <= hi; lo += step) {
+			*bits |= (uint64_t) 1 << lo;
+		}
+
+		if (*p == '\0') {
+			return 0;
+		}
+		if (*p++ != ',') {
+			return -1;
+		}
+	}
+}
+
+
+int
+mcd_schedule_parse (mcd_schedule_t *s, char **argv, int argc, char *err, size_t size)
+{
+	static const char *const names[5] = { "minute", "hour", "day", "month", "weekday" };
+	static const int         limits[5][2] = { {0, 59}, {0, 23}, {1, 31}, {1, 12}, {0, 7} };
+	uint64_t                 bits[5];
+	int                      any[5];
+	int                      i;
+
+	memset (s, 0, sizeof(*s));
+
+	if (argc >= 2 && strcmp (argv[0], "every") == 0) {
+		s->kind = MCD_EVERY;
+		if (parse_duration (argv[1], &s->every) < 0 || s->every == 0) {
+			snprintf (err, size, "Wrong interval: %s", argv[1]);
+			return -1;
+		}
+		if (argc >= 4 && strcmp (argv[2], "jitter") == 0) {
+			if (parse_duration (argv[3], &s->jitter) < 0) {
+				snprintf (err, size, "Wrong jitter: %s", argv[3]);
+				return -1;
+			}
+			return 4;
+		}
+		return 2;
+	}
+
+	if (argc >= 6 && strcmp (argv[0], "cron") == 0) {
+		s->kind = MCD_CRON;
+		for (i=0; i<5; i++) {
+			if (parse_field (argv[i+1], limits[i][0], limits[i][1], &bits[i], &any[i]) < 0) {
+				snprintf (err, size, "Wrong %s: %s", names[i], argv[i+1]);
+				return -1;
+			}
+		}
+		s->minutes  = bits[0];
+		s->hours    = bits[1];
+		s->mdays    = bits[2];
+		s->months   = bits[3];
+		s->wdays    = (bits[4] | (bits[4] >> 7)) & 0x7f;  /* 7 is Sunday too */
+		s->mday_any = any[2];
+		s->wday_any = any[4];
+		return 6;
+	}
+
+	snprintf (err, size, "Expected 'every INTERVAL' or 'cron MIN HOUR DAY MONTH WEEKDAY'");
+	return -1;
+}
+
+
+/* As cron has it: if both the day of the month and the day of the week
+ * are restricted, either one will do.
+ */
+static int
+cron_day (const mcd_schedule_t *s, const struct tm *tm)
+{
+	int mday = (s->mdays >> tm->tm_mday) & 1;
+	int wday = (s->wdays >> tm->tm_wday) & 1;
+
+	if (!s->mday_any && !s->wday_any) {
+		return mday || wday;
+	}
+	return mday && wday;
+}
+
+
+static int64_t
+cron_next (const mcd_schedule_t *s, time_t after)
+{
+	struct tm tm;
+	time_t    t;
+	int       year;
+
+	t = after - (after % 60) + 60;
+	localtime_r (&t, &tm);
+	year = tm.tm_year;
+
+	/* Skip whole months, days and hours that cannot match */
+	while (tm.tm_year - year <= CRON_SEARCH_YEARS) {
+		if (!((s->months >> (tm.tm_mon + 1)) & 1)) {
+			tm.tm_mon++;
+			tm.tm_mday = 1;
+			tm.tm_hour = tm.tm_min = 0;
+		} else if (!cron_day (s, &tm)) {
+			tm.tm_mday++;
+			tm.tm_hour = tm.tm_min = 0;
+		} else if (!((s->hours >> tm.tm_hour) & 1)) {
+			tm.tm_hour++;
+			tm.tm_min = 0;
+		} else if (!((s->minutes >> tm.tm_min) & 1)) {
+			tm.tm_min++;
+		} else {
+			return (int64_t) mktime (&tm) * 1000;
+		}
+
+		tm.tm_sec   = 0;
+		tm.tm_isdst = -1;
+		if ((t = mktime (&tm)) == (time_t) -1) {
+			break;
+		}
+		localtime_r (&t, &tm);
+	}
+
+	return -1;
+}
+
+
+int64_t
+mcd_schedule_next (const mcd_schedule_t *s, int64_t after, unsigned long r)
+{
+	int64_t next;
+
+	if (s->kind == MCD_CRON) {
+		return cron_next (s, (time_t) (after / 1000));
+	}
+
+	next = after + (int64_t) s->every * 1000;
+	if (s->jitter > 0) {
+		next += r % ((uint64_t) s->jitter * 1000 + 1);
+	}
+	return next;
+}
+
+
+/* Timer heap
+ */
+
+static void
+heap_set (mcd_timer_heap_t *h, size_t pos, mcd_timer_t *t)
+{
+	h->timers[pos] = t;
+	t->pos = pos;
+}
+
+
+static void
+sift_up (mcd_timer_heap_t *h, size_t pos)
+{
+	mcd_timer_t *t = h->timers[pos];
+	size_t       parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (h->timers[parent]->due <= t->due) {
+			break;
+		}
+		heap_set (h, pos, h->timers[parent]);
+		pos = parent;
+	}
+	heap_set (h, pos, t);
+}
+
+
+static void
+sift_down (mcd_timer_heap_t *h, size_t pos)
+{
+	mcd_timer_t *t = h->timers[pos];
+	size_t       child;
+
+	while ((child = 2 * pos + 1) < h->len) {
+		if (child + 1 < h->len && h->timers[child + 1]->due < h->timers[child]->due) {
+			child++;
+		}
+		if (t->due <= h->timers[child]->due) {
+			break;
+		}
+		heap_set (h, pos, h->timers[child]);
+		pos = child;
+	}
+	heap_set (h, pos, t);
+}
+
+
+int
+mcd_timer_add (mcd_timer_heap_t *h, mcd_timer_t *t)
+{
+	mcd_timer_t **timers;
+	size_t        size;
+
+	if (h->len == h->size) {
+		size = h->size ? 2 * h->size : 16;
+		if ((timers = realloc (h->timers, size * sizeof(mcd_timer_t *))) == NULL) {
+			return -1;
+		}
+		h->timers = timers;
+		h->size   = size;
+	}
+
+	h->timers[h->len] = t;
+	sift_up (h, h->len++);
+	return 0;
+}
+
+
+mcd_timer_t *
+mcd_timer_first (const mcd_timer_heap_t *h)
+{
+	return h->len ? h->timers[0] : NULL;
+}
+
+
+/* Puts 't' back in order after its deadline changed */
+void
+mcd_timer_update (mcd_timer_heap_t *h, mcd_timer_t *t)
+{
+	sift_up (h, t->pos);
+	sift_down (h, t->pos);
+}
+
+
+/* Restores the order after any number of deadlines changed */
+void
+mcd_timer_reorder (mcd_timer_heap_t *h)
+{
+	size_t i;
+
+	for (i = h->len / 2; i-- > 0; ) {
+		sift_down (h, i);
+	}
+}
+
+
+void
+mcd_timer_free (mcd_timer_heap_t *h)
+{
+	free (h->timers);
+	h->timers = NULL;
+	h->len = h->size = 0;
+}
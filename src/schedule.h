@@ -0,0 +1,89 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#ifndef __MAC_CHANGER_SCHEDULE_H__
+#define __MAC_CHANGER_SCHEDULE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* When macchangerd rotates addresses
+ *
+ * A schedule is either a fixed interval, optionally stretched by a
+ * random jitter, or a set of wall clock times in the crontab(5)
+ * notation.  Timers waiting on schedules are kept in a binary heap
+ * ordered by their deadline, so the daemon needs a single timerfd
+ * armed for the earliest of them, however many there are.
+ */
+
+typedef enum {
+	MCD_EVERY,
+	MCD_CRON
+} mcd_schedule_kind_t;
+
+typedef struct {
+	mcd_schedule_kind_t kind;
+	unsigned long       every;      /* seconds */
+	unsigned long       jitter;     /* seconds, added at random */
+	uint64_t            minutes;    /* one bit per allowed value */
+	uint32_t            hours;
+	uint32_t            mdays;      /* bit 1 is the first day */
+	uint16_t            months;     /* bit 1 is January */
+	uint8_t             wdays;      /* bit 0 is Sunday */
+	int                 mday_any;
+	int                 wday_any;
+} mcd_schedule_t;
+
+/* Parses 'argv', either "every DURATION [jitter DURATION]" or "cron
+ * MINUTE HOUR DAY MONTH WEEKDAY".  Returns the number of words used,
+ * or -1 with a message in 'err'.
+ */
+int    mcd_schedule_parse (mcd_schedule_t *, char **argv, int argc, char *err, size_t size);
+
+/* The first time the schedule falls on after 'after', in milliseconds
+ * since the epoch.  'r' is a random number for the jitter.
+ */
+int64_t mcd_schedule_next (const mcd_schedule_t *, int64_t after, unsigned long r);
+
+/* Timers, embedded in whatever they time */
+typedef struct {
+	int64_t due;   /* milliseconds since the epoch */
+	size_t  pos;   /* in the heap */
+} mcd_timer_t;
+
+typedef struct {
+	mcd_timer_t **timers;
+	size_t        len, size;
+} mcd_timer_heap_t;
+
+int          mcd_timer_add    (mcd_timer_heap_t *, mcd_timer_t *);
+mcd_timer_t *mcd_timer_first  (const mcd_timer_heap_t *);
+void         mcd_timer_update (mcd_timer_heap_t *, mcd_timer_t *);
+void         mcd_timer_reorder (mcd_timer_heap_t *);
+void         mcd_timer_free   (mcd_timer_heap_t *);
+
+#endif /* __MAC_CHANGER_SCHEDULE_H__ */
@@ -0,0 +1,356 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* Case-insensitive vendor search
+ *
+ * Every lower-cased vendor name is split into its trigrams.  A query
+ * intersects the postings of the trigrams of all its keywords, and
+ * only the few surviving rows are compared against the keywords.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+#include "common.h"
+
+typedef struct {
+	uint32_t trigram;
+	uint32_t row;
+} search_pair_t;
+
+
+static inline unsigned char
+fold (unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+
+static inline uint32_t
+trigram (const char *s)
+{
+	return ((uint32_t) fold (s[0]) << 16) |
+	       ((uint32_t) fold (s[1]) << 8)  |
+	       fold (s[2]);
+}
+
+
+static const char *
+row_name (const mc_macdb_t *db, uint32_t row)
+{
+	if (row < db->others.len) {
+		return db->strings + db->others.names[row];
+	}
+	return db->strings + db->wireless.names[row - db->others.len];
+}
+
+
+/* Sorts and deduplicates a short array in place */
+static size_t
+unique_trigrams (uint32_t *tri, size_t len)
+{
+	size_t   i, j, out;
+	uint32_t cur;
+
+	for (i=1; i<len; i++) {
+		cur = tri[i];
+		for (j=i; j>0 && tri[j-1] > cur; j--) {
+			tri[j] = tri[j-1];
+		}
+		tri[j] = cur;
+	}
+
+	for (i=0, out=0; i<len; i++) {
+		if (out == 0 || tri[out-1] != tri[i]) {
+			tri[out++] = tri[i];
+		}
+	}
+
+	return out;
+}
+
+
+/* Stable LSD radix sort of the pairs on their 24-bit trigram, which
+ * leaves the rows of each trigram in ascending order.
+ */
+static void
+pairs_sort (search_pair_t *pairs, size_t num)
+{
+	search_pair_t *tmp, *src, *dst, *swap;
+	size_t         count[256];
+	size_t         i, pos, c;
+	unsigned       shift;
+
+	tmp = (search_pair_t *) xmalloc (sizeof(search_pair_t) * (num+1));
+	src = pairs;
+	dst = tmp;
+
+	for (shift=0; shift<24; shift+=8) {
+		memset (count, 0, sizeof(count));
+		for (i=0; i<num; i++) {
+			count[(src[i].trigram >> shift) & 0xFF]++;
+		}
+		for (i=0, pos=0; i<256; i++) {
+			c = count[i];
+			count[i] = pos;
+			pos += c;
+		}
+		for (i=0; i<num; i++) {
+			dst[count[(src[i].trigram >> shift) & 0xFF]++] = src[i];
+		}
+		swap = src; src = dst; dst = swap;
+	}
+
+	if (src != pairs) {
+		memcpy (pairs, src, sizeof(search_pair_t) * num);
+	}
+	free (tmp);
+}
+
+
+void
+mc_search_build (mc_macdb_t *db)
+{
+	search_pair_t *pairs = NULL;
+	size_t         npairs = 0, size = 0;
+	uint32_t       tri[512];
+	uint32_t      *keys, *offsets, *postings;
+	uint32_t       row, rows, nkeys;
+	size_t         i, len, ntri;
+	const char    *name;
+
+	rows = db->others.len + db->wireless.len;
+
+	for (row=0; row<rows; row++) {
+		name = row_name (db, row);
+		len  = strlen (name);
+
+		ntri = 0;
+		for (i=0; i+3<=len && ntri<sizeof(tri)/sizeof(tri[0]); i++) {
+			tri[ntri++] = trigram (name + i);
+		}
+		ntri = unique_trigrams (tri, ntri);
+
+		if (npairs + ntri > size) {
+			while (npairs + ntri > size) {
+				size = size ? size * 2 : 64 * 1024;
+			}
+			pairs = (search_pair_t *) xrealloc (pairs, sizeof(search_pair_t) * size);
+		}
+
+		for (i=0; i<ntri; i++) {
+			pairs[npairs].trigram = tri[i];
+			pairs[npairs].row     = row;
+			npairs++;
+		}
+	}
+
+	pairs_sort (pairs, npairs);
+
+	keys     = (uint32_t *) xmalloc (sizeof(uint32_t) * (npairs+1));
+	offsets  = (uint32_t *) xmalloc (sizeof(uint32_t) * (npairs+2));
+	postings = (uint32_t *) xmalloc (sizeof(uint32_t) * (npairs+1));
+
+	nkeys = 0;
+	for (i=0; i<npairs; i++) {
+		if (nkeys == 0 || keys[nkeys-1] != pairs[i].trigram) {
+			keys[nkeys]    = pairs[i].trigram;
+			offsets[nkeys] = i;
+			nkeys++;
+		}
+		postings[i] = pairs[i].row;
+	}
+	offsets[nkeys] = npairs;
+
+	free (pairs);
+
+	db->search.keys         = keys;
+	db->search.offsets      = offsets;
+	db->search.postings     = postings;
+	db->search.len          = nkeys;
+	db->search.postings_len = npairs;
+}
+
+
+void
+mc_search_free (mc_macdb_t *db)
+{
+	free ((void *) db->search.keys);
+	free ((void *) db->search.offsets);
+	free ((void *) db->search.postings);
+	memset (&db->search, 0, sizeof(db->search));
+}
+
+
+/* Postings of one trigram, or NULL if no name contains it */
+static const uint32_t *
+search_postings (const mc_search_index_t *idx, uint32_t key, uint32_t *len)
+{
+	uint32_t lo = 0, hi = idx->len, mid;
+	uint32_t start, end;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->keys[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == idx->len || idx->keys[lo] != key) {
+		return NULL;
+	}
+
+	start = idx->offsets[lo];
+	end   = idx->offsets[lo+1];
+	if (start > end || end > idx->postings_len) {
+		return NULL;
+	}
+
+	*len = end - start;
+	return idx->postings + start;
+}
+
+
+/* Keeps the rows of 'rows' that are also in 'list'; both ascending */
+static uint32_t
+intersect (uint32_t *rows, uint32_t nrows, const uint32_t *list, uint32_t len)
+{
+	uint32_t i, out = 0, lo = 0, hi, mid;
+
+	for (i=0; i<nrows && lo<len; i++) {
+		/* Gallop, then binary search the rest of 'list' */
+		hi = 1;
+		while (lo + hi < len && list[lo + hi] < rows[i]) {
+			hi *= 2;
+		}
+		hi = (lo + hi < len) ? lo + hi + 1 : len;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (list[mid] < rows[i]) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		if (lo < len && list[lo] == rows[i]) {
+			rows[out++] = rows[i];
+		}
+	}
+
+	return out;
+}
+
+
+static int
+name_contains (const char *name, const char *keyword)
+{
+	size_t i;
+
+	for (; *name; name++) {
+		for (i=0; keyword[i] && fold (name[i]) == fold (keyword[i]); i++);
+		if (keyword[i] == '\0') {
+			return 1;
+		}
+	}
+
+	return keyword[0] == '\0';
+}
+
+
+/* Returns the number of rows whose name contains every keyword,
+ * ignoring case.  The rows are stored, ascending, in a newly
+ * allocated array.
+ */
+uint32_t
+mc_search_query (const mc_macdb_t *db, const char *const *keywords,
+		 size_t nkeywords, uint32_t **result)
+{
+	const mc_search_index_t *idx = &db->search;
+	const uint32_t          *list;
+	uint32_t                 rows = db->others.len + db->wireless.len;
+	uint32_t                *cand;
+	uint32_t                 ncand = 0, len, i, out;
+	size_t                   k, j, klen;
+	int                      filtered = 0;
+
+	cand = (uint32_t *) xmalloc (sizeof(uint32_t) * (rows+1));
+
+	/* Narrow the candidates down with the trigram postings */
+	for (k=0; k<nkeywords; k++) {
+		klen = strlen (keywords[k]);
+		for (j=0; j+3<=klen; j++) {
+			list = search_postings (idx, trigram (keywords[k] + j), &len);
+			if (list == NULL) {
+				ncand = 0;
+				goto done;
+			}
+
+			if (!filtered) {
+				memcpy (cand, list, sizeof(uint32_t) * len);
+				ncand    = len;
+				filtered = 1;
+			} else {
+				ncand = intersect (cand, ncand, list, len);
+			}
+
+			if (ncand == 0) {
+				goto done;
+			}
+		}
+	}
+
+	/* Keywords too short to have trigrams: every row is a candidate */
+	if (!filtered) {
+		for (i=0; i<rows; i++) {
+			cand[i] = i;
+		}
+		ncand = rows;
+	}
+
+	/* Trigrams only tell that a row may match */
+	for (i=0, out=0; i<ncand; i++) {
+		if (cand[i] >= rows) {
+			continue;
+		}
+		for (k=0; k<nkeywords; k++) {
+			if (!name_contains (row_name (db, cand[i]), keywords[k])) {
+				break;
+			}
+		}
+		if (k == nkeywords) {
+			cand[out++] = cand[i];
+		}
+	}
+	ncand = out;
+
+done:
+	*result = cand;
+	return ncand;
+}
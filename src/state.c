@@ -0,0 +1,537 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "state.h"
+#include "macdb.h"
+#include "common.h"
+
+#define STATE_MAGIC    0x3153434d   /* "MCS1" */
+#define STATE_SAVE     1
+#define STATE_FORGET   2
+#define STATE_CHUNK    256          /* records per read */
+#define STATE_SLACK    1024         /* dead records before a rewrite */
+
+/* On disk, in host byte order */
+typedef struct {
+	uint32_t magic;
+	uint16_t type;
+	uint8_t  mac[6];
+	uint32_t index;
+	char     name[16];
+	uint32_t checksum;   /* of the fields above */
+} state_record_t;
+
+struct mc_state {
+	char             *path;
+	int               fd;
+	dev_t             dev;
+	ino_t             ino;
+	off_t             offset;    /* read up to here */
+	size_t            records;   /* in the log */
+	mc_state_entry_t *entries;
+	size_t            len, size, live;
+	uint32_t         *slots;     /* by name: entry + 1, or 0 */
+	size_t            nslots;
+	error_cleanup_t   unlock;    /* while the log is locked */
+};
+
+
+static uint32_t
+name_hash (const char *name)
+{
+	return mc_macdb_checksum (name, strnlen (name, 16));
+}
+
+
+static size_t
+find_slot (const mc_state_t *st, const char *name)
+{
+	size_t slot = name_hash (name) & (st->nslots - 1);
+
+	while (st->slots[slot] != 0 &&
+	       strncmp (st->entries[st->slots[slot] - 1].name, name, 16) != 0) {
+		slot = (slot + 1) & (st->nslots - 1);
+	}
+	return slot;
+}
+
+
+static void
+rehash (mc_state_t *st)
+{
+	size_t i;
+
+	st->nslots = st->nslots ? 2 * st->nslots : 256;
+	free (st->slots);
+	st->slots = (uint32_t *) xcalloc (st->nslots, sizeof(uint32_t));
+	for (i=0; i<st->len; i++) {
+		st->slots[find_slot (st, st->entries[i].name)] = i + 1;
+	}
+}
+
+
+static mc_state_entry_t *
+entry_get (mc_state_t *st, const char *name)
+{
+	size_t slot;
+
+	if (st->nslots == 0) {
+		return NULL;
+	}
+	slot = find_slot (st, name);
+	return st->slots[slot] ? &st->entries[st->slots[slot] - 1] : NULL;
+}
+
+
+static mc_state_entry_t *
+entry_add (mc_state_t *st, const char *name)
+{
+	mc_state_entry_t *e;
+
+	if ((e = entry_get (st, name)) != NULL) {
+		return e;
+	}
+
+	if (2 * (st->len + 1) > st->nslots) {
+		rehash (st);
+	}
+	if (st->len == st->size) {
+		st->size    = st->size ? 2 * st->size : 64;
+		st->entries = (mc_state_entry_t *) xrealloc (st->entries,
+							      st->size * sizeof(mc_state_entry_t));
+	}
+
+	e = &st->entries[st->len];
+	memset (e, 0, sizeof(*e));
+	snprintf (e->name, sizeof(e->name), "%s", name);
+	st->slots[find_slot (st, e->name)] = ++st->len;
+	return e;
+}
+
+
+static void
+record_fill (state_record_t *r, int type, const char *name, unsigned int index, const mac_t *mac)
+{
+	memset (r, 0, sizeof(*r));
+	r->magic = STATE_MAGIC;
+	r->type  = type;
+	r->index = index;
+	snprintf (r->name, sizeof(r->name), "%s", name);
+	if (mac) {
+		memcpy (r->mac, mac->byte, 6);
+	}
+	r->checksum = mc_macdb_checksum (r, offsetof(state_record_t, checksum));
+}
+
+
+static void
+record_apply (mc_state_t *st, const state_record_t *r)
+{
+	mc_state_entry_t *e;
+	char              name[16];
+
+	if (r->magic != STATE_MAGIC ||
+	    r->checksum != mc_macdb_checksum (r, offsetof(state_record_t, checksum))) {
+		return;  /* torn or damaged: skip it */
+	}
+
+	memcpy (name, r->name, sizeof(name));
+	name[sizeof(name)-1] = '\0';
+
+	if (r->type == STATE_SAVE) {
+		e = entry_add (st, name);
+		if (!e->live) {
+			st->live++;
+		}
+		e->index = r->index;
+		e->live  = 1;
+		memcpy (e->mac.byte, r->mac, 6);
+	} else if (r->type == STATE_FORGET && (e = entry_get (st, name)) != NULL && e->live) {
+		e->live = 0;
+		st->live--;
+	}
+}
+
+
+static int
+state_reopen (mc_state_t *st)
+{
+	struct stat sb;
+
+	if (st->fd >= 0) {
+		close (st->fd);
+	}
+	if ((st->fd = open (st->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) < 0 ||
+	    fstat (st->fd, &sb) < 0) {
+		return -1;
+	}
+
+	st->dev     = sb.st_dev;
+	st->ino     = sb.st_ino;
+	st->offset  = 0;
+	st->records = 0;
+	st->len     = 0;
+	st->live    = 0;
+	if (st->nslots) {
+		memset (st->slots, 0, st->nslots * sizeof(uint32_t));
+	}
+	return 0;
+}
+
+
+/* Lets go of the log when an error jumps out with it locked */
+static void
+state_unlock_fd (void *arg)
+{
+	flock (((mc_state_t *) arg)->fd, LOCK_UN);
+}
+
+
+static void
+state_unlock (mc_state_t *st)
+{
+	error_cleanup_pop (&st->unlock);
+	flock (st->fd, LOCK_UN);
+}
+
+
+/* Locks the log and reads what was appended since the last time.  A
+ * log another process rewrote is opened again.
+ */
+static int
+state_lock (mc_state_t *st)
+{
+	state_record_t buf[STATE_CHUNK];
+	struct stat    sb;
+	ssize_t        n;
+	size_t         i;
+	int            err;
+
+	for (;;) {
+		if (flock (st->fd, LOCK_EX) < 0) {
+			return -1;
+		}
+		if (stat (st->path, &sb) == 0 && sb.st_dev == st->dev && sb.st_ino == st->ino) {
+			break;
+		}
+		if (state_reopen (st) < 0) {
+			return -1;
+		}
+	}
+	error_cleanup_push (&st->unlock, state_unlock_fd, st);
+
+	while ((n = pread (st->fd, buf, sizeof(buf), st->offset)) > 0) {
+		for (i=0; i < (size_t) n / sizeof(state_record_t); i++) {
+			record_apply (st, &buf[i]);
+		}
+		st->records += n / sizeof(state_record_t);
+		st->offset  += n - n % sizeof(state_record_t);
+		if (n % sizeof(state_record_t)) {
+			break;
+		}
+	}
+	if (n < 0) {
+		goto fail;
+	}
+
+	/* A write cut short by a crash: drop its remains */
+	if (fstat (st->fd, &sb) == 0 && sb.st_size > st->offset &&
+	    ftruncate (st->fd, st->offset) < 0) {
+		goto fail;
+	}
+	return 0;
+
+fail:
+	err = errno;
+	state_unlock (st);
+	errno = err;
+	return -1;
+}
+
+
+static int
+sync_dir (const char *path)
+{
+	char *copy = xmalloc (strlen (path) + 1);
+	int   fd, ret = -1;
+
+	strcpy (copy, path);
+	if ((fd = open (dirname (copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+		ret = fsync (fd);
+		close (fd);
+	}
+	free (copy);
+	return ret;
+}
+
+
+static int
+write_all (int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t     n;
+
+	while (len > 0) {
+		if ((n = write (fd, p, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p   += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/* Rewrites the log with the live entries only, once most of it is
+ * dead.  Called locked; the new log is in place, and open, before
+ * the old one is let go.
+ */
+static void
+state_compact (mc_state_t *st)
+{
+	state_record_t *records;
+	char           *tmp;
+	size_t          i, n = 0;
+	int             fd;
+
+	if (st->records <= 2 * st->live + STATE_SLACK) {
+		return;
+	}
+
+	records = (state_record_t *) xmalloc ((st->live + 1) * sizeof(state_record_t));
+	for (i=0; i<st->len; i++) {
+		if (st->entries[i].live) {
+			record_fill (&records[n++], STATE_SAVE, st->entries[i].name,
+				     st->entries[i].index, &st->entries[i].mac);
+		}
+	}
+
+	tmp = xmalloc (strlen (st->path) + 5);
+	sprintf (tmp, "%s.tmp", st->path);
+	fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0 || write_all (fd, records, n * sizeof(state_record_t)) < 0 ||
+	    fsync (fd) < 0 || rename (tmp, st->path) < 0) {
+		/* The old log is still good */
+		if (fd >= 0) {
+			close (fd);
+		}
+		unlink (tmp);
+	} else {
+		close (fd);
+		sync_dir (st->path);
+	}
+
+	free (tmp);
+	free (records);
+}
+
+
+/* mkdir -p: the parents are made before 'dir' */
+static void
+make_dirs (char *dir)
+{
+	char *slash;
+
+	for (slash = strchr (dir + 1, '/'); slash; slash = strchr (slash + 1, '/')) {
+		*slash = '\0';
+		mkdir (dir, 0755);
+		*slash = '/';
+	}
+	mkdir (dir, 0700);
+}
+
+
+mc_state_t *
+mc_state_open (const char *path)
+{
+	mc_state_t *st;
+	char       *dir;
+
+	st = (mc_state_t *) xcalloc (1, sizeof(mc_state_t));
+	st->fd   = -1;
+	st->path = xmalloc (strlen (path) + 1);
+	strcpy (st->path, path);
+
+	/* The directories of the default log may not be there yet */
+	dir = xmalloc (strlen (path) + 1);
+	strcpy (dir, path);
+	make_dirs (dirname (dir));
+	free (dir);
+
+	if (state_reopen (st) < 0) {
+		error ("Could not open the state file %s: %s", path, strerror (errno));
+		mc_state_close (st);
+		return NULL;
+	}
+
+	return st;
+}
+
+
+void
+mc_state_close (mc_state_t *st)
+{
+	if (st == NULL) {
+		return;
+	}
+	if (st->fd >= 0) {
+		close (st->fd);
+	}
+	free (st->slots);
+	free (st->entries);
+	free (st->path);
+	free (st);
+}
+
+
+int
+mc_state_load (mc_state_t *st)
+{
+	if (state_lock (st) < 0) {
+		error ("Could not read the state file %s: %s", st->path, strerror (errno));
+		return -1;
+	}
+	state_unlock (st);
+	return 0;
+}
+
+
+const mc_state_entry_t *
+mc_state_find (const mc_state_t *st, const char *name)
+{
+	const mc_state_entry_t *e = entry_get ((mc_state_t *) st, name);
+
+	return (e && e->live) ? e : NULL;
+}
+
+
+const mc_state_entry_t *
+mc_state_entries (const mc_state_t *st, size_t *n)
+{
+	*n = st->len;
+	return st->entries;
+}
+
+
+/* Appends 'n' records and waits for them to reach the disk */
+static int
+state_append (mc_state_t *st, const state_record_t *records, size_t n)
+{
+	size_t i;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if (write_all (st->fd, records, n * sizeof(state_record_t)) < 0 ||
+	    fdatasync (st->fd) < 0) {
+		error ("Could not write the state file %s: %s", st->path, strerror (errno));
+		if (ftruncate (st->fd, st->offset) < 0) {
+			/* Left for the next reader to drop */
+		}
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		record_apply (st, &records[i]);
+	}
+	st->records += n;
+	st->offset  += n * sizeof(state_record_t);
+	return 0;
+}
+
+
+int
+mc_state_save (mc_state_t *st, const mc_state_entry_t *entries, size_t n)
+{
+	const mc_state_entry_t *e;
+	state_record_t         *records;
+	size_t                  i, count = 0;
+	int                     ret;
+
+	if (state_lock (st) < 0) {
+		error ("Could not read the state file %s: %s", st->path, strerror (errno));
+		return -1;
+	}
+
+	records = (state_record_t *) xmalloc ((n + 1) * sizeof(state_record_t));
+	for (i=0; i<n; i++) {
+		e = mc_state_find (st, entries[i].name);
+		if (e == NULL || e->index != entries[i].index) {
+			record_fill (&records[count++], STATE_SAVE, entries[i].name,
+				     entries[i].index, &entries[i].mac);
+		}
+	}
+
+	if ((ret = state_append (st, records, count)) == 0) {
+		state_compact (st);
+	}
+	state_unlock (st);
+	free (records);
+	return ret;
+}
+
+
+int
+mc_state_forget (mc_state_t *st, const char *const *names, size_t n)
+{
+	state_record_t *records;
+	size_t          i, count = 0;
+	int             ret;
+
+	if (state_lock (st) < 0) {
+		error ("Could not read the state file %s: %s", st->path, strerror (errno));
+		return -1;
+	}
+
+	records = (state_record_t *) xmalloc ((n + 1) * sizeof(state_record_t));
+	for (i=0; i<n; i++) {
+		if (mc_state_find (st, names[i]) != NULL) {
+			record_fill (&records[count++], STATE_FORGET, names[i], 0, NULL);
+		}
+	}
+
+	if ((ret = state_append (st, records, count)) == 0) {
+		state_compact (st);
+	}
+	state_unlock (st);
+	free (records);
+	return ret;
+}
@@ -0,0 +1,78 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* MAC Changer
+ *
+ * Authors:
+ *      Alvaro Lopez Ortega <alvaro@alobbs.com>
+ *
+ * Copyright (C) 2002,2013 Alvaro Lopez Ortega
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#ifndef __MAC_CHANGER_STATE_H__
+#define __MAC_CHANGER_STATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mac.h"
+
+/* Original addresses, kept across runs
+ *
+ * The address an interface had before it was first changed is saved
+ * in an append-only log of fixed size records, keyed by name and
+ * ifindex, so it can be put back even for interfaces without a
+ * permanent address.  A record carries its own checksum; a record
+ * torn by a crash fails it and is dropped, and everything before it
+ * stands.  Records are on disk before the change they guard is made.
+ *
+ * Every process using the log takes flock() on it, and reads what
+ * others appended before acting.  Once most records are dead the log
+ * is rewritten with the live ones and renamed into place.
+ */
+
+#define MC_STATE_FILE  "state"
+
+typedef struct {
+	unsigned int index;
+	char         name[16];
+	mac_t        mac;
+	int          live;
+} mc_state_entry_t;
+
+typedef struct mc_state mc_state_t;
+
+mc_state_t *mc_state_open   (const char *path);
+void        mc_state_close  (mc_state_t *);
+
+/* Brings the entries up to date with the log */
+int         mc_state_load   (mc_state_t *);
+
+/* The live entry of 'name', or NULL; valid until the next call */
+const mc_state_entry_t *mc_state_find (const mc_state_t *, const char *name);
+
+/* Every entry, dead ones included */
+const mc_state_entry_t *mc_state_entries (const mc_state_t *, size_t *n);
+
+/* Saves the entries whose interface has none yet, or whose ifindex
+ * changed; the others are left as they are.  Returns once the log is
+ * on disk.
+ */
+int         mc_state_save   (mc_state_t *, const mc_state_entry_t *, size_t n);
+int         mc_state_forget (mc_state_t *, const char *const *names, size_t n);
+
+#endif /* __MAC_CHANGER_STATE_H__ */
@@ -30,6 +30,53 @@ SLASHES = '|/-\\'
 URL     = 'http://standards.ieee.org/regauth/oui/oui.txt'
 OUTPUT  = 'OUI.list'
 
+# MA-M (28-bit) and MA-S (36-bit) registries: (input, output, number
+# of extra hex digits after the OUI).  They are only converted from
+# local copies of the IEEE files.
+REGISTRIES = [('mam.txt',   'MA-M.list', 1),
+              ('oui36.txt', 'MA-S.list', 3)]
+
+def convert_registry (infile, outfile, extra):
+    try:
+        f = open (infile, "r")
+        print "Reading file %s" % (infile)
+        content = f.read()
+        f.close()
+    except IOError:
+        print "Skipping %s: no local copy" % (infile)
+        return
+
+    try:
+        output = open (outfile, "w")
+    except IOError:
+        print "Cannot open %s for writting" % (outfile)
+        raise SystemExit
+
+    # Each assignment is a "(hex)" line with the OUI followed by a
+    # "(base 16)" line with the range inside it
+    oui = None
+    for l in split (content, '\n'):
+        found = re.findall (r'(\S\S)-(\S\S)-(\S\S)\s+\(hex\)', l)
+        if found:
+            oui = found[0]
+            continue
+
+        found = re.findall (r'([0-9A-Fa-f]{6})-[0-9A-Fa-f]{6}\s+\(base 16\)\s+([\S ]+)', l)
+        if found and oui:
+            digits = found[0][0][:extra].upper()
+            if extra == 1:
+                prefix = '%s %s %s %s' %(oui[0], oui[1], oui[2], digits)
+            else:
+                prefix = '%s %s %s %s %s' %(oui[0], oui[1], oui[2], digits[:2], digits[2:])
+            newline = '%s %s' %(prefix, found[0][1].strip())
+            print 'Adding prefix: %s\r' % (prefix),
+            output.write (newline + '\n')
+            oui = None
+
+    print
+    output.close()
+
+
 def download ():
     http = urllib2.urlopen(URL)
 
@@ -76,3 +123,6 @@ for l in split (content, '\n'):
 
 print
 output.close()
+
+for (infile, outfile, extra) in REGISTRIES:
+    convert_registry (infile, outfile, extra)